@@ -78,8 +78,17 @@ struct mbuf { };
  */
 int mg_printf(struct mg_connection *, const char *fmt, ...);
 
+/*
+ * Sends data to the connection.
+ */
+void mg_send(struct mg_connection *, const void *buf, int len);
+
 struct mg_str mg_mk_str_n(const char *s, size_t len);
 int mg_vcmp(const struct mg_str *str2, const char *str1);
+int mg_vcasecmp(const struct mg_str *str2, const char *str1);
+struct mg_str *mg_get_http_header(struct http_message *hm, const char *name);
+int mg_get_http_var(const struct mg_str *buf, const char *name, char *dst,
+		    size_t dst_len);
 
 /*
  * Callback function (event handler) prototype. Must be defined by the user.
@@ -465,4 +474,23 @@ void mg_mgr_free(struct mg_mgr *);
  */
 time_t mg_mgr_poll(struct mg_mgr *, int milli);
 
+/*
+ * Iterates over all active connections.
+ *
+ * Returns the next connection from the list of active connections, or
+ * `NULL` if there are no more connections.
+ */
+struct mg_connection *mg_next(struct mg_mgr *mgr, struct mg_connection *c);
+
+#if MG_ENABLE_BROADCAST
+/*
+ * Passes a message of a given length to all connections.
+ *
+ * Must be called from a thread that does NOT call `mg_mgr_poll()`.
+ * `cb` is called on the `mg_mgr_poll()` thread for each connection.
+ */
+void mg_broadcast(struct mg_mgr *mgr, mg_event_handler_t cb, void *data,
+		  size_t len);
+#endif
+
 void mg_set_protocol_http_websocket(struct mg_connection *nc);
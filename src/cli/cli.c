@@ -77,6 +77,7 @@ enum { HUMAN = 0, RAW = -1, JSON = 1 };
 #define _LINK		"link"
 #define _UNLINK		"unlink"
 #define _USAGE		"usage"
+#define _HEALTH		"health"
 #define _INB_MGMT	"inband"
 #define _OOB_MGMT	"outofband"
 #define _LOCAL_MGMT	"local"
@@ -85,6 +86,8 @@ enum { HUMAN = 0, RAW = -1, JSON = 1 };
 
 #define DELETE_PROMPT	"Are you sure you want to delete "
 
+#define LIST_PAGE_SIZE	500
+
 struct verbs {
 	int		(*function)(char *base, int n, char **p);
 	int		 target;
@@ -141,6 +144,95 @@ static inline int formatted_json(json_t *json)
 	return 0;
 }
 
+/*
+ * Lists are fetched a page at a time, following the cursor each reply
+ * ends with, so the DEM never has to build the whole collection at once.
+ * A reply that is not a page, e.g. an error, is printed as it came and
+ * no list is returned.
+ */
+static int get_list(char *base, char *tag, json_t **list)
+{
+	json_t			*page;
+	json_t			*next;
+	json_error_t		 error;
+	char			 url[512];
+	char			*cursor = NULL;
+	char			*result;
+	int			 ret;
+
+	*list = json_object();
+	json_object_set_new(*list, tag, json_array());
+
+	do {
+		if (cursor)
+			snprintf(url, sizeof(url), "%s?%s=%d&%s=%s", base,
+				 URI_PARM_LIMIT, LIST_PAGE_SIZE,
+				 URI_PARM_AFTER, cursor);
+		else
+			snprintf(url, sizeof(url), "%s?%s=%d", base,
+				 URI_PARM_LIMIT, LIST_PAGE_SIZE);
+
+		curl_free(cursor);
+		cursor = NULL;
+
+		ret = exec_get(url, &result);
+		if (ret)
+			goto err;
+
+		page = json_loads(result, JSON_DECODE_ANY, &error);
+		if (!page) {
+			printf("%s\n", result);
+			free(result);
+			goto err;
+		}
+
+		free(result);
+
+		json_array_extend(json_object_get(*list, tag),
+				  json_object_get(page, tag));
+
+		next = json_object_get(page, TAG_NEXT);
+		if (next && json_is_string(next))
+			cursor = curl_easy_escape(NULL,
+						  json_string_value(next), 0);
+
+		json_decref(page);
+	} while (cursor);
+
+	return 0;
+err:
+	json_decref(*list);
+	*list = NULL;
+
+	return ret;
+}
+
+static int show_list(char *url, char *tag, void (*show)(json_t *parent))
+{
+	json_t			*parent;
+	char			*str;
+	int			 ret;
+
+	ret = get_list(url, tag, &parent);
+	if (ret || !parent)
+		return ret;
+
+	if (formatted == RAW) {
+		str = json_dumps(parent, 0);
+		if (str) {
+			printf("%s\n", str);
+			free(str);
+		}
+	} else if (formatted)
+		formatted_json(parent);
+	else
+		show(parent);
+
+	json_decref(parent);
+
+	return 0;
+}
+
 /* DEM */
 
 static int dem_config(char *base, int n, char **p)
@@ -195,38 +287,10 @@ static int dem_shutdown(char *base, int n, char **p)
 
 static int list_group(char *url, int n, char **p)
 {
-	char			*result;
-	json_t			*parent;
-	json_error_t		 error;
-	int			 ret;
-
 	UNUSED(n);
 	UNUSED(p);
 
-	ret = exec_get(url, &result);
-	if (ret)
-		return ret;
-
-	if (formatted == RAW)
-		goto err;
-
-	parent = json_loads(result, JSON_DECODE_ANY, &error);
-	if (!parent)
-		goto err;
-
-	if (formatted) {
-		if (formatted_json(parent))
-			goto err;
-	} else
-		show_group_list(parent);
-
-	goto out;
-err:
-	printf("%s\n", result);
-out:
-	free(result);
-
-	return 0;
+	return show_list(url, TAG_GROUPS, show_group_list);
 }
 
 static int add_group(char *base, int n, char **p)
@@ -335,40 +399,17 @@ static int rename_group(char *base, int n, char **p)
 
 /* TARGETS */
 
-static int list_target(char *url, int n, char **p)
+static void show_targets(json_t *parent)
 {
-	char			*result;
-	json_t			*parent;
-	json_error_t		 error;
-	int			 ret;
+	show_target_list(parent, 0);
+}
 
+static int list_target(char *url, int n, char **p)
+{
 	UNUSED(n);
 	UNUSED(p);
 
-	ret = exec_get(url, &result);
-	if (ret)
-		return ret;
-
-	if (formatted == RAW)
-		goto err;
-
-	parent = json_loads(result, JSON_DECODE_ANY, &error);
-	if (!parent)
-		goto err;
-
-	if (formatted) {
-		if (formatted_json(parent))
-			goto err;
-	} else
-		show_target_list(parent, 0);
-
-	goto out;
-err:
-	printf("%s\n", result);
-out:
-	free(result);
-
-	return 0;
+	return show_list(url, TAG_TARGETS, show_targets);
 }
 
 static int add_target(char *base, int n, char **p)
@@ -660,6 +701,47 @@ out:
 	return 0;
 }
 
+static int health_target(char *base, int n, char **p)
+{
+	char			 url[128];
+	char			*result;
+	char			*alias = *p;
+	json_t			*parent;
+	json_error_t		 error;
+	int			 ret;
+
+	UNUSED(n);
+
+	snprintf(url, sizeof(url), "%s/%s/%s", base, alias, URI_HEALTH);
+
+	ret = exec_get(url, &result);
+	if (ret)
+		return ret;
+
+	if (formatted == RAW)
+		goto err;
+
+	parent = json_loads(result, JSON_DECODE_ANY, &error);
+	if (!parent)
+		goto err;
+
+	if (formatted) {
+		if (formatted_json(parent))
+			goto err;
+	} else
+		show_health_data(parent);
+
+	json_decref(parent);
+
+	goto out;
+err:
+	printf("%s\n", result);
+out:
+	free(result);
+
+	return 0;
+}
+
 /* SUBSYSTEMS */
 
 static int add_subsys(char *base, int n, char **p)
@@ -934,40 +1016,17 @@ static int del_ns(char *base, int n, char **p)
 
 /* HOSTS */
 
-static int list_host(char *url, int n, char **p)
+static void show_hosts(json_t *parent)
 {
-	char			*result;
-	json_t			*parent;
-	json_error_t		 error;
-	int			 ret;
+	show_host_list(parent, 0);
+}
 
+static int list_host(char *url, int n, char **p)
+{
 	UNUSED(n);
 	UNUSED(p);
 
-	ret = exec_get(url, &result);
-	if (ret)
-		return ret;
-
-	if (formatted == RAW)
-		goto err;
-
-	parent = json_loads(result, JSON_DECODE_ANY, &error);
-	if (!parent)
-		goto err;
-
-	if (formatted) {
-		if (formatted_json(parent))
-			goto err;
-	} else
-		show_host_list(parent, 0);
-
-	goto out;
-err:
-	printf("%s\n", result);
-out:
-	free(result);
-
-	return 0;
+	return show_list(url, TAG_HOSTS, show_hosts);
 }
 
 static int add_host(char *base, int n, char **p)
@@ -1141,7 +1200,7 @@ static int unlink_host(char *base, int n, char **p)
 static struct verbs verb_list[] = {
 	/* DEM */
 	{ dem_config,	 DEM,     0, _CONFIG,   NULL, NULL,
-	  "show dem configuration including interfaces" },
+	  "show dem configuration including interfaces and startup status" },
 	{ dem_shutdown,	 DEM,     0, _SHUTDOWN, NULL, NULL,
 	  "signal the dem to shutdown" },
 
@@ -1188,6 +1247,8 @@ static struct verbs verb_list[] = {
 	  "signal the dem to reconfigure the target" },
 	{ usage_target,	 TARGET,  1, "usage", _TARGET, "<alias>",
 	  "get usage for subsystems of a target" },
+	{ health_target, TARGET,  1, _HEALTH, _TARGET, "<alias>",
+	  "show the health of a target and when it is next retried" },
 	{ link_target,	 GROUP,   2, _LINK,  _TARGET, "<alias> <group>",
 	  "link a target to a group (using PUT)" },
 	{ unlink_target, GROUP,   2, _UNLINK,  _TARGET, "<alias> <group>",
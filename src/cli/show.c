@@ -403,6 +403,32 @@ void show_usage_data(json_t *parent)
 	UNUSED(parent);
 }
 
+void show_health_data(json_t *parent)
+{
+	json_t			*obj;
+
+	obj = json_object_get(parent, TAG_ALIAS);
+	if (!obj)
+		return;
+
+	printf("%s '%s' ", TAG_TARGET, json_string_value(obj));
+
+	obj = json_object_get(parent, TAG_STATE);
+	printf("is %s", obj ? json_string_value(obj) : "unknown");
+
+	obj = json_object_get(parent, TAG_FAILURES);
+	if (obj && json_integer_value(obj))
+		printf(", %lld consecutive failures",
+		       (long long) json_integer_value(obj));
+
+	obj = json_object_get(parent, TAG_NEXT_RETRY);
+	if (obj)
+		printf(", next retry in %lld seconds",
+		       (long long) json_integer_value(obj));
+
+	printf("\n");
+}
+
 void show_target_data(json_t *parent)
 {
 	json_t			*attrs;
@@ -547,6 +573,30 @@ void show_group_data(json_t *parent)
 	printf("\n");
 }
 
+static void show_startup(json_t *parent)
+{
+	json_t			*obj;
+	int			 total, ready, failed;
+
+	if (!parent)
+		return;
+
+	obj = json_object_get(parent, TAG_TARGETS);
+	total = obj ? json_integer_value(obj) : 0;
+
+	obj = json_object_get(parent, TAG_READY);
+	ready = obj ? json_integer_value(obj) : 0;
+
+	obj = json_object_get(parent, TAG_FAILED);
+	failed = obj ? json_integer_value(obj) : 0;
+
+	obj = json_object_get(parent, TAG_COMPLETE);
+
+	printf("%s: %d of %d targets ready, %d failed%s\n", TAG_STARTUP,
+	       ready, total, failed,
+	       (obj && json_is_true(obj)) ? "" : " (in progress)");
+}
+
 void show_config(json_t *parent)
 {
 	json_t			*array;
@@ -597,7 +647,9 @@ void show_config(json_t *parent)
 
 	printf("\n");
 
-	return;
+	goto startup;
 err:
 	printf("No Interfaces defined\n");
+startup:
+	show_startup(json_object_get(parent, TAG_STARTUP));
 }
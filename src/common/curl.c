@@ -54,14 +54,52 @@ struct curl_context {
 	int read_sz;
 };
 
-static struct curl_context	*ctx;
-static int			 debug_curl;
+/* one easy handle per thread so target work can run in parallel */
+static __thread struct curl_context	*ctx;
+static int				 debug_curl;
+
+/* endpoints worked on at once by a batch, the rest wait their turn */
+#define CURL_BATCH_PARALLEL	16
+#define MAX_ORIGIN_SIZE		128
+
+struct curl_request {
+	struct curl_request	*next;
+	void			*owner;
+	const char		*method;
+	char			*url;
+	char			*data;
+	int			 len;
+};
 
-#ifdef CURLINFO_CONTENT_LENGTH_DOWNLOAD_T
-#define CURLINFO_CONTENT_LENGTH CURLINFO_CONTENT_LENGTH_DOWNLOAD_T
-#else
-#define CURLINFO_CONTENT_LENGTH CURLINFO_CONTENT_LENGTH_DOWNLOAD
-#endif
+/*
+ * Requests to one endpoint are sent in order on a handle of its own, so
+ * that a subsystem exists before its namespaces are added; requests to
+ * different endpoints are in flight together.  Endpoints are kept for the
+ * life of the thread so their connections can be reused by later batches.
+ */
+struct curl_endpoint {
+	struct curl_endpoint	*next;
+	char			 origin[MAX_ORIGIN_SIZE];
+	CURL			*curl;
+	struct curl_request	*head;
+	struct curl_request	**tail;
+	struct curl_request	*busy;
+	char			*write_data;
+	size_t			 write_sz;
+};
+
+struct curl_batch {
+	CURLM			*multi;
+	struct curl_endpoint	*endpoints;
+	void			*owner;
+	int			 depth;
+	int			 active;
+	int			 ret;
+	curl_batch_cb		 failed;
+	void			*arg;
+};
+
+static __thread struct curl_batch	*batch;
 
 static size_t read_cb(char *p, size_t size, size_t n, void *stream)
 {
@@ -104,62 +142,407 @@ static size_t write_cb(void *contents, size_t size, size_t n, void *stream)
 	return bytes;
 }
 
-int init_curl(int debug)
+static struct curl_context *alloc_curl_context(void)
 {
+	struct curl_context	*context;
 	CURL			*curl;
 
-	debug_curl = debug;
-
-	ctx = malloc(sizeof(*ctx));
-	if (!ctx) {
+	context = malloc(sizeof(*context));
+	if (!context) {
 		fprintf(stderr, "unable to alloc memory for curl context\n");
-		return -ENOMEM;
+		return NULL;
 	}
 
-	curl_global_init(CURL_GLOBAL_ALL);
-
 	curl = curl_easy_init();
 	if (!curl) {
 		fprintf(stderr, "unable to init curl");
-		free(ctx);
-		return -EINVAL;
+		free(context);
+		return NULL;
 	}
 
 	/* will be grown as needed by the realloc in write_cb */
-	ctx->write_data = malloc(1);
-	if (!ctx->write_data)
-		return -ENOMEM;
+	context->write_data = malloc(1);
+	if (!context->write_data) {
+		curl_easy_cleanup(curl);
+		free(context);
+		return NULL;
+	}
 
-	ctx->write_sz = 0;    /* no data at this point */
-	ctx->write_data[0] = 0;
+	context->write_sz = 0;    /* no data at this point */
+	context->write_data[0] = 0;
 
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,	(void *) write_cb);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA,	(void *) ctx);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA,	(void *) context);
 	curl_easy_setopt(curl, CURLOPT_READFUNCTION,	(void *) read_cb);
-	curl_easy_setopt(curl, CURLOPT_READDATA,	(void *) ctx);
+	curl_easy_setopt(curl, CURLOPT_READDATA,	(void *) context);
+	/* take any encoding curl can decode, large replies come gzipped */
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING,	"");
+
+	context->curl = curl;
+
+	return context;
+}
+
+static CURL *get_curl(void)
+{
+	if (!ctx)
+		ctx = alloc_curl_context();
+
+	return ctx ? ctx->curl : NULL;
+}
+
+static size_t batch_write_cb(void *contents, size_t size, size_t n,
+			     void *stream)
+{
+	struct curl_endpoint	*ep = stream;
+	size_t			 bytes = size * n;
+	char			*p;
+
+	p = realloc(ep->write_data, ep->write_sz + bytes + 1);
+	if (!p)
+		return 0;
+
+	memcpy(p + ep->write_sz, contents, bytes);
+	ep->write_sz += bytes;
+	p[ep->write_sz] = 0;
+	ep->write_data = p;
+
+	return bytes;
+}
+
+static void free_request(struct curl_request *req)
+{
+	free(req->url);
+	free(req->data);
+	free(req);
+}
+
+static void free_curl_batch(void)
+{
+	struct curl_endpoint	*ep, *next;
+	struct curl_request	*req;
+
+	if (!batch)
+		return;
+
+	for (ep = batch->endpoints; ep; ep = next) {
+		next = ep->next;
+
+		if (ep->busy) {
+			curl_multi_remove_handle(batch->multi, ep->curl);
+			free_request(ep->busy);
+		}
+
+		while ((req = ep->head)) {
+			ep->head = req->next;
+			free_request(req);
+		}
+
+		curl_easy_cleanup(ep->curl);
+		free(ep->write_data);
+		free(ep);
+	}
 
-	ctx->curl = curl;
+	curl_multi_cleanup(batch->multi);
+	free(batch);
+
+	batch = NULL;
+}
+
+static struct curl_endpoint *get_endpoint(char *url)
+{
+	struct curl_endpoint	*ep;
+	char			 origin[MAX_ORIGIN_SIZE];
+	char			*p;
+	int			 len;
+
+	p = strstr(url, "://");
+	p = strchr(p ? p + 3 : url, '/');
+	len = p ? p - url : (int) strlen(url);
+	if (len >= MAX_ORIGIN_SIZE)
+		len = MAX_ORIGIN_SIZE - 1;
+
+	memcpy(origin, url, len);
+	origin[len] = 0;
+
+	for (ep = batch->endpoints; ep; ep = ep->next)
+		if (!strcmp(ep->origin, origin))
+			return ep;
+
+	ep = calloc(1, sizeof(*ep));
+	if (!ep)
+		return NULL;
+
+	ep->curl = curl_easy_init();
+	if (!ep->curl) {
+		free(ep);
+		return NULL;
+	}
+
+	strcpy(ep->origin, origin);
+	ep->tail = &ep->head;
+
+	curl_easy_setopt(ep->curl, CURLOPT_WRITEFUNCTION, batch_write_cb);
+	curl_easy_setopt(ep->curl, CURLOPT_WRITEDATA,	 (void *) ep);
+	curl_easy_setopt(ep->curl, CURLOPT_PRIVATE,	 (void *) ep);
+	curl_easy_setopt(ep->curl, CURLOPT_ACCEPT_ENCODING, "");
+#ifndef DEM_CLI
+	curl_easy_setopt(ep->curl, CURLOPT_FAILONERROR,	 1L);
+#endif
+
+	ep->next = batch->endpoints;
+	batch->endpoints = ep;
+
+	return ep;
+}
+
+static int queue_request(const char *method, char *url, char *data, int len)
+{
+	struct curl_endpoint	*ep;
+	struct curl_request	*req;
+
+	ep = get_endpoint(url);
+	if (!ep)
+		return -ENOMEM;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return -ENOMEM;
+
+	req->url = strdup(url);
+	req->data = malloc(len + 1);
+	if (!req->url || !req->data) {
+		free_request(req);
+		return -ENOMEM;
+	}
+
+	if (len)
+		memcpy(req->data, data, len);
+	req->data[len] = 0;
+
+	req->len = len;
+	req->method = method;
+	req->owner = batch->owner;
+
+	if (debug_curl) {
+		printf("%s %s (queued)\n", method, url);
+		if (len)
+			printf("<< %.*s >>\n", len, data);
+	}
+
+	*ep->tail = req;
+	ep->tail = &req->next;
 
 	return 0;
 }
 
-void cleanup_curl(void)
+static void start_request(struct curl_endpoint *ep)
 {
-	CURL			*curl = ctx->curl;
+	struct curl_request	*req = ep->head;
+	CURL			*curl = ep->curl;
 
-	curl_easy_cleanup(curl);
+	ep->head = req->next;
+	if (!ep->head)
+		ep->tail = &ep->head;
 
-	curl_global_cleanup();
+	ep->busy = req;
+	ep->write_sz = 0;
+
+	curl_easy_setopt(curl, CURLOPT_URL, req->url);
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, req->method);
+
+	if (strcmp(req->method, "DELETE") || req->len) {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, req->data);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) req->len);
+	} else
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+
+	curl_multi_add_handle(batch->multi, curl);
+	batch->active++;
+}
+
+static void fail_request(struct curl_request *req, int ret)
+{
+	if (!batch->ret)
+		batch->ret = ret;
+
+	if (batch->failed)
+		batch->failed(req->owner, ret, batch->arg);
+}
+
+static void complete_request(struct curl_endpoint *ep, CURLcode res)
+{
+	struct curl_request	*req = ep->busy;
+	int			 ret = 0;
+
+	curl_multi_remove_handle(batch->multi, ep->curl);
+	batch->active--;
+	ep->busy = NULL;
+
+	if (res == CURLE_OK) {
+		if (curl_show_results && ep->write_sz)
+			printf("%s\n", ep->write_data);
+	} else if (res == CURLE_COULDNT_CONNECT ||
+		   res == CURLE_OPERATION_TIMEDOUT)
+		ret = -ECONNREFUSED;
+	else
+		ret = -EINVAL;
+
+	if (ret) {
+		fprintf(stderr, "curl %s %s returned error %s (%d)\n",
+			req->method, req->url, curl_easy_strerror(res), res);
+		fail_request(req, ret);
+	}
+
+	free_request(req);
+
+	/* no point waiting out the timeout again for each queued request */
+	if (ret == -ECONNREFUSED)
+		while ((req = ep->head)) {
+			ep->head = req->next;
+			fail_request(req, ret);
+			free_request(req);
+		}
+
+	if (!ep->head)
+		ep->tail = &ep->head;
+}
+
+/*
+ * Until the matching curl_batch_end(), PUT, POST, PATCH and DELETE requests
+ * made by this thread are queued rather than sent and report success.  GETs
+ * are always sent at once.  Batches may nest; only the outermost end sends.
+ */
+int curl_batch_begin(void)
+{
+	if (!batch) {
+		batch = calloc(1, sizeof(*batch));
+		if (!batch)
+			return -ENOMEM;
+
+		batch->multi = curl_multi_init();
+		if (!batch->multi) {
+			free(batch);
+			batch = NULL;
+			return -ENOMEM;
+		}
+
+		curl_multi_setopt(batch->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+				  (long) CURL_BATCH_PARALLEL);
+	}
+
+	if (!batch->depth++) {
+		batch->owner = NULL;
+		batch->ret = 0;
+	}
+
+	return 0;
+}
+
+/* tag the requests queued from here on, e.g. with the target they are for */
+void curl_batch_owner(void *owner)
+{
+	if (batch)
+		batch->owner = owner;
+}
+
+/*
+ * Send everything queued and wait for it.  failed() is called with the
+ * owner of each request that did not succeed; the first error is returned.
+ */
+int curl_batch_end(curl_batch_cb failed, void *arg)
+{
+	struct curl_endpoint	*ep;
+	struct CURLMsg		*msg;
+	int			 running;
+	int			 left;
+
+	if (!batch || !batch->depth)
+		return -EINVAL;
+
+	if (--batch->depth)
+		return 0;
+
+	batch->failed = failed;
+	batch->arg = arg;
+
+	for (ep = batch->endpoints; ep; ep = ep->next)
+		if (ep->head)
+			start_request(ep);
+
+	while (batch->active) {
+		curl_multi_perform(batch->multi, &running);
+
+		while ((msg = curl_multi_info_read(batch->multi, &left))) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+					  (char **) &ep);
+
+			complete_request(ep, msg->data.result);
+
+			if (ep->head)
+				start_request(ep);
+		}
+
+		if (batch->active)
+			curl_multi_wait(batch->multi, NULL, 0, 1000, NULL);
+	}
+
+	batch->failed = NULL;
+	batch->arg = NULL;
+	batch->owner = NULL;
+
+	return batch->ret;
+}
+
+static inline int batch_open(void)
+{
+	return batch && batch->depth;
+}
+
+int init_curl(int debug)
+{
+	debug_curl = debug;
+
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	if (!get_curl()) {
+		curl_global_cleanup();
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* release the calling thread's handles */
+void free_curl_context(void)
+{
+	free_curl_batch();
+
+	if (!ctx)
+		return;
+
+	curl_easy_cleanup(ctx->curl);
 
 	free(ctx->write_data);
 	free(ctx);
+
+	ctx = NULL;
+}
+
+void cleanup_curl(void)
+{
+	free_curl_context();
+
+	curl_global_cleanup();
 }
 
 static int exec_curl(char *url, char **p)
 {
 	CURL			*curl = ctx->curl;
 	CURLcode		 ret;
-	curl_off_t		 bytes;
 
 	curl_easy_setopt(curl, CURLOPT_URL, url);
 #ifndef DEM_CLI
@@ -168,9 +551,9 @@ static int exec_curl(char *url, char **p)
 
 	ret = curl_easy_perform(curl);
 
+	/* all that was decoded, Content-Length is the size on the wire */
 	if (ret == CURLE_OK) {
-		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH, &bytes);
-		*p = strndup(ctx->write_data, bytes);
+		*p = strndup(ctx->write_data, ctx->write_sz);
 	} else if (ret == CURLE_COULDNT_CONNECT) {
 		fprintf(stderr, "curl returned error %s (%d) errno %d\n",
 			curl_easy_strerror(ret), ret, errno);
@@ -193,9 +576,12 @@ static int exec_curl(char *url, char **p)
 
 int exec_get(char *url, char **result)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl = get_curl();
 	int			 ret;
 
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1);
 
 	if (debug_curl)
@@ -210,10 +596,17 @@ int exec_get(char *url, char **result)
 
 int exec_put(char *url, char *data, int len)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl;
 	char			*result;
 	int			 ret;
 
+	if (batch_open())
+		return queue_request("PUT", url, data, len);
+
+	curl = get_curl();
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_PUT, 1);
 
 	ctx->read_data = data;
@@ -242,10 +635,17 @@ int exec_put(char *url, char *data, int len)
 
 int exec_post(char *url, char *data, int len)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl;
 	char			*result;
 	int			 ret;
 
+	if (batch_open())
+		return queue_request("POST", url, data, len);
+
+	curl = get_curl();
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_HTTPPOST, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
@@ -273,10 +673,17 @@ int exec_post(char *url, char *data, int len)
 
 int exec_delete(char *url)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl;
 	char			*result;
 	int			 ret;
 
+	if (batch_open())
+		return queue_request("DELETE", url, NULL, 0);
+
+	curl = get_curl();
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
 
 	if (debug_curl)
@@ -299,10 +706,17 @@ int exec_delete(char *url)
 
 int exec_delete_ex(char *url, char *data, int len)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl;
 	char			*result;
 	int			 ret;
 
+	if (batch_open())
+		return queue_request("DELETE", url, data, len);
+
+	curl = get_curl();
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
@@ -330,10 +744,17 @@ int exec_delete_ex(char *url, char *data, int len)
 
 int exec_patch(char *url, char *data, int len)
 {
-	CURL			*curl = ctx->curl;
+	CURL			*curl;
 	char			*result;
 	int			 ret;
 
+	if (batch_open())
+		return queue_request("PATCH", url, data, len);
+
+	curl = get_curl();
+	if (!curl)
+		return -ENOMEM;
+
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, len);
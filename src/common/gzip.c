@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#include "common.h"
+
+#define GZIP_WINDOW		(15 + 16)	/* max window, gzip wrapper */
+#define GZIP_MEM_LEVEL		8
+
+/*
+ * REST replies of GZIP_MIN_SIZE bytes or more are sent gzip encoded to
+ * clients whose Accept-Encoding takes it; smaller ones are not worth it.
+ */
+
+/* a coding in an Accept-Encoding list, unless its q is zero */
+static bool coding_accepted(const char *p, size_t len, const char *coding)
+{
+	size_t			 n = strlen(coding);
+	const char		*q;
+
+	while (len && *p == ' ') {
+		p++;
+		len--;
+	}
+
+	if (len < n || strncasecmp(p, coding, n))
+		return false;
+
+	p += n;
+	len -= n;
+
+	while (len && *p == ' ') {
+		p++;
+		len--;
+	}
+
+	if (!len)
+		return true;
+
+	if (*p != ';')
+		return false;
+
+	q = memchr(p, '=', len);
+	if (!q)
+		return true;
+
+	/* q=0, q=0.0, q=0.000 all refuse it */
+	for (q++; q < p + len; q++)
+		if (*q >= '1' && *q <= '9')
+			return true;
+
+	return false;
+}
+
+bool gzip_accepted(const char *hdr, size_t len)
+{
+	const char		*end = hdr + len;
+	const char		*next;
+
+	for (; hdr < end; hdr = next + 1) {
+		next = memchr(hdr, ',', end - hdr);
+		if (!next)
+			next = end;
+
+		if (coding_accepted(hdr, next - hdr, "gzip") ||
+		    coding_accepted(hdr, next - hdr, "*"))
+			return true;
+	}
+
+	return false;
+}
+
+/* a gzip copy of len bytes, NULL if it fails or would not be smaller */
+char *gzip_body(const char *body, size_t len, size_t *gz_len)
+{
+	z_stream		 zs;
+	char			*gz;
+	size_t			 size;
+	int			 ret;
+
+	memset(&zs, 0, sizeof(zs));
+
+	ret = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW,
+			   GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK)
+		return NULL;
+
+	size = deflateBound(&zs, len);
+
+	gz = malloc(size);
+	if (!gz)
+		goto out;
+
+	zs.next_in = (Bytef *) body;
+	zs.avail_in = len;
+	zs.next_out = (Bytef *) gz;
+	zs.avail_out = size;
+
+	ret = deflate(&zs, Z_FINISH);
+	if (ret != Z_STREAM_END || zs.total_out >= len) {
+		free(gz);
+		gz = NULL;
+		goto out;
+	}
+
+	*gz_len = zs.total_out;
+out:
+	deflateEnd(&zs);
+
+	return gz;
+}
@@ -395,7 +395,8 @@ out:
 	return ret;
 }
 
-int send_mi_send(struct endpoint *ep, int fcid, int len, void *data)
+static int _send_mi_send(struct endpoint *ep, int fcid, int len, void *data,
+			 u64 *result)
 {
 	struct nvme_command		*cmd = ep->cmd;
 	struct xp_mr			*mr;
@@ -426,13 +427,25 @@ int send_mi_send(struct endpoint *ep, int fcid, int len, void *data)
 
 	do {
 		usleep(CONFIG_TIMEOUT);
-		ret = process_nvme_rsp(ep, 0, NULL);
+		ret = process_nvme_rsp(ep, 0, result);
 	} while (ret == -EAGAIN && --cnt);
 out:
 
 	return ret;
 }
 
+int send_mi_send(struct endpoint *ep, int fcid, int len, void *data)
+{
+	return _send_mi_send(ep, fcid, len, data, NULL);
+}
+
+int send_mi_send_batch(struct endpoint *ep, int len, void *data, u64 *failed)
+{
+	*failed = 0;
+
+	return _send_mi_send(ep, nvmf_batch_config, len, data, failed);
+}
+
 static int send_get_property(struct endpoint *ep, u32 reg)
 {
 	struct nvme_command		*cmd = ep->cmd;
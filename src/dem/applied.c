@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "common.h"
+
+/*
+ * Record of the config objects the DEM has successfully pushed to each
+ * target.  Reconfiguring a target compares it against the state built
+ * from the target's subsystems and ports and only pushes the difference.
+ * The record is dropped whenever the endpoint may have lost or changed
+ * its config behind our back, and a full rebuild is done instead.
+ */
+
+static bool same_key(struct applied *a, struct applied *b)
+{
+	if (a->type != b->type)
+		return false;
+
+	switch (a->type) {
+	case APPLIED_PORT:
+		return a->portid.portid == b->portid.portid;
+	case APPLIED_HOST:
+		return !strcmp(a->hostnqn, b->hostnqn);
+	case APPLIED_SUBSYS:
+		return !strcmp(a->nqn, b->nqn);
+	case APPLIED_ACL:
+		return !strcmp(a->nqn, b->nqn) &&
+			!strcmp(a->hostnqn, b->hostnqn);
+	case APPLIED_NS:
+		return !strcmp(a->nqn, b->nqn) && a->ns.nsid == b->ns.nsid;
+	case APPLIED_LINK:
+		return !strcmp(a->nqn, b->nqn) &&
+			a->portid.portid == b->portid.portid;
+	}
+
+	return false;
+}
+
+bool same_applied_value(struct applied *a, struct applied *b)
+{
+	switch (a->type) {
+	case APPLIED_PORT:
+		return !strcmp(a->portid.type, b->portid.type) &&
+			!strcmp(a->portid.family, b->portid.family) &&
+			!strcmp(a->portid.address, b->portid.address) &&
+			a->portid.port_num == b->portid.port_num;
+	case APPLIED_SUBSYS:
+		return a->access == b->access;
+	case APPLIED_NS:
+		return a->ns.devid == b->ns.devid &&
+			a->ns.devns == b->ns.devns;
+	}
+
+	return true;
+}
+
+/* objects the endpoint drops along with their parent */
+static bool depends_on(struct applied *a, struct applied *parent)
+{
+	switch (parent->type) {
+	case APPLIED_PORT:
+		return a->type == APPLIED_LINK &&
+			a->portid.portid == parent->portid.portid;
+	case APPLIED_HOST:
+		return a->type == APPLIED_ACL &&
+			!strcmp(a->hostnqn, parent->hostnqn);
+	case APPLIED_SUBSYS:
+		return (a->type == APPLIED_ACL || a->type == APPLIED_NS ||
+			a->type == APPLIED_LINK) &&
+			!strcmp(a->nqn, parent->nqn);
+	}
+
+	return false;
+}
+
+struct applied *find_applied(struct linked_list *list, struct applied *key)
+{
+	struct applied		*a;
+
+	list_for_each_entry(a, list, node)
+		if (same_key(a, key))
+			return a;
+
+	return NULL;
+}
+
+static int add_applied(struct linked_list *list, struct applied *a)
+{
+	struct applied		*p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	memcpy(p, a, sizeof(*p));
+
+	list_add_tail(&p->node, list);
+
+	return 0;
+}
+
+void free_applied_list(struct linked_list *list)
+{
+	struct applied		*a, *next;
+
+	list_for_each_entry_safe(a, next, list, node) {
+		list_del(&a->node);
+		free(a);
+	}
+}
+
+void note_applied(struct target *target, struct applied *a)
+{
+	struct applied		*p;
+	struct linked_list	 node;
+
+	p = find_applied(&target->applied_list, a);
+	if (!p) {
+		if (add_applied(&target->applied_list, a))
+			forget_applied_config(target);
+		return;
+	}
+
+	node = p->node;
+	memcpy(p, a, sizeof(*p));
+	p->node = node;
+}
+
+void forget_applied(struct target *target, struct applied *a)
+{
+	struct applied		*p, *next;
+
+	list_for_each_entry_safe(p, next, &target->applied_list, node)
+		if (same_key(p, a) || depends_on(p, a)) {
+			list_del(&p->node);
+			free(p);
+		}
+}
+
+void forget_applied_config(struct target *target)
+{
+	free_applied_list(&target->applied_list);
+
+	target->applied_valid = false;
+}
+
+/* takes over the entries of list */
+void set_applied_config(struct target *target, struct linked_list *list)
+{
+	struct applied		*a, *next;
+
+	free_applied_list(&target->applied_list);
+
+	list_for_each_entry_safe(a, next, list, node) {
+		list_del(&a->node);
+		list_add_tail(&a->node, &target->applied_list);
+	}
+
+	target->applied_valid = true;
+}
+
+void applied_port(struct applied *a, struct portid *portid)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_PORT;
+	a->portid = *portid;
+}
+
+void applied_host(struct applied *a, char *hostnqn)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_HOST;
+	strcpy(a->hostnqn, hostnqn);
+}
+
+void applied_subsys(struct applied *a, struct subsystem *subsys)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_SUBSYS;
+	a->access = subsys->access;
+	strcpy(a->nqn, subsys->nqn);
+}
+
+void applied_acl(struct applied *a, struct subsystem *subsys, char *hostnqn)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_ACL;
+	strcpy(a->nqn, subsys->nqn);
+	strcpy(a->hostnqn, hostnqn);
+}
+
+void applied_ns(struct applied *a, struct subsystem *subsys, struct ns *ns)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_NS;
+	a->ns = *ns;
+	strcpy(a->nqn, subsys->nqn);
+}
+
+void applied_link(struct applied *a, struct subsystem *subsys,
+		  struct portid *portid)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->type = APPLIED_LINK;
+	a->portid.portid = portid->portid;
+	strcpy(a->nqn, subsys->nqn);
+}
+
+/* what config_target() would push for the target as it is now */
+int build_applied_config(struct target *target, struct linked_list *list)
+{
+	struct subsystem	*subsys;
+	struct portid		*portid;
+	struct host		*host;
+	struct ns		*ns;
+	struct applied		 a;
+	int			 ret = 0;
+
+	list_for_each_entry(portid, &target->portid_list, node) {
+		applied_port(&a, portid);
+		ret = add_applied(list, &a);
+		if (ret)
+			goto err;
+	}
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		applied_subsys(&a, subsys);
+		ret = add_applied(list, &a);
+		if (ret)
+			goto err;
+
+		if (is_restricted(subsys))
+			list_for_each_entry(host, &subsys->host_list, node) {
+				applied_host(&a, host->nqn);
+				if (!find_applied(list, &a)) {
+					ret = add_applied(list, &a);
+					if (ret)
+						goto err;
+				}
+
+				applied_acl(&a, subsys, host->nqn);
+				ret = add_applied(list, &a);
+				if (ret)
+					goto err;
+			}
+
+		list_for_each_entry(ns, &subsys->ns_list, node) {
+			applied_ns(&a, subsys, ns);
+			ret = add_applied(list, &a);
+			if (ret)
+				goto err;
+		}
+
+		if (is_restricted(subsys) && list_empty(&subsys->host_list))
+			continue;
+
+		list_for_each_entry(portid, &target->portid_list, node) {
+			applied_link(&a, subsys, portid);
+			ret = add_applied(list, &a);
+			if (ret)
+				goto err;
+		}
+	}
+
+	return 0;
+err:
+	free_applied_list(list);
+
+	return ret;
+}
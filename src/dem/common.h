@@ -63,18 +63,37 @@
 #define JSINT		"\"%s\":%lld"
 #define JSINDX		"\"%s\":%d"
 #define JSENTRY		"%s\"%s\""
+#define JSTAG		"\"%s\":"
 
 extern int			 debug;
 extern int			 curl_show_results;
 extern int			 num_interfaces;
+extern int			 push_delay;
 extern struct host_iface	*interfaces;
 extern struct linked_list	*aen_req_list;
 extern struct linked_list	*target_list;
 extern struct linked_list	*group_list;
 extern struct linked_list	*host_list;
 
+/* needs to be < NVMF_DISC_KATO in connect AND < 2 MIN for upstream target */
+#define KEEP_ALIVE_TIMER	120000 /* ms */
+
+#define TIMER_NEVER		((u64) -1)
+
+/*
+ * A target's health, failures and retry_deadline change with the target
+ * locked, or with the workers suspended, and are read that way too, except
+ * by target_health() which runs under the json lock a worker may be
+ * waiting on.  Writes and that read go through these.
+ */
+#define set_target_state(t, field, val) \
+	__atomic_store_n(&(t)->field, val, __ATOMIC_RELAXED)
+#define get_target_state(t, field) \
+	__atomic_load_n(&(t)->field, __ATOMIC_RELAXED)
+
 #define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
 #define PATH_NVMF_DEM_DISC	"/etc/nvme/nvmeof-dem/"
+#define SNAPSHOT_DIR		"/var/lib/nvmeof-dem/"
 #define NUM_CONFIG_ITEMS	3
 #define CONFIG_TYPE_SIZE	8
 #define CONFIG_FAMILY_SIZE	8
@@ -177,6 +196,32 @@ union sc_iface {
 	struct ctrl_queue inb;
 };
 
+/* config objects as pushed to a target, in the order they are pushed */
+enum { APPLIED_PORT, APPLIED_HOST, APPLIED_SUBSYS, APPLIED_ACL, APPLIED_NS,
+	APPLIED_LINK, APPLIED_TYPES };
+
+struct applied {
+	struct linked_list	 node;
+	int			 type;
+	char			 nqn[MAX_NQN_SIZE + 1];
+	char			 hostnqn[MAX_NQN_SIZE + 1];
+	struct portid		 portid;
+	struct ns		 ns;
+	int			 access;
+	int			 stale;
+};
+
+/* written only by the thread doing the target's work, see metrics.c */
+struct target_metrics {
+	u64			 keep_alives;
+	u64			 keep_alive_failures;
+	u64			 keep_alive_usec;
+	u64			 keep_alive_last_usec;
+	u64			 refreshes;
+	u64			 refresh_usec;
+	u64			 logpages;
+};
+
 struct target {
 	struct linked_list	 node;
 	struct linked_list	 subsys_list;
@@ -185,18 +230,47 @@ struct target {
 	struct linked_list	 discovery_queue_list;
 	struct linked_list	 unattached_logpage_list;
 	struct linked_list	 fabric_iface_list;
+	struct linked_list	 work_node;
+	struct linked_list	 applied_list;
 	struct host_iface	*iface;
 	json_t			*json;
 	union sc_iface		 sc_iface;
+	struct target_metrics	 metrics;
+	pthread_mutex_t		 lock;
 	char			 alias[MAX_ALIAS_SIZE + 1];
 	int			 mgmt_mode;
 	int			 refresh;
-	int			 log_page_retry_count;
-	int			 refresh_countdown;
-	int			 kato_countdown;
+	u64			 kato_deadline;
+	u64			 refresh_deadline;
+	u64			 retry_deadline;
+	u64			 push_deadline;
+	u64			 push_since;
+	u64			 timer;
+	int			 timer_index;
+	int			 health;
+	int			 failures;
+	int			 work_state;
+	int			 work_flags;
+	bool			 applied_valid;
+	bool			 push_pending;
+	bool			 refresh_pending;
+	bool			 config_pending;
+	bool			 warming;
 	bool			 group_member;
 };
 
+/* target work_state */
+enum { WORK_IDLE, WORK_QUEUED, WORK_RUNNING };
+
+/* target work_flags */
+#define WORK_KEEP_ALIVE		0x01
+#define WORK_REFRESH		0x02
+#define WORK_STARTUP		0x04
+#define WORK_PUSH		0x08
+
+/* target health */
+enum { TARGET_HEALTHY, TARGET_DEGRADED, TARGET_DOWN, TARGET_PROBING };
+
 struct group {
 	struct linked_list	 node;
 	struct linked_list	 target_list;
@@ -224,6 +298,7 @@ struct event_notification {
 };
 
 struct mg_connection;
+struct mg_mgr;
 struct mg_str;
 
 extern char shared_nqn[];
@@ -232,12 +307,51 @@ extern struct mg_str s_signature_user;
 extern struct mg_str *s_signature;
 
 void shutdown_dem(void);
+void get_startup_status(int *total, int *ready, int *failed);
+void cancel_warm_up(struct target *target);
 void handle_http_request(struct mg_connection *c, void *ev_data);
+void close_http_request(struct mg_connection *c);
+int init_rest_threads(struct mg_mgr *mgr, int count);
+void cleanup_rest_threads(void);
+
+/* a connection streaming GET /dem/watch */
+#define MG_F_WATCH		MG_F_USER_1
+
+struct http_message;
+
+void watch_event(const char *type, const char *name, u64 gen, bool deleted);
+int start_watch(struct mg_connection *c, struct http_message *hm);
+void stop_watch(struct mg_connection *c);
+void ping_watchers(void);
+void flush_watchers(void);
+void init_watch(struct mg_mgr *mgr);
+void cleanup_watch(void);
+
+/* discovery commands and REST requests are timed by kind */
+enum { DISC_OP_CONNECT, DISC_OP_PROPERTY_GET, DISC_OP_PROPERTY_SET,
+       DISC_OP_IDENTIFY, DISC_OP_KEEP_ALIVE, DISC_OP_GET_LOG_PAGE,
+       DISC_OP_GET_FEATURES, DISC_OP_SET_FEATURES, DISC_OP_ASYNC_EVENT,
+       DISC_OP_OTHER, NUM_DISC_OPS };
+enum { REST_GET, REST_PUT, REST_POST, REST_PATCH, REST_DELETE, REST_OTHER,
+       NUM_REST_METHODS };
+
+void bind_metrics(struct host_iface *iface);
+void count_host_conn(bool connected);
+void time_disc_cmd(int op, u64 usec);
+void time_rest_request(int method, u64 usec);
+void count_aen_sent(void);
+void time_refresh(struct target *target, u64 usec, int logpages);
+void time_keep_alive(struct target *target, u64 usec, bool failed);
+int format_metrics(char **resp);
+void cleanup_metrics(void);
 
 int init_json(char *filename);
 void cleanup_json(void);
-void json_spinlock(void);
-void json_spinunlock(void);
+void json_rdlock(void);
+void json_wrlock(void);
+void json_unlock(void);
+bool json_write_held(void);
+bool json_dry_run(void);
 
 int init_interfaces(void);
 void *interface_thread(void *arg);
@@ -255,22 +369,104 @@ struct target *find_target(char *alias);
 
 struct subsystem *new_subsys(struct target *target, char *nqn);
 
-void refresh_log_pages(struct target *target);
+int refresh_log_pages(struct target *target);
 void fetch_log_pages(struct ctrl_queue *dq);
 void del_unattached_logpage_list(struct target *target);
+void load_logpage_snapshot(struct target *target);
+void save_logpage_snapshot(struct target *target);
+void del_logpage_snapshot(struct target *target);
+void rename_logpage_snapshot(struct target *target, const char *alias);
+void logpage_rdlock(void);
+void logpage_wrlock(void);
+void logpage_unlock(void);
+u64 get_logpage_genctr(void);
+void notify_target_hosts(struct target *target);
+void queue_aen_request(struct event_notification *req);
 
 void create_discovery_queue(struct target *target, struct subsystem *subsys,
 			    struct portid *portid);
 int target_reconfig(char *alias);
 int target_refresh(char *alias);
 int target_usage(char *alias, char **results);
+int target_health(char *alias, char **results);
 int target_logpage(char *alias, char **results);
 int host_logpage(char *alias, char **results);
 
+/* response body grown in place, *buf must hold at least size bytes */
+struct writer {
+	char			**buf;
+	size_t			  len;
+	size_t			  size;
+	int			  err;
+};
+
+void init_writer(struct writer *w, char **buf, size_t size);
+int write_resp(struct writer *w, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
 int get_config(struct target *target);
+int connect_inb_ctrl(struct ctrl_queue *ctrl);
+void disconnect_inb_ctrl(struct ctrl_queue *ctrl);
 int config_target(struct target *target);
 
 struct target *alloc_target(char *alias);
+void free_target(struct target *target);
+
+int init_workers(int count, void (*work)(struct target *target, int flags));
+void cleanup_workers(void);
+void schedule_target_work(struct target *target, int flags);
+void cancel_target_work(struct target *target);
+bool target_work_pending(struct target *target);
+void suspend_workers(void);
+void resume_workers(void);
+bool begin_periodic_work(void);
+void end_periodic_work(void);
+void lock_target(struct target *target);
+bool trylock_target(struct target *target);
+void unlock_target(struct target *target);
+void fan_out_targets(struct target **targets, int count, int *results,
+		     int (*fn)(struct target *target, void *arg), void *arg);
+
+void init_timers(void);
+void cleanup_timers(void);
+u64 time_msec(void);
+u64 time_usec(void);
+void set_target_timer(struct target *target, u64 when);
+void del_target_timer(struct target *target);
+struct target *next_expired_target(u64 now);
+u64 target_deadline(struct target *target);
+u64 next_refresh(struct target *target, u64 now);
+u64 next_keep_alive(u64 now);
+void set_log_page_retry(struct target *target);
+void target_failed(struct target *target);
+void target_succeeded(struct target *target);
+const char *target_health_str(int health);
+void arm_target_timers(struct target *target);
+
+bool same_applied_value(struct applied *a, struct applied *b);
+struct applied *find_applied(struct linked_list *list, struct applied *key);
+void free_applied_list(struct linked_list *list);
+void note_applied(struct target *target, struct applied *a);
+void forget_applied(struct target *target, struct applied *a);
+void forget_applied_config(struct target *target);
+void set_applied_config(struct target *target, struct linked_list *list);
+int build_applied_config(struct target *target, struct linked_list *list);
+void applied_port(struct applied *a, struct portid *portid);
+void applied_host(struct applied *a, char *hostnqn);
+void applied_subsys(struct applied *a, struct subsystem *subsys);
+void applied_acl(struct applied *a, struct subsystem *subsys, char *hostnqn);
+void applied_ns(struct applied *a, struct subsystem *subsys, struct ns *ns);
+void applied_link(struct applied *a, struct subsystem *subsys,
+		  struct portid *portid);
+int reconfig_target(struct target *target);
+void defer_target_pushes(void);
+bool defer_target_refresh(struct target *target);
+int deferred_config_count(void);
+int push_deferred_config(char *resp);
+void queue_deferred_config(void);
+int finish_deferred_config(char *resp);
+int push_queued_config(struct target *target);
+int commit_queued_config(struct target *target, char *resp);
 
 int get_mgmt_mode(char *mode);
 
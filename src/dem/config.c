@@ -141,13 +141,43 @@ static inline struct group_host_link *find_group_host(struct group *group,
 
 /* notification functions */
 
+/*
+ * AEN requests are queued by the interface threads and consumed from both
+ * REST requests and target work, so access to aen_req_list is serialized.
+ */
+static pthread_mutex_t aen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void queue_aen_request(struct event_notification *req)
+{
+	pthread_mutex_lock(&aen_lock);
+	list_add(&req->node, aen_req_list);
+	pthread_mutex_unlock(&aen_lock);
+}
+
+static inline int aen_request_queued(struct event_notification *req)
+{
+	struct event_notification *entry;
+
+	list_for_each_entry(entry, aen_req_list, node)
+		if (entry == req)
+			return 1;
+
+	return 0;
+}
+
 static inline int send_notifications(struct linked_list *list)
 {
 	struct event_notification *entry, *next;
 	struct endpoint		*ep;
 	struct nvme_completion	*resp;
 
+	pthread_mutex_lock(&aen_lock);
+
 	list_for_each_entry_safe(entry, next, list, node) {
+		/* already answered by another notification */
+		if (!aen_request_queued(entry->req))
+			goto free;
+
 		ep = entry->ep;
 		resp = (void *) ep->cmd;
 		if (!resp)
@@ -157,18 +187,24 @@ static inline int send_notifications(struct linked_list *list)
 
 		resp->result.U32 = NVME_AER_NOTICE_LOG_PAGE_CHANGE;
 
-		if (ep->state == CONNECTED)
-			ep->ops->send_rsp(ep->ep, resp, sizeof(*resp), ep->mr);
-		else
+		if (ep->state != CONNECTED)
 			print_err("cannot send AER_NOTICE to %p state %d", ep,
 				  ep->state);
+		else if (ep->ops->send_rsp(ep->ep, resp, sizeof(*resp),
+					   ep->mr))
+			print_err("failed to send AER_NOTICE to %p", ep);
+		else
+			count_aen_sent();
 cleanup:
 		list_del(&entry->req->node);
 		free(entry->req);
+free:
 		list_del(&entry->node);
 		free(entry);
 	}
 
+	pthread_mutex_unlock(&aen_lock);
+
 	return 0;
 }
 
@@ -207,9 +243,13 @@ static inline void create_notification_list(struct linked_list *list)
 
 	INIT_LINKED_LIST(list);
 
+	pthread_mutex_lock(&aen_lock);
+
 	list_for_each_entry(req, aen_req_list, node)
 		if (!in_notification_list(list, req->nqn))
 			create_notification_entry(list, req);
+
+	pthread_mutex_unlock(&aen_lock);
 }
 
 static inline int any_subsys_unrestricted(struct target *target)
@@ -345,11 +385,23 @@ static inline void create_event_host_list_for_host(struct linked_list *list,
 
 	INIT_LINKED_LIST(list);
 
+	pthread_mutex_lock(&aen_lock);
+
 	list_for_each_entry(req, aen_req_list, node)
 		if (!strcmp(nqn, req->nqn)) {
 			create_notification_entry(list, req);
 			break;
 		}
+
+	pthread_mutex_unlock(&aen_lock);
+}
+
+void notify_target_hosts(struct target *target)
+{
+	struct linked_list	 list;
+
+	create_event_host_list_for_target(&list, target);
+	send_notifications(&list);
 }
 
 static void _del_subsys_dq(struct subsystem *subsys)
@@ -471,7 +523,7 @@ int add_group(char *name, char *resp)
 	int			 ret;
 
 	ret = add_json_group(name, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	group = init_group(name);
@@ -490,7 +542,7 @@ int update_group(char *name, char *data, char *resp)
 	int			 ret;
 
 	ret = update_json_group(name, data, resp, _name);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	group = find_group(_name);
@@ -557,7 +609,7 @@ int set_group_member(char *name, char *data, char *alias, char *tag,
 
 	ret = set_json_group_member(name, data, alias, tag, parent_tag, resp,
 				    _alias);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	group = find_group(name);
@@ -617,7 +669,7 @@ int del_group_member(char *name, char *alias, char *tag, char *parent_tag,
 	int			 ret;
 
 	ret = del_json_group_member(name, alias, tag, parent_tag, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	group = find_group(name);
@@ -637,7 +689,7 @@ int del_group(char *name, char *resp)
 	int			 ret;
 
 	ret = del_json_group(name, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	group = find_group(name);
@@ -917,6 +969,63 @@ static void build_set_portid_oob(int portid, char *buf, int len)
 
 /* out of band message sending functions */
 
+/*
+ * Pushes made while an oob batch is open are queued and reported as done;
+ * closing the batch sends them, each endpoint in order and the endpoints
+ * in parallel.  A target whose pushes failed can no longer trust its
+ * applied record, so it is dropped and the alert goes into resp if given.
+ */
+static void oob_batch_failed(void *owner, int ret, void *arg)
+{
+	struct target		*target = owner;
+	char			*resp = arg;
+
+	if (!target)
+		return;
+
+	print_err("OOB push to %s failed %d", target->alias, ret);
+
+	forget_applied_config(target);
+
+	if (resp)
+		sprintf(resp, CONFIG_ALERT, target->alias);
+}
+
+static inline bool open_oob_batch(void)
+{
+	return !curl_batch_begin();
+}
+
+static inline int close_oob_batch(bool open, char *resp)
+{
+	return open ? curl_batch_end(oob_batch_failed, resp) : 0;
+}
+
+static inline void oob_batch_target(struct target *target)
+{
+	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
+		curl_batch_owner(target);
+}
+
+/*
+ * While pushes are deferred the dispatchers only mark the target; the
+ * configuration is left for push_deferred_config() to send as one delta
+ * per target, the targets in parallel.  Every REST change runs this way so
+ * no fabric I/O happens with the json lock held.
+ */
+static __thread bool defer_pushes;
+static __thread bool push_now;
+
+static inline int push_mode(struct target *target)
+{
+	if (defer_pushes && target->mgmt_mode != LOCAL_MGMT) {
+		target->push_pending = true;
+		return LOCAL_MGMT;
+	}
+
+	return target->mgmt_mode;
+}
+
 static int send_get_config_oob(struct target *target, char *tag, char **buf)
 {
 	char			 uri[MAX_URI_SIZE];
@@ -1126,21 +1235,25 @@ out1:
 	return ret;
 }
 
-static int get_inb_config(struct target *target)
+/*
+ * The in-band management queue stays connected between refreshes and is
+ * health-checked by keep_alive_work(); it is only reconnected after a
+ * command or keep-alive on it has failed.
+ */
+int connect_inb_ctrl(struct ctrl_queue *ctrl)
 {
-	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
 	int			 ret;
 
+	if (ctrl->connected)
+		return 0;
+
 	ctrl->ep.ops = register_ops(ctrl->portid->type);
 	if (!ctrl->ep.ops)
 		return -EINVAL;
 
-	if (ctrl->connected)
-		disconnect_ctrl(ctrl, 0);
-
 	ret = connect_ctrl(ctrl);
 	if (ret) {
-		print_err("failed to connect to %s", target->alias);
+		print_err("failed to connect to %s", ctrl->target->alias);
 		print_errno("connect_ctrl failed",  ret);
 
 		return ret;
@@ -1148,19 +1261,56 @@ static int get_inb_config(struct target *target)
 
 	ctrl->connected = 1;
 
-	ret = get_inb_nsdevs(target);
-	if (!ret)
-		ret = get_inb_xports(target);
+	return 0;
+}
 
-	if (ret)
+void disconnect_inb_ctrl(struct ctrl_queue *ctrl)
+{
+	if (ctrl->connected)
 		disconnect_ctrl(ctrl, 0);
+}
+
+static int get_inb_config(struct target *target)
+{
+	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+	int			 retry = ctrl->connected;
+	int			 ret;
+
+	do {
+		ret = connect_inb_ctrl(ctrl);
+		if (ret)
+			return ret;
+
+		ret = get_inb_nsdevs(target);
+		if (!ret)
+			ret = get_inb_xports(target);
+		if (!ret)
+			return 0;
+
+		/* the queue may have gone stale since its last keep-alive */
+		disconnect_inb_ctrl(ctrl);
+	} while (retry--);
 
 	return ret;
 }
 
 /* set config (INB) command handlers */
 
-static int _send_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
+/*
+ * While a batch is open on this thread, set config requests for its
+ * queue are packed into a page and go out as one nvmf_batch_config
+ * MI send rather than one round trip each.
+ */
+struct mi_batch {
+	struct ctrl_queue	*ctrl;
+	struct nvmf_batch_config_hdr *hdr;
+	int			 len;
+	int			 failed;
+};
+
+static __thread struct mi_batch *mi_batch;
+
+static int send_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
 {
 	int			 ret;
 
@@ -1169,18 +1319,159 @@ static int _send_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
 		if (!ret)
 			return 0;
 
-		ctrl->connected = 0;
+		disconnect_inb_ctrl(ctrl);
 	}
 
-	ret = connect_ctrl(ctrl);
+	ret = connect_inb_ctrl(ctrl);
 	if (ret)
 		return ret;
 
-	ctrl->connected = 1;
-
 	return send_mi_send(&ctrl->ep, id, len, p);
 }
 
+static inline struct nvmf_batch_config_entry *
+batch_entry(struct mi_batch *batch, int offset)
+{
+	return (void *) ((char *) batch->hdr + offset);
+}
+
+/* a dem-em without batch support gets the entries one at a time */
+static int replay_mi_batch(struct mi_batch *batch)
+{
+	struct nvmf_batch_config_entry *entry;
+	int			 n = le16toh(batch->hdr->num_entries);
+	int			 offset = sizeof(*batch->hdr);
+	int			 i;
+
+	for (i = 0; i < n; i++) {
+		entry = batch_entry(batch, offset);
+		if (send_set_config(batch->ctrl, entry->fcid,
+				    le16toh(entry->len), entry + 1))
+			batch->failed++;
+
+		offset += NVMF_BATCH_ENTRY_SIZE(le16toh(entry->len));
+	}
+
+	return 0;
+}
+
+static int flush_mi_batch(struct mi_batch *batch)
+{
+	struct ctrl_queue	*ctrl = batch->ctrl;
+	struct nvmf_batch_config_entry *entry;
+	u64			 failed;
+	int			 n = le16toh(batch->hdr->num_entries);
+	int			 offset = sizeof(*batch->hdr);
+	int			 i;
+	int			 ret;
+
+	if (!n)
+		return 0;
+
+	ret = connect_inb_ctrl(ctrl);
+	if (ret)
+		goto out;
+
+	ret = send_mi_send_batch(&ctrl->ep, batch->len, batch->hdr, &failed);
+	if (ret == (NVME_SC_DNR | NVME_SC_INVALID_FIELD)) {
+		ret = replay_mi_batch(batch);
+		goto out;
+	}
+
+	if (ret) {
+		disconnect_inb_ctrl(ctrl);
+		goto out;
+	}
+
+	for (i = 0; i < n && failed; i++, failed >>= 1) {
+		entry = batch_entry(batch, offset);
+		if (failed & 1) {
+			print_err("batched set config id %x failed for %s",
+				  entry->fcid, ctrl->target->alias);
+			batch->failed++;
+		}
+
+		offset += NVMF_BATCH_ENTRY_SIZE(le16toh(entry->len));
+	}
+out:
+	batch->hdr->num_entries = 0;
+	batch->len = sizeof(*batch->hdr);
+
+	return ret;
+}
+
+static int add_to_mi_batch(struct mi_batch *batch, int id, int len, void *p)
+{
+	struct nvmf_batch_config_entry *entry;
+	int			 size = NVMF_BATCH_ENTRY_SIZE(len);
+	int			 n = le16toh(batch->hdr->num_entries);
+	int			 ret;
+
+	if (n == NVMF_BATCH_MAX_ENTRIES ||
+	    batch->len + size > NVMF_BATCH_SIZE) {
+		ret = flush_mi_batch(batch);
+		if (ret)
+			return ret;
+		n = 0;
+	}
+
+	entry = batch_entry(batch, batch->len);
+	memset(entry, 0, size);
+
+	entry->fcid = id;
+	entry->len = htole16(len);
+	memcpy(entry + 1, p, len);
+
+	batch->hdr->num_entries = htole16(n + 1);
+	batch->len += size;
+
+	return 0;
+}
+
+static int open_mi_batch(struct mi_batch *batch, struct ctrl_queue *ctrl)
+{
+	if (posix_memalign((void **) &batch->hdr, PAGE_SIZE,
+			   NVMF_BATCH_SIZE)) {
+		print_errno("posix_memalign failed", errno);
+		return -ENOMEM;
+	}
+
+	memset(batch->hdr, 0, sizeof(*batch->hdr));
+
+	batch->ctrl = ctrl;
+	batch->len = sizeof(*batch->hdr);
+	batch->failed = 0;
+
+	mi_batch = batch;
+
+	return 0;
+}
+
+/* sends what is left; -EIO if any entry was rejected by the target */
+static int close_mi_batch(struct mi_batch *batch)
+{
+	int			 ret;
+
+	mi_batch = NULL;
+
+	ret = flush_mi_batch(batch);
+
+	free(batch->hdr);
+
+	if (!ret && batch->failed)
+		ret = -EIO;
+
+	return ret;
+}
+
+static int _send_set_config(struct ctrl_queue *ctrl, int id, int len, void *p)
+{
+	if (mi_batch && mi_batch->ctrl == ctrl)
+		return add_to_mi_batch(mi_batch, id, len, p);
+
+	return send_set_config(ctrl, id, len, p);
+}
+
 static int config_portid_inb(struct target *target, struct portid *portid)
 {
 	struct nvmf_port_config_entry *entry;
@@ -1298,20 +1589,27 @@ static int send_link_host_oob(struct subsystem *subsys, struct host *host)
 static inline int _link_host(struct subsystem *subsys, struct host *host)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
 	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT) {
+	if (mode == IN_BAND_MGMT) {
 		ret = send_host_config_inb(target, host);
-		if (ret)
-			return ret;
+		if (!ret)
+			ret = send_link_host_inb(subsys, host);
+	} else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_link_host_oob(subsys, host);
+	else
+		return 0;
 
-		return send_link_host_inb(subsys, host);
+	if (!ret) {
+		applied_host(&a, host->nqn);
+		note_applied(target, &a);
+		applied_acl(&a, subsys, host->nqn);
+		note_applied(target, &a);
 	}
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_link_host_oob(subsys, host);
-
-	return 0;
+	return ret;
 }
 
 static int send_unlink_host_inb(struct subsystem *subsys, struct host *host)
@@ -1353,14 +1651,23 @@ static int send_unlink_host_oob(struct subsystem *subsys, struct host *host)
 static inline int _unlink_host(struct subsystem *subsys, struct host *host)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_unlink_host_inb(subsys, host);
+	if (mode == IN_BAND_MGMT)
+		ret = send_unlink_host_inb(subsys, host);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_unlink_host_oob(subsys, host);
+	else
+		return 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_unlink_host_oob(subsys, host);
+	if (!ret) {
+		applied_acl(&a, subsys, host->nqn);
+		forget_applied(target, &a);
+	}
 
-	return 0;
+	return ret;
 }
 
 static int send_del_host_inb(struct target *target, char *hostnqn)
@@ -1400,19 +1707,105 @@ static int send_del_host_oob(struct target *target, char *hostnqn)
 
 static inline int _del_host(struct target *target, char *hostnqn)
 {
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_del_host_inb(target, hostnqn);
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_del_host_oob(target, hostnqn);
+	if (mode == IN_BAND_MGMT)
+		ret = send_del_host_inb(target, hostnqn);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_del_host_oob(target, hostnqn);
+	else
+		return 0;
+
+	if (!ret) {
+		applied_host(&a, hostnqn);
+		forget_applied(target, &a);
+	}
+
+	return ret;
+}
+
+/*
+ * Host changes reach every target the host is allowed on; the per target
+ * pushes are fanned out and their results gathered into the response.
+ */
+struct host_change {
+	char			*alias;
+	char			*newalias;
+	char			*hostnqn;
+};
+
+static void fan_out_pushes(struct target **targets, int count, int *results,
+			   int (*fn)(struct target *target, void *arg),
+			   void *arg)
+{
+	int			 i;
+
+	/* deferred pushes only mark the target, threads would lose that */
+	if (defer_pushes) {
+		for (i = 0; i < count; i++)
+			results[i] = fn(targets[i], arg);
+		return;
+	}
+
+	fan_out_targets(targets, count, results, fn, arg);
+}
+
+static int alloc_fan_out(struct target ***targets, int **results)
+{
+	struct target		*target;
+	int			 count = 0;
+
+	list_for_each_entry(target, target_list, node)
+		count++;
+
+	*targets = calloc(count + 1, sizeof(**targets));
+	*results = calloc(count + 1, sizeof(**results));
+	if (!*targets || !*results) {
+		free(*targets);
+		free(*results);
+		return -ENOMEM;
+	}
 
 	return 0;
 }
 
+/* append "; N targets updated, M failed: t1 t2 ..." to the response */
+static int fan_out_results(char *resp, struct target **targets, int count,
+			   int *results)
+{
+	int			 len = strlen(resp);
+	int			 failed = 0;
+	int			 ret = 0;
+	int			 i;
+
+	for (i = 0; i < count; i++)
+		if (results[i]) {
+			failed++;
+			if (!ret)
+				ret = results[i];
+		}
+
+	len += snprintf(resp + len, BODY_SIZE - len,
+			"%s%d %s updated", len ? "; " : "", count - failed,
+			(count - failed == 1) ? "target" : "targets");
+	if (!failed)
+		return 0;
+
+	len += snprintf(resp + len, BODY_SIZE - len, ", %d failed:", failed);
+
+	for (i = 0; i < count && len < BODY_SIZE; i++)
+		if (results[i])
+			len += snprintf(resp + len, BODY_SIZE - len, " %s",
+					targets[i]->alias);
+
+	return ret;
+}
+
 static inline int _update_host(struct subsystem *subsys, struct host *host,
-			       char *hostnqn, char *resp)
+			       char *hostnqn)
 {
-	struct target		*target = subsys->target;
 	char			 oldnqn[MAX_NQN_SIZE + 1];
 	int			 ret;
 
@@ -1422,41 +1815,92 @@ static inline int _update_host(struct subsystem *subsys, struct host *host,
 	strcpy(host->nqn, hostnqn);
 
 	ret = _link_host(subsys, host);
-	if (ret)
-		sprintf(resp, CONFIG_ALERT, target->alias);
 
 	_update_subsys_dq(subsys, oldnqn, hostnqn);
 
 	return ret;
 }
 
-int update_host(char *alias, char *data, char *resp)
+static int update_host_on_target(struct target *target, void *arg)
 {
-	struct target		*target;
+	struct host_change	*change = arg;
 	struct subsystem	*subsys;
 	struct host		*host;
-	char			 newalias[MAX_ALIAS_SIZE + 1];
-	char			 hostnqn[MAX_NQN_SIZE + 1];
-	int			 ret;
+	int			 ret = 0;
+	int			 err;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(host, &subsys->host_list, node)
+			if (!strcmp(host->alias, change->alias)) {
+				if (strcmp(host->nqn, change->hostnqn)) {
+					err = _update_host(subsys, host,
+							   change->hostnqn);
+					if (err)
+						ret = err;
+				}
+				if (strcmp(host->alias, change->newalias))
+					strcpy(host->alias, change->newalias);
+				break;
+			}
 
-	ret = update_json_host(alias, data, resp, newalias, hostnqn);
 	if (ret)
-		return ret;
+		print_err("update host on %s failed %d", target->alias, ret);
 
-	if (!alias)
+	return ret;
+}
+
+static bool has_host(struct target *target, char *alias)
+{
+	struct subsystem	*subsys;
+	struct host		*host;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(host, &subsys->host_list, node)
+			if (!strcmp(host->alias, alias))
+				return true;
+
+	return false;
+}
+
+int update_host(char *alias, char *data, char *resp)
+{
+	struct target		*target;
+	struct target		**targets;
+	struct host_change	 change;
+	char			 newalias[MAX_ALIAS_SIZE + 1];
+	char			 hostnqn[MAX_NQN_SIZE + 1];
+	int			*results;
+	int			 count = 0;
+	int			 ret;
+
+	ret = update_json_host(alias, data, resp, newalias, hostnqn);
+	if (ret || json_dry_run())
+		return ret;
+
+	if (!alias)
 		alias = newalias;
 
+	ret = alloc_fan_out(&targets, &results);
+	if (ret)
+		return ret;
+
 	list_for_each_entry(target, target_list, node)
-		list_for_each_entry(subsys, &target->subsys_list, node)
-			list_for_each_entry(host, &subsys->host_list, node)
-				if (!strcmp(host->alias, alias)) {
-					if (strcmp(host->nqn, hostnqn))
-						_update_host(subsys, host,
-							     hostnqn, resp);
-					if (strcmp(host->alias, newalias))
-						strcpy(host->alias, newalias);
-					break;
-				}
+		if (has_host(target, alias))
+			targets[count++] = target;
+
+	change.alias = alias;
+	change.newalias = newalias;
+	change.hostnqn = hostnqn;
+
+	fan_out_pushes(targets, count, results, update_host_on_target,
+		       &change);
+
+	if (count)
+		fan_out_results(resp, targets, count, results);
+
+	free(targets);
+	free(results);
+
 	return 0;
 }
 
@@ -1469,46 +1913,75 @@ int add_host(char *host, char *resp)
 	return ret;
 }
 
+static int del_host_on_target(struct target *target, void *arg)
+{
+	struct host_change	*change = arg;
+	struct subsystem	*subsys;
+	struct host		*host;
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		if (!is_restricted(subsys))
+			continue;
+		list_for_each_entry(host, &subsys->host_list, node)
+			if (!strcmp(host->alias, change->alias)) {
+				_unlink_host(subsys, host);
+				list_del(&host->node);
+				_reset_subsys_dq_nqn(subsys, host->nqn);
+				free(host);
+				break;
+			}
+	}
+
+	return _del_host(target, change->hostnqn);
+}
+
 int del_host(char *alias, char *resp)
 {
 	struct target		*target;
+	struct target		**targets;
 	struct subsystem	*subsys;
-	struct host		*host;
+	struct host_change	 change;
 	char			 hostnqn[MAX_NQN_SIZE + 1];
 	char			 dummy[MAX_BODY_SIZE];
+	int			*results;
+	int			 count = 0;
 	int			 dirty;
 	int			 ret;
 
 	ret = del_json_host(alias, resp, hostnqn);
+	if (ret || json_dry_run())
+		return ret;
+
+	ret = alloc_fan_out(&targets, &results);
 	if (ret)
 		return ret;
 
+	/* the json tree is shared, so it is only changed from here */
 	list_for_each_entry(target, target_list, node) {
 		dirty = 0;
 		list_for_each_entry(subsys, &target->subsys_list, node) {
 			if (!is_restricted(subsys))
 				continue;
 			dirty = 1;
-			list_for_each_entry(host, &subsys->host_list, node)
-				if (!strcmp(host->alias, alias)) {
-					_unlink_host(subsys, host);
-					list_del(&host->node);
-					_reset_subsys_dq_nqn(subsys, host->nqn);
-					del_json_acl(target->alias, subsys->nqn,
-						     host->alias, dummy);
-					free(host);
-					break;
-				}
+			del_json_acl(target->alias, subsys->nqn, alias, dummy);
 		}
 
-		if (dirty) {
-			ret = _del_host(target, hostnqn);
-			if (ret)
-				sprintf(resp, CONFIG_ALERT, target->alias);
-		} else
-			ret = 0;
+		if (dirty)
+			targets[count++] = target;
 	}
 
+	change.alias = alias;
+	change.newalias = NULL;
+	change.hostnqn = hostnqn;
+
+	fan_out_pushes(targets, count, results, del_host_on_target, &change);
+
+	if (count)
+		ret = fan_out_results(resp, targets, count, results);
+
+	free(targets);
+	free(results);
+
 	return ret;
 }
 
@@ -1526,7 +1999,7 @@ int link_host(char *tgt, char *subnqn, char *alias, char *data, char *resp)
 	int			 ret;
 
 	ret = set_json_acl(tgt, subnqn, alias, data, resp, newalias, hostnqn);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(tgt);
@@ -1591,7 +2064,7 @@ int unlink_host(char *tgt, char *subnqn, char *alias, char *resp)
 	int			 ret;
 
 	ret = del_json_acl(tgt, subnqn, alias, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	target = find_target(tgt);
@@ -1669,20 +2142,34 @@ static int send_link_portid_oob(struct subsystem *subsys, struct portid *portid)
 	return ret;
 }
 
-static int _link_portid(struct subsystem *subsys, struct portid *portid)
+static int __link_portid(struct subsystem *subsys, struct portid *portid)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (is_restricted(subsys) && list_empty(&subsys->host_list))
+	if (mode == IN_BAND_MGMT)
+		ret = send_link_portid_inb(subsys, portid);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_link_portid_oob(subsys, portid);
+	else
 		return 0;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_link_portid_inb(subsys, portid);
+	if (!ret) {
+		applied_link(&a, subsys, portid);
+		note_applied(target, &a);
+	}
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_link_portid_oob(subsys, portid);
+	return ret;
+}
 
-	return 0;
+static int _link_portid(struct subsystem *subsys, struct portid *portid)
+{
+	if (is_restricted(subsys) && list_empty(&subsys->host_list))
+		return 0;
+
+	return __link_portid(subsys, portid);
 }
 
 static int send_unlink_portid_inb(struct subsystem *subsys,
@@ -1730,14 +2217,23 @@ static inline int _unlink_portid(struct subsystem *subsys,
 				 struct portid *portid)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_unlink_portid_inb(subsys, portid);
+	if (mode == IN_BAND_MGMT)
+		ret = send_unlink_portid_inb(subsys, portid);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_unlink_portid_oob(subsys, portid);
+	else
+		return 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_unlink_portid_oob(subsys, portid);
+	if (!ret) {
+		applied_link(&a, subsys, portid);
+		forget_applied(target, &a);
+	}
 
-	return 0;
+	return ret;
 }
 
 /* SUBSYS */
@@ -1783,14 +2279,23 @@ static int send_del_subsys_oob(struct subsystem *subsys)
 static inline int _del_subsys(struct subsystem *subsys)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_del_subsys_inb(subsys);
+	if (mode == IN_BAND_MGMT)
+		ret = send_del_subsys_inb(subsys);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_del_subsys_oob(subsys);
+	else
+		return 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_del_subsys_oob(subsys);
+	if (!ret) {
+		applied_subsys(&a, subsys);
+		forget_applied(target, &a);
+	}
 
-	return 0;
+	return ret;
 }
 
 int del_subsys(char *alias, char *nqn, char *resp)
@@ -1801,7 +2306,7 @@ int del_subsys(char *alias, char *nqn, char *resp)
 	int			 ret;
 
 	ret = del_json_subsys(alias, nqn, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -1836,6 +2341,7 @@ static int config_subsys_oob(struct target *target, struct subsystem *subsys)
 	char			*alias = target->alias;
 	char			*nqn = subsys->nqn;
 	char			 buf[MAX_BODY_SIZE];
+	int			 err = 0;
 	int			 ret;
 
 	build_set_subsys_oob(subsys, buf, sizeof(buf));
@@ -1850,8 +2356,10 @@ static int config_subsys_oob(struct target *target, struct subsystem *subsys)
 		build_set_ns_oob(ns, buf, sizeof(buf));
 
 		ret = send_update_subsys_oob(target, nqn, URI_NAMESPACE, buf);
-		if (ret)
+		if (ret) {
 			print_err("set subsys ns OOB failed for %s", alias);
+			err = ret;
+		}
 	}
 
 	list_for_each_entry(host, &subsys->host_list, node) {
@@ -1860,39 +2368,61 @@ static int config_subsys_oob(struct target *target, struct subsystem *subsys)
 		ret = send_set_config_oob(target, URI_HOST, buf);
 		if (ret) {
 			print_err("set host OOB failed for %s", alias);
+			err = ret;
 			continue;
 		}
 
 		ret = send_update_subsys_oob(target, nqn, URI_HOST, buf);
 		if (ret) {
 			print_err("set subsys acl OOB failed for %s", alias);
+			err = ret;
 			continue;
 		}
 	}
 
 	if (is_restricted(subsys) && list_empty(&subsys->host_list))
-		return 0;
+		return err;
 
 	list_for_each_entry(portid, &target->portid_list, node) {
 		ret = send_link_portid_oob(subsys, portid);
-		if (ret)
+		if (ret) {
 			print_err("link subsys/port OOB failed for %s",
 				  alias);
+			err = ret;
+		}
 	}
 
-	return 0;
+	return err;
+}
+
+static int __config_subsys(struct target *target, struct subsystem *subsys)
+{
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
+
+	if (mode == IN_BAND_MGMT)
+		ret = config_subsys_inb(target, subsys);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = config_subsys_oob(target, subsys);
+	else
+		return 0;
+
+	if (!ret) {
+		applied_subsys(&a, subsys);
+		note_applied(target, &a);
+	}
+
+	return ret;
 }
 
 static inline int _config_subsys(struct target *target,
 				 struct subsystem *subsys)
 {
 	struct host		*host, *next_host;
-	int			 ret = 0;
+	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		ret = config_subsys_inb(target, subsys);
-	else if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		ret = config_subsys_oob(target, subsys);
+	ret = __config_subsys(target, subsys);
 
 	if (is_restricted(subsys))
 		return ret;
@@ -1922,7 +2452,7 @@ int set_subsys(char *alias, char *nqn, char *data, char *resp)
 	new_ss.access = UNDEFINED_ACCESS;
 
 	ret = set_json_subsys(alias, nqn, data, resp, &new_ss);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -2023,13 +2553,23 @@ static int send_del_portid_oob(struct target *target, struct portid *portid)
 
 static inline int _del_portid(struct target *target, struct portid *portid)
 {
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_del_portid_inb(target, portid);
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_del_portid_oob(target, portid);
+	if (mode == IN_BAND_MGMT)
+		ret = send_del_portid_inb(target, portid);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_del_portid_oob(target, portid);
+	else
+		return 0;
 
-	return 0;
+	if (!ret) {
+		applied_port(&a, portid);
+		forget_applied(target, &a);
+	}
+
+	return ret;
 }
 
 int del_portid(char *alias, int id, char *resp)
@@ -2043,7 +2583,7 @@ int del_portid(char *alias, int id, char *resp)
 	int			 ret;
 
 	ret = del_json_portid(alias, id, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -2064,6 +2604,8 @@ int del_portid(char *alias, int id, char *resp)
 		free(dq);
 	}
 
+	logpage_wrlock();
+
 	list_for_each_entry(subsys, &target->subsys_list, node)
 		list_for_each_entry_safe(logpage, next_log,
 					 &subsys->logpage_list, node) {
@@ -2073,6 +2615,18 @@ int del_portid(char *alias, int id, char *resp)
 			free(logpage);
 		}
 
+	list_for_each_entry_safe(logpage, next_log,
+				 &target->unattached_logpage_list, node) {
+		if (logpage->portid != portid)
+			continue;
+		list_del(&logpage->node);
+		free(logpage);
+	}
+
+	logpage_unlock();
+
+	save_logpage_snapshot(target);
+
 	ret = _del_portid(target, portid);
 	if (ret)
 		sprintf(resp, CONFIG_ALERT, target->alias);
@@ -2102,13 +2656,23 @@ static int config_portid_oob(struct target *target, struct portid *portid)
 
 static inline int _config_portid(struct target *target, struct portid *portid)
 {
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return config_portid_inb(target, portid);
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return config_portid_oob(target, portid);
+	if (mode == IN_BAND_MGMT)
+		ret = config_portid_inb(target, portid);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = config_portid_oob(target, portid);
+	else
+		return 0;
 
-	return 0;
+	if (!ret) {
+		applied_port(&a, portid);
+		note_applied(target, &a);
+	}
+
+	return ret;
 }
 
 static void _del_portid_dq(struct target *target, struct portid *portid)
@@ -2136,7 +2700,7 @@ int set_portid(char *alias, int id, char *data, char *resp)
 	struct linked_list	 list;
 
 	ret = set_json_portid(alias, id, data, resp, &_portid);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	if (id == 0)
@@ -2249,14 +2813,23 @@ static int send_set_ns_oob(struct subsystem *subsys, struct ns *ns)
 static inline int _set_ns(struct subsystem *subsys, struct ns *ns)
 {
 	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		return send_set_ns_inb(subsys, ns);
+	if (mode == IN_BAND_MGMT)
+		ret = send_set_ns_inb(subsys, ns);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_set_ns_oob(subsys, ns);
+	else
+		return 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return send_set_ns_oob(subsys, ns);
+	if (!ret) {
+		applied_ns(&a, subsys, ns);
+		note_applied(target, &a);
+	}
 
-	return 0;
+	return ret;
 }
 
 int set_ns(char *alias, char *nqn, char *data, char *resp)
@@ -2271,7 +2844,7 @@ int set_ns(char *alias, char *nqn, char *data, char *resp)
 	memset(&ns, 0, sizeof(ns));
 
 	ret = set_json_ns(alias, nqn, data, resp, &result);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -2359,6 +2932,28 @@ static int send_del_ns_oob(struct subsystem *subsys, struct ns *ns)
 	return exec_delete(uri);
 }
 
+static inline int _del_ns(struct subsystem *subsys, struct ns *ns)
+{
+	struct target		*target = subsys->target;
+	struct applied		 a;
+	int			 mode = push_mode(target);
+	int			 ret;
+
+	if (mode == IN_BAND_MGMT)
+		ret = send_del_ns_inb(subsys, ns);
+	else if (mode == OUT_OF_BAND_MGMT)
+		ret = send_del_ns_oob(subsys, ns);
+	else
+		return 0;
+
+	if (!ret) {
+		applied_ns(&a, subsys, ns);
+		forget_applied(target, &a);
+	}
+
+	return ret;
+}
+
 int del_ns(char *alias, char *nqn, int nsid, char *resp)
 {
 	struct subsystem	*subsys;
@@ -2367,7 +2962,7 @@ int del_ns(char *alias, char *nqn, int nsid, char *resp)
 	int			 ret;
 
 	ret = del_json_ns(alias, nqn, nsid, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -2382,11 +2977,7 @@ int del_ns(char *alias, char *nqn, int nsid, char *resp)
 	if (!ns)
 		goto out;
 
-	if (target->mgmt_mode == IN_BAND_MGMT)
-		ret = send_del_ns_inb(subsys, ns);
-	else if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		ret = send_del_ns_oob(subsys, ns);
-
+	ret = _del_ns(subsys, ns);
 	if (ret)
 		sprintf(resp, CONFIG_ALERT, target->alias);
 
@@ -2448,20 +3039,21 @@ static int get_oob_config(struct target *target)
 static int config_target_inb(struct target *target)
 {
 	struct ctrl_queue	*ctrl = &target->sc_iface.inb;
+	struct mi_batch		 batch;
 	struct portid		*portid;
 	struct subsystem	*subsys;
 	struct ns		*ns;
 	struct host		*host;
 	int			 ret;
+	int			 err;
 
-	if (!ctrl->connected) {
-		ret = connect_ctrl(ctrl);
-		if (ret) {
-			print_err("failed to connect to %s", target->alias);
-			print_errno("connect_ctrl failed",  ret);
-			goto out1;
-		}
-	}
+	ret = connect_inb_ctrl(ctrl);
+	if (ret)
+		goto out1;
+
+	ret = open_mi_batch(&batch, ctrl);
+	if (ret)
+		goto out1;
 
 	list_for_each_entry(portid, &target->portid_list, node) {
 		ret = config_portid_inb(target, portid);
@@ -2500,13 +3092,18 @@ static int config_target_inb(struct target *target)
 				goto out2;
 		}
 	}
+out2:
+	err = close_mi_batch(&batch);
+	if (!ret)
+		ret = err;
 
-	target_refresh(target->alias);
+	if (!ret) {
+		target_refresh(target->alias);
+		return 0;
+	}
 
-	return 0;
-out2:
 	if (ctrl->failed_kato)
-		disconnect_ctrl(ctrl, 0);
+		disconnect_inb_ctrl(ctrl);
 out1:
 	return ret;
 }
@@ -2515,7 +3112,12 @@ static int config_target_oob(struct target *target)
 {
 	struct portid		*portid;
 	struct subsystem	*subsys;
+	bool			 batch;
 	int			 ret = 0;
+	int			 err;
+
+	batch = open_oob_batch();
+	oob_batch_target(target);
 
 	list_for_each_entry(portid, &target->portid_list, node) {
 		ret = config_portid_oob(target, portid);
@@ -2529,8 +3131,16 @@ static int config_target_oob(struct target *target)
 			break;
 	}
 
+	err = close_oob_batch(batch, NULL);
+	if (!ret)
+		ret = err;
+
 	target_refresh(target->alias);
+
+	return ret;
 out:
+	close_oob_batch(batch, NULL);
+
 	return ret;
 }
 
@@ -2547,34 +3157,27 @@ int get_config(struct target *target)
 
 int config_target(struct target *target)
 {
+	LINKED_LIST(applied);
+	int			 ret;
+
 	if (target->mgmt_mode == IN_BAND_MGMT)
-		return config_target_inb(target);
+		ret = config_target_inb(target);
+	else if (target->mgmt_mode == OUT_OF_BAND_MGMT)
+		ret = config_target_oob(target);
+	else
+		return 0;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		return config_target_oob(target);
+	if (ret || build_applied_config(target, &applied))
+		forget_applied_config(target);
+	else
+		set_applied_config(target, &applied);
 
-	return 0;
+	return ret;
 }
 
 static int _send_reset_config(struct ctrl_queue *ctrl)
 {
-	int			 ret;
-
-	if (ctrl->connected) {
-		ret = send_mi_send(&ctrl->ep, nvmf_reset_config, 0, NULL);
-		if (!ret)
-			return 0;
-
-		ctrl->connected = 0;
-	}
-
-	ret = connect_ctrl(ctrl);
-	if (ret)
-		return ret;
-
-	ctrl->connected = 1;
-
-	return send_mi_send(&ctrl->ep, nvmf_reset_config, 0, NULL);
+	return send_set_config(ctrl, nvmf_reset_config, 0, NULL);
 }
 
 static int send_del_target_inb(struct target *target)
@@ -2608,13 +3211,535 @@ int send_del_target(struct target *target)
 	int			ret = 0;
 
 	if (target->mgmt_mode == IN_BAND_MGMT)
-		send_del_target_inb(target);
+		ret = send_del_target_inb(target);
 	else if (target->mgmt_mode == OUT_OF_BAND_MGMT)
-		send_del_target_oob(target);
+		ret = send_del_target_oob(target);
+
+	/* after a reset the endpoint holds nothing of ours */
+	forget_applied_config(target);
+	target->applied_valid = !ret;
+
+	return ret;
+}
+
+static int push_removal(struct target *target, struct applied *a)
+{
+	struct applied		 obj = *a;
+	struct subsystem	 subsys;
+	struct host		 host;
+
+	memset(&subsys, 0, sizeof(subsys));
+	INIT_LINKED_LIST(&subsys.host_list);
+	INIT_LINKED_LIST(&subsys.ns_list);
+	INIT_LINKED_LIST(&subsys.logpage_list);
+
+	subsys.target = target;
+	subsys.access = obj.access;
+	strcpy(subsys.nqn, obj.nqn);
+
+	memset(&host, 0, sizeof(host));
+	strcpy(host.nqn, obj.hostnqn);
+
+	switch (obj.type) {
+	case APPLIED_PORT:
+		return _del_portid(target, &obj.portid);
+	case APPLIED_HOST:
+		return _del_host(target, obj.hostnqn);
+	case APPLIED_SUBSYS:
+		return _del_subsys(&subsys);
+	case APPLIED_ACL:
+		return _unlink_host(&subsys, &host);
+	case APPLIED_NS:
+		return _del_ns(&subsys, &obj.ns);
+	case APPLIED_LINK:
+		return _unlink_portid(&subsys, &obj.portid);
+	}
+
+	return 0;
+}
+
+static int push_addition(struct target *target, struct applied *a)
+{
+	struct subsystem	*subsys = NULL;
+	struct portid		*portid;
+	struct host		*host;
+	struct ns		*ns;
+
+	if (a->type != APPLIED_PORT && a->type != APPLIED_HOST) {
+		subsys = find_subsys(target, a->nqn);
+		if (!subsys)
+			return -ENOENT;
+	}
+
+	switch (a->type) {
+	case APPLIED_PORT:
+		portid = find_portid(target, a->portid.portid);
+		return portid ? _config_portid(target, portid) : -ENOENT;
+	case APPLIED_SUBSYS:
+		return __config_subsys(target, subsys);
+	case APPLIED_ACL:
+		list_for_each_entry(host, &subsys->host_list, node)
+			if (!strcmp(host->nqn, a->hostnqn))
+				return _link_host(subsys, host);
+		return -ENOENT;
+	case APPLIED_NS:
+		ns = find_ns(subsys, a->ns.nsid);
+		return ns ? _set_ns(subsys, ns) : -ENOENT;
+	case APPLIED_LINK:
+		portid = find_portid(target, a->portid.portid);
+		return portid ? __link_portid(subsys, portid) : -ENOENT;
+	}
+
+	/* hosts are created along with their ACLs */
+	return 0;
+}
+
+/* a changed subsystem is updated in place, anything else is replaced */
+static inline bool is_stale(struct applied *a, struct linked_list *desired)
+{
+	struct applied		*d = find_applied(desired, a);
+
+	return !d || (a->type != APPLIED_SUBSYS && !same_applied_value(a, d));
+}
+
+static int remove_stale(struct target *target, int type, int *count)
+{
+	struct applied		*a;
+	int			 ret = 0;
+	int			 err;
+again:
+	/* a removal can take dependent entries with it; rescan after each */
+	list_for_each_entry(a, &target->applied_list, node) {
+		if (a->type != type || !a->stale)
+			continue;
+
+		a->stale = 0;
+
+		err = push_removal(target, a);
+		if (err)
+			ret = err;
+		else
+			(*count)++;
+
+		goto again;
+	}
+
+	return ret;
+}
+
+/*
+ * Bring the endpoint in line with the target by pushing only what differs
+ * from what was last applied: stale objects are removed children first,
+ * then missing or changed ones are added parents first.  Subsystems,
+ * namespaces and ports that did not change are left alone.  The target
+ * config must have been read with get_config() first.
+ */
+static int apply_config_delta(struct target *target)
+{
+	struct applied		*a, *d;
+	LINKED_LIST(desired);
+	int			 added = 0, removed = 0;
+	bool			 batch;
+	int			 type;
+	int			 ret, err;
+
+	if (target->mgmt_mode == LOCAL_MGMT)
+		return 0;
+
+	if (!target->applied_valid) {
+		print_info("full reconfig of %s", target->alias);
+
+		ret = send_del_target(target);
+		if (ret)
+			return ret;
+
+		return config_target(target);
+	}
+
+	ret = build_applied_config(target, &desired);
+	if (ret)
+		return ret;
+
+	list_for_each_entry(a, &target->applied_list, node)
+		a->stale = is_stale(a, &desired);
+
+	batch = open_oob_batch();
+	oob_batch_target(target);
+
+	for (type = APPLIED_TYPES - 1; type >= 0; type--) {
+		err = remove_stale(target, type, &removed);
+		if (err)
+			ret = err;
+	}
+
+	for (type = 0; type < APPLIED_TYPES; type++)
+		list_for_each_entry(d, &desired, node) {
+			if (d->type != type)
+				continue;
+
+			a = find_applied(&target->applied_list, d);
+			if (a && same_applied_value(a, d))
+				continue;
+
+			err = push_addition(target, d);
+			if (err)
+				ret = err;
+			else
+				added++;
+		}
+
+	err = close_oob_batch(batch, NULL);
+	if (err)
+		ret = err;
+
+	free_applied_list(&desired);
+
+	print_info("reconfig of %s: %d added, %d removed%s", target->alias,
+		   added, removed, ret ? ", with errors" : "");
+
+	return ret;
+}
+
+static int push_config_delta(struct target *target)
+{
+	int			 ret;
+
+	if (target->mgmt_mode == LOCAL_MGMT)
+		return 0;
+
+	/* never talk to the target with the config locked, leave it pending */
+	if (json_write_held()) {
+		target->push_pending = true;
+		push_now = true;
+		return 0;
+	}
+
+	ret = get_config(target);
+	if (ret)
+		return ret;
+
+	return apply_config_delta(target);
+}
+
+int reconfig_target(struct target *target)
+{
+	int			 ret;
+
+	/* anything queued goes out with this push */
+	target->push_deadline = TIMER_NEVER;
+
+	/* a REST request pushes once it released the config */
+	if (defer_pushes) {
+		if (target->mgmt_mode != LOCAL_MGMT) {
+			target->push_pending = true;
+			push_now = true;
+		}
+		return 0;
+	}
+
+	ret = push_config_delta(target);
+
+	if (target->mgmt_mode != LOCAL_MGMT)
+		target_refresh(target->alias);
 
 	return ret;
 }
 
+void defer_target_pushes(void)
+{
+	defer_pushes = true;
+}
+
+/* reading the config back is fabric I/O too, a REST request defers it */
+static int read_target_config(struct target *target)
+{
+	if (target->mgmt_mode != IN_BAND_MGMT &&
+	    target->mgmt_mode != OUT_OF_BAND_MGMT)
+		return 0;
+
+	if (defer_pushes) {
+		target->config_pending = true;
+		return 0;
+	}
+
+	return get_config(target);
+}
+
+static int read_pending_target(struct target *target, void *arg)
+{
+	UNUSED(arg);
+
+	return get_config(target);
+}
+
+/* the targets whose config a REST request read back, in parallel */
+static void read_deferred_config(char *resp)
+{
+	struct target		*target;
+	struct target		**targets;
+	int			*results;
+	int			 count = 0;
+	int			 i;
+
+	if (alloc_fan_out(&targets, &results)) {
+		print_err("unable to alloc deferred read list");
+		list_for_each_entry(target, target_list, node)
+			target->config_pending = false;
+		return;
+	}
+
+	list_for_each_entry(target, target_list, node)
+		if (target->config_pending) {
+			target->config_pending = false;
+			targets[count++] = target;
+		}
+
+	fan_out_targets(targets, count, results, read_pending_target, NULL);
+
+	for (i = 0; i < count; i++)
+		if (results[i] && resp)
+			sprintf(resp, CONFIG_ALERT, targets[i]->alias);
+
+	free(targets);
+	free(results);
+}
+
+/* refreshing reads log pages over the fabric, hold it back as well */
+bool defer_target_refresh(struct target *target)
+{
+	if (!defer_pushes)
+		return false;
+
+	target->refresh_pending = true;
+
+	return true;
+}
+
+int deferred_config_count(void)
+{
+	struct target		*target;
+	int			 count = 0;
+
+	list_for_each_entry(target, target_list, node)
+		if (target->push_pending)
+			count++;
+
+	return count;
+}
+
+static void refresh_deferred_targets(void)
+{
+	struct target		*target;
+
+	list_for_each_entry(target, target_list, node)
+		if (target->push_pending || target->refresh_pending) {
+			target->push_pending = false;
+			target->refresh_pending = false;
+			target_refresh(target->alias);
+		}
+}
+
+/*
+ * Reading the config and pushes that are not out of band are done on the
+ * worker pool; out of band deltas are queued by push_deferred_config().
+ */
+static int prepare_pending_target(struct target *target, void *arg)
+{
+	int			 ret;
+
+	UNUSED(arg);
+
+	if (target->mgmt_mode == LOCAL_MGMT)
+		return 0;
+
+	ret = get_config(target);
+	if (ret)
+		return ret;
+
+	if (target->mgmt_mode != OUT_OF_BAND_MGMT)
+		ret = apply_config_delta(target);
+
+	return ret;
+}
+
+/*
+ * The changed targets are read and non-oob ones pushed in parallel, as a
+ * host change fans out.  The out of band deltas of all of them are then
+ * queued into a single curl batch, so every endpoint is written at once.
+ */
+int push_deferred_config(char *resp)
+{
+	struct target		*target;
+	struct target		**targets;
+	int			*results;
+	int			 count = 0;
+	bool			 batch;
+	int			 i;
+
+	/* an import still holding the config pushes once it is dropped */
+	if (json_write_held()) {
+		push_now = true;
+		return 0;
+	}
+
+	defer_pushes = false;
+
+	if (alloc_fan_out(&targets, &results)) {
+		print_err("unable to alloc deferred push list");
+		list_for_each_entry(target, target_list, node)
+			if (target->push_pending) {
+				forget_applied_config(target);
+				target->push_pending = false;
+			}
+		return -ENOMEM;
+	}
+
+	list_for_each_entry(target, target_list, node)
+		if (target->push_pending)
+			targets[count++] = target;
+
+	fan_out_targets(targets, count, results, prepare_pending_target, NULL);
+
+	batch = open_oob_batch();
+
+	for (i = 0; i < count; i++) {
+		target = targets[i];
+		if (results[i] || target->mgmt_mode != OUT_OF_BAND_MGMT)
+			continue;
+
+		oob_batch_target(target);
+		results[i] = apply_config_delta(target);
+	}
+
+	/* failed sends drop the applied record and alert on their own */
+	close_oob_batch(batch, resp);
+
+	for (i = 0; i < count; i++) {
+		if (!results[i])
+			continue;
+
+		target = targets[i];
+		print_err("deferred push to %s failed %d", target->alias,
+			  results[i]);
+		forget_applied_config(target);
+		if (resp)
+			sprintf(resp, CONFIG_ALERT, target->alias);
+	}
+
+	free(targets);
+	free(results);
+
+	refresh_deferred_targets();
+
+	return count;
+}
+
+/*
+ * With a push delay set, the targets a REST request changed are not pushed
+ * to at the end of the request but queued: further changes within the
+ * delay push it back, up to PUSH_DELAY_MAX delays after the first, and the
+ * queued changes then go out as one delta, so adding then deleting an
+ * object sends nothing and repeated updates only send the last value.
+ */
+#define PUSH_DELAY_MAX		10
+
+void queue_deferred_config(void)
+{
+	struct target		*target;
+	u64			 now = time_msec();
+	u64			 limit;
+
+	defer_pushes = false;
+
+	list_for_each_entry(target, target_list, node) {
+		if (!target->push_pending)
+			continue;
+
+		target->push_pending = false;
+
+		if (target->push_deadline == TIMER_NEVER)
+			target->push_since = now;
+
+		limit = target->push_since + PUSH_DELAY_MAX * push_delay;
+
+		target->push_deadline = min(now + push_delay, limit);
+
+		set_target_timer(target, target_deadline(target));
+	}
+
+	refresh_deferred_targets();
+}
+
+/*
+ * REST requests change the config with pushes deferred and the json lock
+ * held, then call this once the lock is dropped so the fabric I/O does not
+ * hold up other requests.  Explicit reconfigs and commits go out right
+ * away, anything else waits for the push delay when one is set.
+ */
+int finish_deferred_config(char *resp)
+{
+	bool			 now = push_now;
+
+	push_now = false;
+
+	read_deferred_config(resp);
+
+	if (push_delay > 0 && !now) {
+		queue_deferred_config();
+		return 0;
+	}
+
+	return push_deferred_config(resp);
+}
+
+/* runs on a worker thread with the target locked */
+int push_queued_config(struct target *target)
+{
+	int			 ret;
+
+	ret = push_config_delta(target);
+	if (ret) {
+		print_err("queued push to %s failed %d", target->alias, ret);
+
+		forget_applied_config(target);
+		target_failed(target);
+
+		/* keep it queued, the backoff paces the retries */
+		target->push_deadline = target->retry_deadline;
+		return ret;
+	}
+
+	target_refresh(target->alias);
+
+	return 0;
+}
+
+/* push what is queued for the target, or for all targets, right away */
+int commit_queued_config(struct target *target, char *resp)
+{
+	struct target		*iter;
+	int			 count = 0;
+
+	list_for_each_entry(iter, target_list, node)
+		if (iter->push_deadline != TIMER_NEVER &&
+		    (!target || iter == target)) {
+			iter->push_deadline = TIMER_NEVER;
+			iter->push_pending = true;
+			count++;
+		}
+
+	if (target)
+		set_target_timer(target, target_deadline(target));
+
+	/* inside a REST request the push waits for the json lock to drop */
+	if (defer_pushes || json_write_held()) {
+		push_now = true;
+		return count;
+	}
+
+	return push_deferred_config(resp);
+}
+
 int del_target(char *alias, char *resp)
 {
 	struct target		*target;
@@ -2626,7 +3751,7 @@ int del_target(char *alias, char *resp)
 	int			 ret;
 
 	ret = del_json_target(alias, resp);
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	target = find_target(alias);
@@ -2643,12 +3768,22 @@ int del_target(char *alias, char *resp)
 	list_for_each_entry(portid, &target->portid_list, node)
 		_del_portid(target, portid);
 
+	cancel_target_work(target);
+	cancel_warm_up(target);
+	del_target_timer(target);
+	del_logpage_snapshot(target);
+
+	logpage_wrlock();
 	list_del(&target->node);
+	logpage_unlock();
 
 	create_event_host_list_for_target(&list, target);
 	send_notifications(&list);
 
-	free(target);
+	if (target->mgmt_mode == IN_BAND_MGMT)
+		disconnect_inb_ctrl(&target->sc_iface.inb);
+
+	free_target(target);
 out:
 	return ret;
 }
@@ -2675,7 +3810,11 @@ static inline void set_inb_interface(union sc_iface *iface,
 		if (!portid)
 			return;
 		iface->inb.portid = portid;
-	}
+	} else if (strcmp(portid->type, result->inb.portid->type) ||
+		   strcmp(portid->family, result->inb.portid->family) ||
+		   strcmp(portid->address, result->inb.portid->address) ||
+		   portid->port_num != result->inb.portid->port_num)
+		disconnect_inb_ctrl(&iface->inb);
 
 	strcpy(portid->type, result->inb.portid->type);
 	strcpy(portid->family, result->inb.portid->family);
@@ -2684,6 +3823,30 @@ static inline void set_inb_interface(union sc_iface *iface,
 	portid->port_num = result->inb.portid->port_num;
 }
 
+/* a different endpoint holds none of what was applied to the old one */
+static bool same_interface(struct target *target, int mode,
+			   union sc_iface *iface)
+{
+	struct portid		*portid = target->sc_iface.inb.portid;
+
+	if (target->mgmt_mode != mode)
+		return false;
+
+	if (mode == OUT_OF_BAND_MGMT)
+		return target->sc_iface.oob.port == iface->oob.port &&
+		       !strcmp(target->sc_iface.oob.address,
+			       iface->oob.address);
+
+	if (mode == IN_BAND_MGMT)
+		return portid &&
+		       !strcmp(portid->type, iface->inb.portid->type) &&
+		       !strcmp(portid->family, iface->inb.portid->family) &&
+		       !strcmp(portid->address, iface->inb.portid->address) &&
+		       portid->port_num == iface->inb.portid->port_num;
+
+	return true;
+}
+
 int set_interface(char *alias, char *data, char *resp)
 {
 	int			 ret;
@@ -2692,15 +3855,21 @@ int set_interface(char *alias, char *data, char *resp)
 	union sc_iface		 result;
 	int			 mode;
 
-	target = find_target(alias);
-	if (!target) {
+	/* in a dry run the target may have been added or changed before */
+	if (json_dry_run()) {
+		target = NULL;
+		mode = get_json_mgmt_mode(alias);
+	} else {
+		target = find_target(alias);
+		mode = target ? target->mgmt_mode : -ENOENT;
+	}
+
+	if (mode < 0) {
 		ret = -ENOENT;
 		strcpy(resp, TARGET_ERR);
 		goto out;
 	}
 
-	mode = target->mgmt_mode;
-
 	if (mode == OUT_OF_BAND_MGMT)
 		ret = set_json_oob_interface(alias, data, resp, &result);
 	else if (mode == IN_BAND_MGMT)
@@ -2710,11 +3879,14 @@ int set_interface(char *alias, char *data, char *resp)
 		ret = -EINVAL;
 	}
 
-	if (ret)
+	if (ret || json_dry_run())
 		goto out;
 
 	iface = &target->sc_iface;
 
+	if (!same_interface(target, mode, &result))
+		forget_applied_config(target);
+
 	if (mode == OUT_OF_BAND_MGMT)
 		set_oob_interface(iface, &result);
 	else if (mode == IN_BAND_MGMT)
@@ -2734,10 +3906,15 @@ int add_target(char *alias, char *resp)
 		return -EEXIST;
 	}
 
+	if (json_dry_run())
+		return 0;
+
 	target = alloc_target(alias);
 	if (!target)
 		return -ENOMEM;
 
+	arm_target_timers(target);
+
 	return 0;
 }
 
@@ -2755,7 +3932,7 @@ int update_target(char *alias, char *data, char *resp)
 	result.sc_iface.inb.portid = &portid;
 
 	ret = update_json_target(alias, data, resp, &result);
-	if (ret)
+	if (ret || json_dry_run())
 		return ret;
 
 	if (!alias) {
@@ -2768,19 +3945,31 @@ int update_target(char *alias, char *data, char *resp)
 			return -EFAULT;
 
 		if (strcmp(result.alias, alias))
-			strcpy(target->alias, result.alias);
+			rename_logpage_snapshot(target, result.alias);
+	}
+
+	if (!same_interface(target, result.mgmt_mode, &result.sc_iface))
+		forget_applied_config(target);
+
+	/* the management queue shares its storage with the oob interface */
+	if (target->mgmt_mode != result.mgmt_mode) {
+		if (target->mgmt_mode == IN_BAND_MGMT)
+			disconnect_inb_ctrl(&target->sc_iface.inb);
+		else if (result.mgmt_mode == IN_BAND_MGMT)
+			target->sc_iface.inb.connected = 0;
 	}
 
 	target->mgmt_mode = result.mgmt_mode;
 	target->refresh	  = result.refresh;
 
-	if (target->mgmt_mode == OUT_OF_BAND_MGMT) {
+	arm_target_timers(target);
+
+	if (target->mgmt_mode == OUT_OF_BAND_MGMT)
 		set_oob_interface(&target->sc_iface, &result.sc_iface);
-		ret = get_oob_config(target);
-	} else if (target->mgmt_mode == IN_BAND_MGMT) {
+	else if (target->mgmt_mode == IN_BAND_MGMT)
 		set_inb_interface(&target->sc_iface, &result.sc_iface);
-		ret = get_inb_config(target);
-	}
+
+	ret = read_target_config(target);
 
 	if (!ret)
 		sprintf(resp, "DEM configuration updated for target '%s'",
@@ -46,9 +46,6 @@
 
 #define CURL_DEBUG		0
 
-/* needs to be < NVMF_DISC_KATO in connect AND < 2 MIN for upstream target */
-#define KEEP_ALIVE_TIMER	120000 /* ms */
-
 static LINKED_LIST(target_linked_list);
 static LINKED_LIST(group_linked_list);
 static LINKED_LIST(host_linked_list);
@@ -61,12 +58,24 @@ int					 debug;
 int					 curl_show_results;
 struct host_iface			*interfaces;
 int					 num_interfaces;
+int					 push_delay;
 struct linked_list			*target_list = &target_linked_list;
 struct linked_list			*group_list = &group_linked_list;
 struct linked_list			*host_list = &host_linked_list;
 struct linked_list			*aen_req_list = &aen_linked_list;
 static pthread_t			*listen_threads;
 static int				 signalled;
+static int				 num_workers;
+static int				 num_rest_threads;
+
+static struct {
+	pthread_mutex_t			 lock;
+	int				 total;
+	int				 ready;
+	int				 failed;
+} startup = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 char shared_nqn[MAX_NQN_SIZE + 1];
 
@@ -88,9 +97,11 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data)
 	case MG_EV_HTTP_REQUEST:
 		handle_http_request(c, ev_data);
 		break;
+	case MG_EV_CLOSE:
+		close_http_request(c);
+		break;
 	case MG_EV_HTTP_CHUNK:
 	case MG_EV_ACCEPT:
-	case MG_EV_CLOSE:
 	case MG_EV_POLL:
 	case MG_EV_SEND:
 	case MG_EV_RECV:
@@ -100,71 +111,141 @@ static void ev_handler(struct mg_connection *c, int ev, void *ev_data)
 	}
 }
 
+static int timed_keep_alive(struct target *target, struct endpoint *ep)
+{
+	u64			 start = time_usec();
+	int			 ret;
+
+	ret = send_keep_alive(ep);
+
+	time_keep_alive(target, time_usec() - start, ret != 0);
+
+	return ret;
+}
+
 static int keep_alive_work(struct target *target)
 {
 	struct ctrl_queue	*dq;
 	struct ctrl_queue	*ctrl;
 	int			 ret;
 
-	if (--target->kato_countdown > 0)
-		return 0;
-
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (!dq->connected || dq->failed_kato)
 			continue;
 
-		ret = send_keep_alive(&dq->ep);
+		ret = timed_keep_alive(target, &dq->ep);
 		if (ret) {
 			print_err("keep alive failed %s", target->alias);
 			disconnect_ctrl(dq, 0);
-			target->log_page_retry_count = LOG_PAGE_RETRY;
+			target_failed(target);
 
 			return ret;
 		}
 	}
 
-	if (target->mgmt_mode == IN_BAND_MGMT) {
-		ctrl = &target->sc_iface.inb;
-		if (!ctrl->connected) {
-			ret = connect_ctrl(ctrl);
-			if (!ret)
-				ctrl->connected = 1;
-		} else {
-			ret = send_keep_alive(&ctrl->ep);
-			if (ret)
-				ctrl->connected = 0;
+	if (target->mgmt_mode != IN_BAND_MGMT)
+		return 0;
+
+	/* keeps the management queue up for the next refresh or config */
+	ctrl = &target->sc_iface.inb;
+	if (ctrl->connected) {
+		ret = timed_keep_alive(target, &ctrl->ep);
+		if (!ret)
+			return 0;
+
+		print_err("management keep alive failed %s", target->alias);
+		disconnect_inb_ctrl(ctrl);
+	}
+
+	ret = connect_inb_ctrl(ctrl);
+	if (ret)
+		target_failed(target);
+
+	return ret;
+}
+
+/* call with the target locked */
+static void expire_target(struct target *target, u64 now)
+{
+	int			 flags = 0;
+
+	/* circuit open: nothing goes to the target but the probe */
+	if (target->health == TARGET_DOWN) {
+		if (target->retry_deadline > now) {
+			set_target_timer(target, target->retry_deadline);
+			return;
 		}
+
+		set_target_state(target, health, TARGET_PROBING);
+		set_target_state(target, retry_deadline, TIMER_NEVER);
+		target->kato_deadline = next_keep_alive(now);
+		target->refresh_deadline = next_refresh(target, now);
+
+		schedule_target_work(target, WORK_REFRESH);
+		set_target_timer(target, now + IDLE_TIMEOUT);
+		return;
 	}
 
-	target->kato_countdown = KEEP_ALIVE_TIMER / IDLE_TIMEOUT / 2;
+	if (target->kato_deadline <= now) {
+		flags |= WORK_KEEP_ALIVE;
+		target->kato_deadline = next_keep_alive(now);
+	}
 
-	return 0;
+	if (target->push_deadline <= now) {
+		flags |= WORK_PUSH;
+		target->push_deadline = TIMER_NEVER;
+	}
+
+	if (target->retry_deadline != TIMER_NEVER) {
+		if (target->retry_deadline <= now) {
+			flags |= WORK_REFRESH;
+			set_target_state(target, retry_deadline, TIMER_NEVER);
+		}
+	} else if (target->refresh_deadline <= now) {
+		flags |= WORK_REFRESH;
+		target->refresh_deadline = next_refresh(target, now);
+	}
+
+	if (!flags) {
+		set_target_timer(target, target_deadline(target));
+		return;
+	}
+
+	schedule_target_work(target, flags);
+
+	/* look again once done, the work may have set a retry */
+	set_target_timer(target, now + IDLE_TIMEOUT);
 }
 
+/*
+ * Decide what is due on the poll loop, do the work on the worker pool.
+ * The deadlines and health are the workers' and REST requests' as well,
+ * a target busy with either is looked at again later rather than waited
+ * on, which would hold up the poll loop.
+ */
 static void periodic_work(void)
 {
 	struct target		*target;
+	u64			 now = time_msec();
 
-	list_for_each_entry(target, target_list, node) {
-		if (keep_alive_work(target))
-			continue;
-
-		if (target->log_page_retry_count)
-			if (--target->log_page_retry_count)
-				continue;
+	if (!begin_periodic_work())
+		return;
 
-		target->refresh_countdown--;
-		if (target->refresh_countdown)
+	while ((target = next_expired_target(now))) {
+		if (!trylock_target(target)) {
+			set_target_timer(target, now + IDLE_TIMEOUT);
 			continue;
+		}
 
-		if (target->mgmt_mode != LOCAL_MGMT)
-			get_config(target);
-
-		refresh_log_pages(target);
+		if (target_work_pending(target))
+			set_target_timer(target, now + IDLE_TIMEOUT);
+		else
+			expire_target(target, now);
 
-		target->refresh_countdown =
-			target->refresh * MINUTES / IDLE_TIMEOUT;
+		unlock_target(target);
 	}
+
+	end_periodic_work();
 }
 
 static void *poll_loop(struct mg_mgr *mgr)
@@ -172,10 +253,16 @@ static void *poll_loop(struct mg_mgr *mgr)
 	while (!stopped) {
 		mg_mgr_poll(mgr, IDLE_TIMEOUT);
 
-		if (!stopped)
+		if (!stopped) {
 			periodic_work();
+			flush_watchers();
+			ping_watchers();
+		}
 	}
 
+	cleanup_rest_threads();
+	cleanup_watch();
+
 	mg_mgr_free(mgr);
 
 	return NULL;
@@ -221,8 +308,8 @@ static void show_help(char *app)
 	const char		*arg_list = "{-d} {-s}";
 #endif
 
-	print_info("Usage: %s %s {-p <port>} {-r <root>} {-c <cert_file>}",
-		   app, arg_list);
+	print_info("Usage: %s %s {-p <port>} {-r <root>} {-c <cert_file>} "
+		   "{-w <workers>} {-t <threads>} {-b <msec>}", app, arg_list);
 #ifdef CONFIG_DEBUG
 	print_info("  -q - quiet mode, no debug prints");
 	print_info("  -d - run as a daemon process (default is standalone)");
@@ -235,6 +322,10 @@ static void show_help(char *app)
 	print_info("  -r - HTTP interface: root (default %s)",
 		   DEFAULT_HTTP_ROOT);
 	print_info("  -c - HTTP interface: SSL cert file (default no SSL)");
+	print_info("  -w - number of target worker threads (default # cpus)");
+	print_info("  -t - number of REST request threads (default 4)");
+	print_info("  -b - coalesce target changes for msec before pushing "
+		   "(default 0, push right away)");
 }
 
 static int init_dem(int argc, char *argv[], char **ssl_cert)
@@ -242,9 +333,9 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 	int			 opt;
 	int			 run_as_daemon;
 #ifdef CONFIG_DEBUG
-	const char		*opt_list = "?qdp:r:c:";
+	const char		*opt_list = "?qdp:r:c:w:t:b:";
 #else
-	const char		*opt_list = "?dsp:r:c:";
+	const char		*opt_list = "?dsp:r:c:w:t:b:";
 #endif
 
 	curl_show_results = 0;
@@ -294,6 +385,15 @@ static int init_dem(int argc, char *argv[], char **ssl_cert)
 		case 'c':
 			*ssl_cert = optarg;
 			break;
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+		case 't':
+			num_rest_threads = atoi(optarg);
+			break;
+		case 'b':
+			push_delay = atoi(optarg);
+			break;
 		case '?':
 		default:
 help:
@@ -461,6 +561,8 @@ void create_discovery_queue(struct target *target, struct subsystem *subsys,
 	if (connect_ctrl(dq))
 		return;
 
+	dq->connected = 1;
+
 	fetch_log_pages(dq);
 
 	if (dq->failed_kato)
@@ -477,24 +579,130 @@ static void init_discovery_queue(struct target *target, struct portid *portid)
 		create_discovery_queue(target, subsys, portid);
 }
 
+/* call with the startup lock held */
+static void startup_progress(void)
+{
+	if (startup.ready + startup.failed == startup.total)
+		print_info("Startup complete: %d targets, %d failed",
+			   startup.total, startup.failed);
+}
+
+static void warm_up_target(struct target *target)
+{
+	struct portid		*portid;
+	int			 ret = 0;
+
+	if (target->mgmt_mode != LOCAL_MGMT) {
+		ret = get_config(target);
+		if (!ret)
+			ret = config_target(target);
+	}
+
+	list_for_each_entry(portid, &target->portid_list, node)
+		init_discovery_queue(target, portid);
+
+	if (ret)
+		target_failed(target);
+	else
+		target_succeeded(target);
+
+	pthread_mutex_lock(&startup.lock);
+
+	target->warming = false;
+
+	if (ret)
+		startup.failed++;
+	else
+		startup.ready++;
+
+	startup_progress();
+
+	pthread_mutex_unlock(&startup.lock);
+}
+
+/* a target deleted before it was warmed up no longer holds startup back */
+void cancel_warm_up(struct target *target)
+{
+	pthread_mutex_lock(&startup.lock);
+
+	if (target->warming) {
+		target->warming = false;
+		startup.total--;
+		startup_progress();
+	}
+
+	pthread_mutex_unlock(&startup.lock);
+}
+
+/* runs on a worker thread with the target locked */
+static void target_work(struct target *target, int flags)
+{
+	int			 ret = 0;
+
+	if (flags & WORK_STARTUP) {
+		warm_up_target(target);
+		return;
+	}
+
+	if (flags & WORK_PUSH)
+		push_queued_config(target);
+
+	if (flags & WORK_KEEP_ALIVE)
+		if (keep_alive_work(target))
+			return;
+
+	if (!(flags & WORK_REFRESH))
+		return;
+
+	if (target->mgmt_mode != LOCAL_MGMT)
+		ret = get_config(target);
+
+	if (refresh_log_pages(target))
+		ret = -EAGAIN;
+
+	if (ret)
+		target_failed(target);
+	else
+		target_succeeded(target);
+}
+
+void get_startup_status(int *total, int *ready, int *failed)
+{
+	pthread_mutex_lock(&startup.lock);
+
+	*total = startup.total;
+	*ready = startup.ready;
+	*failed = startup.failed;
+
+	pthread_mutex_unlock(&startup.lock);
+}
+
+/*
+ * Targets are brought up on the worker pool, so discovery and the REST
+ * interface are available right away and at most one target per worker
+ * is being configured and connected at any time.  Until a target has been
+ * reached, discovery serves the log pages from its last snapshot.
+ */
 static void init_targets(void)
 {
 	struct target		*target;
-	struct portid		*portid;
 
 	list_for_each_entry(target, target_list, node) {
-		target->refresh_countdown =
-			target->refresh * MINUTES / IDLE_TIMEOUT;
+		load_logpage_snapshot(target);
+		target->warming = true;
+		startup.total++;
+	}
+
+	if (!startup.total)
+		print_info("Startup complete: no targets defined");
 
-		target->log_page_retry_count = LOG_PAGE_RETRY;
+	list_for_each_entry(target, target_list, node) {
+		arm_target_timers(target);
 
-		if (target->mgmt_mode != LOCAL_MGMT)
-			if (!get_config(target))
-				config_target(target);
+		set_log_page_retry(target);
+		set_target_timer(target, target_deadline(target));
 
-		list_for_each_entry(portid, &target->portid_list, node) {
-			init_discovery_queue(target, portid);
-		}
+		schedule_target_work(target, WORK_STARTUP);
 	}
 }
 
@@ -533,10 +741,12 @@ static void cleanup_target_list(void)
 			free(dq);
 		}
 
-		if (target->mgmt_mode == IN_BAND_MGMT)
+		if (target->mgmt_mode == IN_BAND_MGMT) {
+			disconnect_inb_ctrl(&target->sc_iface.inb);
 			free(target->sc_iface.inb.portid);
+		}
 
-		free(target);
+		free_target(target);
 	}
 }
 
@@ -645,7 +855,7 @@ int main(int argc, char *argv[])
 
 	build_lists();
 
-	init_targets();
+	init_timers();
 
 	signalled = stopped = 0;
 
@@ -655,8 +865,23 @@ int main(int argc, char *argv[])
 	if (init_interface_threads(&listen_threads))
 		goto out3;
 
+	ret = init_workers(num_workers, target_work);
+	if (ret) {
+		cleanup_threads(listen_threads);
+		goto out3;
+	}
+
+	init_targets();
+
+	init_watch(&mgr);
+
+	/* without REST threads requests are run on the poll thread */
+	init_rest_threads(&mgr, num_rest_threads);
+
 	poll_loop(&mgr);
 
+	cleanup_workers();
+
 	cleanup_threads(listen_threads);
 
 	if (signalled)
@@ -664,6 +889,8 @@ int main(int argc, char *argv[])
 
 	ret = 0;
 out3:
+	cleanup_timers();
+	cleanup_metrics();
 	free(interfaces);
 	cleanup_lists();
 out2:
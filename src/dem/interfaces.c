@@ -45,7 +45,10 @@
 int target_reconfig(char *alias)
 {
 	struct target		*target;
-	int			 ret;
+
+	/* a dry run only checks the target is configured */
+	if (json_dry_run())
+		return get_json_mgmt_mode(alias) < 0 ? -ENOENT : 0;
 
 	list_for_each_entry(target, target_list, node)
 		if (!strcmp(target->alias, alias))
@@ -55,24 +58,33 @@ int target_reconfig(char *alias)
 found:
 	del_unattached_logpage_list(target);
 
-	ret = send_del_target(target);
-	if (ret)
-		return ret;
-
-	return config_target(target);
+	return reconfig_target(target);
 }
 
 int target_refresh(char *alias)
 {
 	struct target		*target;
 
+	/* a dry run only checks the target is configured */
+	if (json_dry_run())
+		return get_json_mgmt_mode(alias) < 0 ? -ENOENT : 0;
+
 	list_for_each_entry(target, target_list, node)
 		if (!strcmp(target->alias, alias))
 			goto found;
 
 	return -ENOENT;
 found:
-	refresh_log_pages(target);
+	if (defer_target_refresh(target))
+		return 0;
+
+	/* an explicit refresh doubles as a probe */
+	if (refresh_log_pages(target))
+		target_failed(target);
+	else
+		target_succeeded(target);
+
+	set_target_timer(target, target_deadline(target));
 
 	return 0;
 }
@@ -91,6 +103,38 @@ found:
 	return 0;
 }
 
+int target_health(char *alias, char **results)
+{
+	struct target		*target;
+	u64			 now = time_msec();
+	u64			 retry;
+	char			*p = *results;
+
+	list_for_each_entry(target, target_list, node)
+		if (!strcmp(target->alias, alias))
+			goto found;
+
+	return -ENOENT;
+found:
+	/* a worker may hold the target waiting on the json lock we hold */
+	retry = get_target_state(target, retry_deadline);
+
+	p += sprintf(p, "{" JSSTR "," JSSTR "," JSINDX, TAG_ALIAS,
+		     target->alias, TAG_STATE,
+		     target_health_str(get_target_state(target, health)),
+		     TAG_FAILURES, get_target_state(target, failures));
+
+	/* seconds until the next retry or probe */
+	if (retry != TIMER_NEVER)
+		p += sprintf(p, "," JSINT, TAG_NEXT_RETRY,
+			     (long long) (retry > now ?
+					  (retry - now) / 1000 : 0));
+
+	sprintf(p, "}");
+
+	return 0;
+}
+
 static void check_host(struct subsystem *subsys, json_t *acl,
 		       const char *alias, const char *nqn)
 {
@@ -328,14 +372,32 @@ struct target *alloc_target(char *alias)
 	INIT_LINKED_LIST(&target->device_list);
 	INIT_LINKED_LIST(&target->discovery_queue_list);
 	INIT_LINKED_LIST(&target->unattached_logpage_list);
+	INIT_LINKED_LIST(&target->work_node);
+	INIT_LINKED_LIST(&target->applied_list);
 
-	list_add_tail(&target->node, target_list);
+	pthread_mutex_init(&target->lock, NULL);
+
+	target->timer_index = -1;
+	target->push_deadline = TIMER_NEVER;
 
 	strncpy(target->alias, alias, MAX_ALIAS_SIZE);
 
+	logpage_wrlock();
+	list_add_tail(&target->node, target_list);
+	logpage_unlock();
+
 	return target;
 }
 
+void free_target(struct target *target)
+{
+	forget_applied_config(target);
+
+	pthread_mutex_destroy(&target->lock);
+
+	free(target);
+}
+
 static int setup_oob_target(json_t *parent, struct target *target)
 {
 	json_t			*iface;
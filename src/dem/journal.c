@@ -0,0 +1,574 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "common.h"
+
+#define JOURNAL_SUFFIX		".journal"
+#define PREV_SUFFIX		".journal.prev"
+#define COMPACT_SIZE		(1024 * 1024)	/* bytes of journal */
+#define COMPACT_INTERVAL	(10 * MINUTES)
+#define JOURNAL_POLL		1		/* seconds */
+
+/*
+ * Changes to the configuration are not written out by dumping the whole
+ * tree any more.  Each change appends one line per top level entry it
+ * touched (a target, host or group) holding the entry as it is now, or
+ * null once it is gone, to an append only journal.  A single thread writes
+ * and fsyncs whatever has been appended since its last pass, so concurrent
+ * changes share one fsync, and requests wait for their lines to be on disk
+ * before they are answered.
+ *
+ * Now and then the journal is compacted: it is renamed out of the way, a
+ * full snapshot of the tree is written to a temp file that is renamed over
+ * the config file, and the old journal is removed.  On start the snapshot
+ * is loaded and any journals left behind are replayed on top of it; since
+ * every line holds a whole entry, replaying lines that already made it into
+ * the snapshot does no harm as long as the later ones follow.
+ */
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work;
+	pthread_cond_t		 synced;
+	pthread_t		 thread;
+	char			*buf;
+	size_t			 len;
+	size_t			 size;
+	u64			 appended;
+	u64			 durable;
+	u64			 lost_at;	/* last line left out */
+	size_t			 bytes;
+	u64			 compacted;
+	int			 fd;
+	bool			 running;
+	bool			 stopping;
+	bool			 compact;
+	bool			 lost;
+	char			 config[FILENAME_MAX];
+	char			 path[FILENAME_MAX];
+	char			 prev[FILENAME_MAX];
+} journal = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.work		= PTHREAD_COND_INITIALIZER,
+	.synced		= PTHREAD_COND_INITIALIZER,
+	.fd		= -1,
+};
+
+/* last line appended by this thread, what journal_sync() waits for */
+static __thread u64 last_append;
+
+/* make a rename or unlink in the directory holding path durable */
+void sync_dir(const char *path)
+{
+	char			 dir[FILENAME_MAX];
+	int			 fd;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+
+	fsync(fd);
+	close(fd);
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t			 n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* write the snapshot to a temp file and rename it over the config file */
+static int write_snapshot(const char *data)
+{
+	char			 tmp[FILENAME_MAX + 4];
+	int			 fd;
+	int			 ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", journal.config);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		ret = -errno;
+		print_errno("unable to create config snapshot", ret);
+		return ret;
+	}
+
+	ret = write_all(fd, data, strlen(data));
+	if (!ret && fsync(fd))
+		ret = -errno;
+
+	close(fd);
+
+	if (!ret && rename(tmp, journal.config))
+		ret = -errno;
+
+	if (ret) {
+		print_errno("unable to write config snapshot", ret);
+		unlink(tmp);
+		return ret;
+	}
+
+	sync_dir(journal.config);
+
+	return 0;
+}
+
+int store_json_snapshot(json_t *root)
+{
+	char			*data;
+	int			 ret;
+
+	data = json_dumps(root, JSON_INDENT(2));
+	if (!data)
+		return -ENOMEM;
+
+	ret = write_snapshot(data);
+
+	free(data);
+
+	return ret;
+}
+
+static void apply_record(json_t *root, json_t *rec)
+{
+	const char		*section;
+	const char		*key;
+	json_t			*array;
+	json_t			*value;
+	json_t			*iter;
+	json_t			*obj;
+	int			 i, n;
+
+	section = json_string_value(json_object_get(rec, TAG_SECTION));
+	key = json_string_value(json_object_get(rec, TAG_KEY));
+	value = json_object_get(rec, TAG_VALUE);
+	if (!section || !key)
+		return;
+
+	array = json_object_get(root, section);
+	if (!array) {
+		array = json_array();
+		json_object_set_new(root, section, array);
+	}
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		iter = json_array_get(array, i);
+		obj = json_object_get(iter, entry_key(section));
+		if (obj && json_is_string(obj) &&
+		    !strcmp(json_string_value(obj), key))
+			break;
+	}
+
+	if (!value || json_is_null(value)) {
+		if (i < n)
+			json_array_remove(array, i);
+	} else if (i < n)
+		json_array_set(array, i, value);
+	else
+		json_array_append(array, value);
+}
+
+/* a torn last line is a change that was never acknowledged, stop there */
+static int replay_file(const char *path, json_t *root)
+{
+	json_error_t		 error;
+	json_t			*rec;
+	FILE			*fd;
+	char			*line = NULL;
+	size_t			 size = 0;
+	ssize_t			 len;
+	int			 count = 0;
+
+	fd = fopen(path, "r");
+	if (!fd)
+		return 0;
+
+	while ((len = getline(&line, &size, fd)) > 0) {
+		if (line[len - 1] != '\n')
+			break;
+
+		rec = json_loadb(line, len, 0, &error);
+		if (!rec)
+			break;
+
+		apply_record(root, rec);
+		json_decref(rec);
+		count++;
+	}
+
+	free(line);
+	fclose(fd);
+
+	return count;
+}
+
+int replay_journal(const char *config, json_t *root)
+{
+	int			 count;
+
+	snprintf(journal.config, sizeof(journal.config), "%s", config);
+	snprintf(journal.path, sizeof(journal.path), "%s" JOURNAL_SUFFIX,
+		 config);
+	snprintf(journal.prev, sizeof(journal.prev), "%s" PREV_SUFFIX,
+		 config);
+
+	count = replay_file(journal.prev, root);
+	count += replay_file(journal.path, root);
+
+	if (count)
+		print_info("replayed %d config journal records", count);
+
+	return count;
+}
+
+void journal_entry(const char *section, const char *key, json_t *value)
+{
+	json_t			*rec;
+	char			*line;
+	char			*buf;
+	size_t			 len;
+
+	rec = json_object();
+	json_object_set_new(rec, TAG_SECTION, json_string(section));
+	json_object_set_new(rec, TAG_KEY, json_string(key));
+	json_object_set(rec, TAG_VALUE, value ? value : json_null());
+
+	line = json_dumps(rec, JSON_COMPACT);
+	json_decref(rec);
+
+	pthread_mutex_lock(&journal.lock);
+
+	if (!line)
+		goto lost;
+
+	len = strlen(line);
+
+	if (journal.len + len + 1 > journal.size) {
+		buf = realloc(journal.buf, journal.len + len + 1 + BODY_SIZE);
+		if (!buf)
+			goto lost;
+		journal.buf = buf;
+		journal.size = journal.len + len + 1 + BODY_SIZE;
+	}
+
+	memcpy(journal.buf + journal.len, line, len);
+	journal.len += len;
+	journal.buf[journal.len++] = '\n';
+	goto out;
+lost:
+	/* cannot journal it, no one is released until a snapshot holds it */
+	journal.lost = true;
+	journal.compact = true;
+	journal.lost_at = journal.appended + 1;
+out:
+	last_append = ++journal.appended;
+
+	pthread_cond_signal(&journal.work);
+
+	pthread_mutex_unlock(&journal.lock);
+
+	free(line);
+}
+
+bool journal_active(void)
+{
+	return journal.running;
+}
+
+/* must not be called with the json lock held */
+void journal_sync(void)
+{
+	if (!journal.running)
+		return;
+
+	pthread_mutex_lock(&journal.lock);
+
+	while (journal.durable < last_append && journal.running)
+		pthread_cond_wait(&journal.synced, &journal.lock);
+
+	pthread_mutex_unlock(&journal.lock);
+}
+
+static void take_pending(char **buf, size_t *len, u64 *seq)
+{
+	*buf = journal.buf;
+	*len = journal.len;
+	*seq = journal.appended;
+
+	journal.buf = NULL;
+	journal.len = 0;
+	journal.size = 0;
+}
+
+/*
+ * Once lines could not be written they are only on disk after the next
+ * snapshot, until then later lines that did make it into the journal do
+ * not release anyone either.
+ */
+static void mark_durable(u64 seq, size_t len)
+{
+	pthread_mutex_lock(&journal.lock);
+
+	journal.bytes += len;
+
+	if (!journal.lost && seq > journal.durable) {
+		journal.durable = seq;
+		pthread_cond_broadcast(&journal.synced);
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+}
+
+static int flush_pending(int fd, char *buf, size_t len)
+{
+	int			 ret;
+
+	if (!len)
+		return 0;
+
+	ret = write_all(fd, buf, len);
+	if (!ret && fdatasync(fd))
+		ret = -errno;
+
+	if (ret)
+		print_errno("unable to write config journal", ret);
+
+	return ret;
+}
+
+static void compact_journal(void)
+{
+	struct json_context	*ctx = get_json_context();
+	char			*data;
+	char			*buf;
+	size_t			 len;
+	u64			 seq;
+	bool			 rotated = false;
+	int			 fd;
+	int			 err, ret;
+
+	json_rdlock();
+	pthread_mutex_lock(&journal.lock);
+
+	take_pending(&buf, &len, &seq);
+
+	fd = journal.fd;
+
+	/* a journal left over from a failed compaction is still needed */
+	if (access(journal.prev, F_OK) && !rename(journal.path, journal.prev)) {
+		journal.fd = open(journal.path,
+				  O_WRONLY | O_CREAT | O_APPEND, 0600);
+		journal.bytes = 0;
+		rotated = true;
+	}
+
+	journal.compact = false;
+	journal.compacted = time_msec();
+
+	pthread_mutex_unlock(&journal.lock);
+
+	data = json_dumps(ctx->root, JSON_INDENT(2));
+
+	json_unlock();
+
+	err = flush_pending(fd, buf, len);
+	if (rotated)
+		close(fd);
+
+	free(buf);
+
+	if (data) {
+		ret = write_snapshot(data);
+		free(data);
+	} else {
+		print_err("unable to dump config for compaction");
+		ret = -ENOMEM;
+	}
+
+	/* the journals stay until a snapshot holds what they do */
+	if (!ret) {
+		unlink(journal.prev);
+		sync_dir(journal.prev);
+	}
+
+	pthread_mutex_lock(&journal.lock);
+
+	if (err)
+		journal.lost = true;
+
+	/*
+	 * With the journals kept nothing is lost by a failed snapshot, but
+	 * lines that could not be written hold their waiters until a later
+	 * snapshot makes it.  One left out after the tree was dumped is not
+	 * in this snapshot either.
+	 */
+	if (!ret && journal.lost_at <= seq)
+		journal.lost = false;
+	else if (journal.lost)
+		journal.compact = true;
+
+	pthread_mutex_unlock(&journal.lock);
+
+	mark_durable(seq, rotated ? 0 : len);
+}
+
+static void *journal_thread(void *arg)
+{
+	struct timespec		 ts;
+	char			*buf;
+	size_t			 len;
+	u64			 seq;
+	bool			 compact;
+
+	UNUSED(arg);
+
+	pthread_mutex_lock(&journal.lock);
+
+	while (!journal.stopping) {
+		/* a failed snapshot is retried once a poll, not in a loop */
+		if (!journal.len && (!journal.compact || journal.lost)) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += JOURNAL_POLL;
+			pthread_cond_timedwait(&journal.work, &journal.lock,
+					       &ts);
+		}
+
+		take_pending(&buf, &len, &seq);
+
+		pthread_mutex_unlock(&journal.lock);
+
+		/* lines that could not be written only survive in a snapshot */
+		compact = !!flush_pending(journal.fd, buf, len);
+		if (!compact)
+			mark_durable(seq, len);
+		free(buf);
+
+		pthread_mutex_lock(&journal.lock);
+
+		if (compact)
+			journal.lost = true;
+
+		if (journal.bytes > COMPACT_SIZE || (journal.bytes &&
+		    time_msec() - journal.compacted > COMPACT_INTERVAL))
+			compact = true;
+
+		if (compact || journal.compact) {
+			pthread_mutex_unlock(&journal.lock);
+			compact_journal();
+			pthread_mutex_lock(&journal.lock);
+		}
+	}
+
+	pthread_mutex_unlock(&journal.lock);
+
+	return NULL;
+}
+
+int init_journal(bool compact)
+{
+	int			 ret;
+
+	journal.fd = open(journal.path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (journal.fd < 0) {
+		ret = -errno;
+		print_errno("unable to open config journal", ret);
+		return ret;
+	}
+
+	journal.compacted = time_msec();
+	journal.compact = compact;
+	journal.running = true;
+
+	if (pthread_create(&journal.thread, NULL, journal_thread, NULL)) {
+		print_err("unable to start config journal thread");
+		journal.running = false;
+		close(journal.fd);
+		journal.fd = -1;
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* leave a clean snapshot and no journal behind */
+void cleanup_journal(void)
+{
+	if (!journal.running)
+		return;
+
+	pthread_mutex_lock(&journal.lock);
+	journal.stopping = true;
+	pthread_cond_signal(&journal.work);
+	pthread_mutex_unlock(&journal.lock);
+
+	pthread_join(journal.thread, NULL);
+
+	compact_journal();
+
+	pthread_mutex_lock(&journal.lock);
+	journal.running = false;
+	pthread_cond_broadcast(&journal.synced);
+	pthread_mutex_unlock(&journal.lock);
+
+	close(journal.fd);
+	journal.fd = -1;
+
+	unlink(journal.path);
+	sync_dir(journal.path);
+}
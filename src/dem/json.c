@@ -44,13 +44,319 @@ static struct json_context *ctx;
 
 /* helper functions */
 
+/*
+ * Targets, hosts and groups are looked up by name far more often than the
+ * arrays holding them change, so each keeps an index of name to position
+ * beside the tree.  A hit is checked against the array before it is used
+ * and the index is rebuilt whenever the array changed size behind its back,
+ * so only additions and renames have to keep it current.
+ */
+struct entry_index {
+	const char		*section;
+	const char		*tag;
+	json_t			*array;		/* array the index describes */
+	json_t			*keys;		/* name -> position */
+	int			 size;
+};
+
+static struct entry_index entry_index[] = {
+	{ .section = TAG_TARGETS,	.tag = TAG_ALIAS },
+	{ .section = TAG_HOSTS,		.tag = TAG_ALIAS },
+	{ .section = TAG_GROUPS,	.tag = TAG_NAME },
+};
+
+/* readers may rebuild an index, so look ups serialize on this */
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* targets whose subsystems may list a host, by host alias; a superset */
+static json_t *host_refs;
+
+/* set while this thread holds the json lock for writing */
+static __thread bool json_writer;
+
+/*
+ * Every entry a writer looks up, adds or renames is noted, and the next
+ * store only compares those against what it last journaled.  Noting too
+ * much costs a compare, so lookups that end up changing nothing are fine.
+ */
+static void mark_dirty(const char *section, const char *key)
+{
+	json_t			*keys;
+
+	if (!json_writer || ctx->all_dirty)
+		return;
+
+	keys = json_object_get(ctx->dirty, section);
+	if (!keys) {
+		keys = json_object();
+		if (json_object_set_new(ctx->dirty, section, keys))
+			goto err;
+	}
+
+	if (!json_object_set_new(keys, key, json_null()))
+		return;
+err:
+	/* have the next store compare everything rather than miss one */
+	ctx->all_dirty = true;
+}
+
+static struct entry_index *get_index(json_t *array, const char *tag)
+{
+	struct entry_index	*idx;
+	int			 i;
+
+	for (i = 0; i < NUM_ENTRIES(entry_index); i++) {
+		idx = &entry_index[i];
+		if (strcmp(tag, idx->tag) == 0 &&
+		    array == json_object_get(ctx->root, idx->section))
+			return idx;
+	}
+
+	return NULL;
+}
+
+static void build_index(struct entry_index *idx, json_t *array)
+{
+	json_t			*iter;
+	json_t			*obj;
+	const char		*key;
+	int			 i, n;
+
+	json_decref(idx->keys);
+	idx->keys = json_object();
+
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		iter = json_array_get(array, i);
+		obj = json_object_get(iter, idx->tag);
+		if (!obj || !json_is_string(obj))
+			continue;
+
+		key = json_string_value(obj);
+		if (!json_object_get(idx->keys, key))
+			json_object_set_new(idx->keys, key, json_integer(i));
+	}
+
+	idx->array = array;
+	idx->size = n;
+}
+
+static inline bool index_current(struct entry_index *idx, json_t *array)
+{
+	return idx->keys && idx->array == array &&
+		idx->size == (int) json_array_size(array);
+}
+
+/* returns -EAGAIN if the index pointed at an entry that has since moved */
+static int find_indexed(struct entry_index *idx, json_t *array, char *val,
+			json_t **result)
+{
+	json_t			*pos;
+	json_t			*iter;
+	json_t			*obj;
+	int			 i;
+
+	if (result)
+		*result = NULL;
+
+	if (!index_current(idx, array))
+		build_index(idx, array);
+
+	pos = json_object_get(idx->keys, val);
+	if (!pos)
+		return -ENOENT;
+
+	i = json_integer_value(pos);
+	iter = json_array_get(array, i);
+	obj = json_object_get(iter, idx->tag);
+	if (!obj || !json_is_string(obj) ||
+	    strcmp(json_string_value(obj), val) != 0)
+		return -EAGAIN;
+
+	if (result)
+		*result = iter;
+
+	return i;
+}
+
+/* call right after appending an entry to an indexed array */
+static void index_append(json_t *array, const char *tag)
+{
+	struct entry_index	*idx;
+	json_t			*obj;
+	int			 n;
+
+	idx = get_index(array, tag);
+	if (!idx)
+		return;
+
+	n = json_array_size(array);
+
+	obj = json_object_get(json_array_get(array, n - 1), tag);
+	if (obj && json_is_string(obj))
+		mark_dirty(idx->section, json_string_value(obj));
+
+	if (!idx->keys || idx->array != array || idx->size != n - 1)
+		return;
+
+	if (obj && json_is_string(obj) &&
+	    !json_object_get(idx->keys, json_string_value(obj)))
+		json_object_set_new(idx->keys, json_string_value(obj),
+				    json_integer(n - 1));
+
+	idx->size = n;
+}
+
+/* call right after changing the name of an entry of an indexed array */
+static void index_rename(json_t *array, const char *tag, char *old,
+			 char *new)
+{
+	struct entry_index	*idx;
+	json_t			*pos;
+
+	idx = get_index(array, tag);
+	if (!idx)
+		return;
+
+	mark_dirty(idx->section, old);
+	mark_dirty(idx->section, new);
+
+	if (!index_current(idx, array))
+		return;
+
+	pos = json_object_get(idx->keys, old);
+	if (!pos)
+		return;
+
+	json_object_set(idx->keys, new, pos);
+	json_object_del(idx->keys, old);
+}
+
+/* call right after removing the entry at pos, those after it move up */
+static void index_remove(json_t *array, const char *tag, char *name, int pos)
+{
+	struct entry_index	*idx;
+	const char		*key;
+	json_t			*val;
+	int			 i;
+
+	idx = get_index(array, tag);
+	if (!idx || !idx->keys)
+		return;
+
+	if (idx->array != array ||
+	    idx->size != (int) json_array_size(array) + 1) {
+		json_decref(idx->keys);
+		idx->keys = NULL;
+		return;
+	}
+
+	json_object_del(idx->keys, name);
+
+	json_object_foreach(idx->keys, key, val) {
+		i = json_integer_value(val);
+		if (i > pos)
+			json_integer_set(val, i - 1);
+	}
+
+	idx->size--;
+}
+
+static void add_host_ref(const char *host, const char *alias)
+{
+	json_t			*refs;
+
+	refs = json_object_get(host_refs, host);
+	if (!refs) {
+		refs = json_object();
+		json_object_set_new(host_refs, host, refs);
+	}
+
+	json_object_set_new(refs, alias, json_null());
+}
+
+static void ref_target_hosts(json_t *tgt)
+{
+	json_t			*alias;
+	json_t			*array;
+	json_t			*list;
+	json_t			*item;
+	int			 i, j;
+	int			 n, m;
+
+	alias = json_object_get(tgt, TAG_ALIAS);
+	if (!host_refs || !alias || !json_is_string(alias))
+		return;
+
+	array = json_object_get(tgt, TAG_SUBSYSTEMS);
+	n = json_array_size(array);
+	for (i = 0; i < n; i++) {
+		list = json_object_get(json_array_get(array, i), TAG_HOSTS);
+		m = json_array_size(list);
+		for (j = 0; j < m; j++) {
+			item = json_array_get(list, j);
+			if (json_is_string(item))
+				add_host_ref(json_string_value(item),
+					     json_string_value(alias));
+		}
+	}
+}
+
+static json_t *get_host_refs(const char *host)
+{
+	json_t			*targets;
+	int			 i, n;
+
+	if (!host_refs) {
+		host_refs = json_object();
+
+		targets = json_object_get(ctx->root, TAG_TARGETS);
+		n = json_array_size(targets);
+		for (i = 0; i < n; i++)
+			ref_target_hosts(json_array_get(targets, i));
+	}
+
+	return json_object_get(host_refs, host);
+}
+
+static void cleanup_indexes(void)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_ENTRIES(entry_index); i++) {
+		json_decref(entry_index[i].keys);
+		entry_index[i].keys = NULL;
+	}
+
+	json_decref(host_refs);
+	host_refs = NULL;
+}
+
 static int find_array(json_t *array, const char *tag, char *val,
 		      json_t **result)
 {
+	struct entry_index	*idx;
 	json_t			*iter;
 	json_t			*obj;
 	int			 i, n;
 
+	idx = get_index(array, tag);
+	if (idx) {
+		mark_dirty(idx->section, val);
+
+		pthread_mutex_lock(&index_lock);
+
+		i = find_indexed(idx, array, val, result);
+		if (i == -EAGAIN) {
+			build_index(idx, array);
+			i = find_indexed(idx, array, val, result);
+		}
+
+		pthread_mutex_unlock(&index_lock);
+
+		return i;
+	}
+
 	n = json_array_size(array);
 	for (i = 0; i < n; i++) {
 		iter = json_array_get(array, i);
@@ -115,127 +421,226 @@ static int find_array_string(json_t *array, char *val)
 	return -ENOENT;
 }
 
-static int strlen_array(json_t *array, char *tag)
+static bool has_fabric(json_t *entry, const char *fabric)
 {
-	json_t			*iter;
+	json_t			*list;
 	json_t			*obj;
-	int			 i, cnt;
-	int			 n = 0;
+	int			 i, n;
 
-	cnt = json_array_size(array);
+	list = json_object_get(entry, TAG_PORTIDS);
+	n = json_array_size(list);
 
-	for (i = 0; i < cnt; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
-
-		obj = json_object_get(iter, tag);
-		if (obj && json_is_string(obj))
-			n += strlen(json_string_value(obj)) + 4;
+	for (i = 0; i < n; i++) {
+		obj = json_object_get(json_array_get(list, i), TAG_TYPE);
+		if (obj && json_is_string(obj) &&
+		    !strcmp(fabric, json_string_value(obj)))
+			return true;
 	}
 
-	return n;
+	return false;
 }
 
-static int list_array(json_t *array, char *tag, char *resp)
+static bool has_string(json_t *entry, const char *tag, const char *value)
 {
-	json_t			*iter;
 	json_t			*obj;
-	char			*p = resp;
-	int			 i, n, cnt;
 
-	cnt = json_array_size(array);
+	obj = json_object_get(entry, tag);
 
-	for (i = 0; i < cnt; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	return obj && json_is_string(obj) &&
+		!strcmp(value, json_string_value(obj));
+}
 
-		obj = json_object_get(iter, tag);
-		if (obj && json_is_string(obj))
-			array_json_string(obj, p, i, n);
-	}
+static bool list_match(json_t *entry, const char *name,
+		       struct list_query *q, json_t *members)
+{
+	if (q->mode && !has_string(entry, TAG_MGMT_MODE, q->mode))
+		return false;
+
+	if (q->fabric && !has_fabric(entry, q->fabric))
+		return false;
+
+	if (q->nqn && !has_string(entry, TAG_HOSTNQN, q->nqn))
+		return false;
 
-	return p - resp;
+	if (members && !json_object_get(members, name))
+		return false;
+
+	return true;
 }
 
-static int filter_fabric(json_t *array, char *query, char *resp)
+/* names of the section's members in a group, as a set */
+static int group_members(const char *section, char *group, json_t **members)
 {
-	json_t			*iter;
-	json_t			*list;
+	json_t			*groups;
 	json_t			*obj;
-	char			*p = resp;
-	int			 i, j, n = 0, tmp, num_targets, num_ports;
+	json_t			*list;
+	int			 i, n;
 
-	query += PARM_FABRIC_LEN;
+	groups = json_object_get(ctx->root, TAG_GROUPS);
+	if (find_array(groups, TAG_NAME, group, &obj) < 0)
+		return -ENOENT;
 
-	num_targets = json_array_size(array);
+	*members = json_object();
 
-	for (i = 0; i < num_targets; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	list = json_object_get(obj, section);
+	n = json_array_size(list);
 
-		list = json_object_get(iter, TAG_PORTIDS);
-		if (!list || !json_is_array(list))
-			continue;
+	for (i = 0; i < n; i++) {
+		obj = json_array_get(list, i);
+		if (json_is_string(obj))
+			json_object_set_new(*members, json_string_value(obj),
+					    json_null());
+	}
 
-		num_ports = json_array_size(list);
+	return 0;
+}
 
-		for (j = 0; j < num_ports; j++) {
-			obj = json_array_get(list, j);
-			if (!json_is_object(obj))
-				continue;
+/* the entry cut down to its name and the requested tags */
+static void list_fields(struct writer *w, json_t *entry, const char *tag,
+			const char *name, char *fields, int n)
+{
+	json_t			*obj;
+	json_t			*value;
+	char			*field;
+	char			*str;
+	char			*p;
 
-			obj = json_object_get(obj, TAG_TYPE);
-			if (!obj || !json_is_string(obj))
-				continue;
-			if (strcmp(query, json_string_value(obj)))
-				continue;
+	obj = json_object();
+	json_object_set_new(obj, tag, json_string(name));
 
-			obj = json_object_get(iter, TAG_ALIAS);
-			if (!obj || !json_is_string(obj))
-				continue;
+	for (field = fields; *field; field = p) {
+		p = strchr(field, ',');
+		if (p)
+			*p++ = 0;
+		else
+			p = field + strlen(field);
 
-			array_json_string(obj, p, n, tmp);
-			n++;
-		}
+		value = json_object_get(entry, field);
+		if (value)
+			json_object_set(obj, field, value);
+
+		/* put the list back for the next entry */
+		if (*p)
+			p[-1] = ',';
+	}
+
+	str = json_dumps(obj, JSON_COMPACT);
+	if (str) {
+		write_resp(w, "%s%s", n ? "," : "", str);
+		free(str);
 	}
 
-	return p - resp;
+	json_decref(obj);
 }
 
-static int filter_mode(json_t *array, char *query, char *resp)
+/*
+ * Entries are only walked from the cursor on and the walk stops one match
+ * past the page, so the cost of a page does not depend on where it is.
+ */
+struct list_entry {
+	const char		*name;
+	json_t			*entry;
+};
+
+static int cmp_list_entry(const void *a, const void *b)
 {
-	json_t			*iter;
-	json_t			*obj;
-	char			*p = resp;
-	int			 i, n = 0, tmp, num_targets;
+	return strcmp(((const struct list_entry *) a)->name,
+		      ((const struct list_entry *) b)->name);
+}
 
-	query += PARM_MODE_LEN;
+/*
+ * Pages come in name order, so a cursor naming an entry deleted since
+ * still has a place: the page starts at the first name after it.
+ */
+static int list_section(const char *section, char *tag, struct list_query *q,
+			char **resp)
+{
+	struct writer		 w;
+	struct list_entry	*entries;
+	json_t			*array;
+	json_t			*entry;
+	json_t			*obj;
+	json_t			*members = NULL;
+	const char		*name;
+	const char		*last = NULL;
+	int			 i, cnt, size;
+	int			 n = 0;
+	int			 ret;
 
-	num_targets = json_array_size(array);
+	array = json_object_get(ctx->root, section);
+	size = json_array_size(array);
 
-	for (i = 0; i < num_targets; i++) {
-		iter = json_array_get(array, i);
-		if (!json_is_object(iter))
-			continue;
+	entries = calloc(size + 1, sizeof(*entries));
+	if (!entries) {
+		strcpy(*resp, "No memory!");
+		return -ENOMEM;
+	}
 
-		obj = json_object_get(iter, TAG_MGMT_MODE);
+	cnt = 0;
+	for (i = 0; i < size; i++) {
+		entry = json_array_get(array, i);
+		obj = json_object_get(entry, tag);
 		if (!obj || !json_is_string(obj))
 			continue;
-		if (strcmp(query, json_string_value(obj)))
-			continue;
 
-		obj = json_object_get(iter, TAG_ALIAS);
-		if (!obj || !json_is_string(obj))
+		entries[cnt].name = json_string_value(obj);
+		entries[cnt++].entry = entry;
+	}
+
+	i = 0;
+
+	/* unpaged listings keep config order */
+	if (q->after || q->limit)
+		qsort(entries, cnt, sizeof(*entries), cmp_list_entry);
+
+	if (q->after)
+		while (i < cnt && strcmp(entries[i].name, q->after) <= 0)
+			i++;
+
+	if (q->group) {
+		ret = group_members(section, q->group, &members);
+		if (ret) {
+			sprintf(*resp, "%s '%.*s' not found", TAG_GROUP,
+				MAX_ALIAS_SIZE, q->group);
+			free(entries);
+			return ret;
+		}
+	}
+
+	**resp = 0;
+	init_writer(&w, resp, BODY_SIZE);
+
+	write_resp(&w, "{" JSARRAY, section);
+
+	for (; i < cnt; i++) {
+		entry = entries[i].entry;
+		name = entries[i].name;
+		if (!list_match(entry, name, q, members))
 			continue;
 
-		array_json_string(obj, p, n, tmp);
+		if (q->limit && n == q->limit)
+			break;
+
+		if (q->fields)
+			list_fields(&w, entry, tag, name, q->fields, n);
+		else
+			write_resp(&w, "%s\"%s\"", n ? "," : "", name);
+
+		last = name;
 		n++;
 	}
 
-	return p - resp;
+	write_resp(&w, "]");
+
+	if (i < cnt && last)
+		write_resp(&w, "," JSSTR, TAG_NEXT, last);
+
+	write_resp(&w, "}");
+
+	json_decref(members);
+	free(entries);
+
+	return w.err;
 }
 
 static int del_from_array(json_t *parent, const char *tag,
@@ -291,6 +696,91 @@ err:
 	return -ENOENT;
 }
 
+static const char *journal_sections[] = {
+	TAG_TARGETS, TAG_HOSTS, TAG_GROUPS
+};
+
+/* what changes to each section are called on the watch stream */
+static const char *section_events[] = {
+	URI_TARGET, URI_HOST, URI_GROUP
+};
+
+/*
+ * Each change to an entry takes the next generation, which becomes that of
+ * the entry and of its section.  GET replies are tagged with it so the REST
+ * cache and pollers can tell whether what they hold is still current.
+ * Removed entries keep theirs, a name that comes back gets a newer one.
+ * Watchers of GET /dem/watch are told about every one of them.
+ */
+static void touch_json_entry(const char *section, const char *key,
+			     bool deleted)
+{
+	json_t			*keys;
+	int			 i;
+
+	ctx->gen++;
+
+	json_object_set_new(ctx->section_gens, section,
+			    json_integer(ctx->gen));
+
+	keys = json_object_get(ctx->entry_gens, section);
+	if (!keys) {
+		keys = json_object();
+		json_object_set_new(ctx->entry_gens, section, keys);
+	}
+
+	json_object_set_new(keys, key, json_integer(ctx->gen));
+
+	for (i = 0; i < NUM_ENTRIES(journal_sections); i++)
+		if (!strcmp(section, journal_sections[i]))
+			watch_event(section_events[i], key, ctx->gen, deleted);
+}
+
+/* call with the json lock held, untouched since start up is 0 */
+u64 json_section_gen(const char *section)
+{
+	return json_integer_value(json_object_get(ctx->section_gens,
+						  section));
+}
+
+u64 json_entry_gen(const char *section, const char *key)
+{
+	json_t			*keys;
+
+	keys = json_object_get(ctx->entry_gens, section);
+
+	return json_integer_value(json_object_get(keys, key));
+}
+
+/* remember each entry as it stands so later stores only journal changes */
+static void init_shadow(void)
+{
+	json_t			*array;
+	json_t			*saved;
+	json_t			*iter;
+	json_t			*key;
+	int			 i, j, n;
+
+	ctx->shadow = json_object();
+
+	for (i = 0; i < NUM_ENTRIES(journal_sections); i++) {
+		saved = json_object();
+		json_object_set_new(ctx->shadow, journal_sections[i], saved);
+
+		array = json_object_get(ctx->root, journal_sections[i]);
+		n = json_array_size(array);
+		for (j = 0; j < n; j++) {
+			iter = json_array_get(array, j);
+			key = json_object_get(iter,
+					      entry_key(journal_sections[i]));
+			if (key && json_is_string(key))
+				json_object_set_new(saved,
+						    json_string_value(key),
+						    json_deep_copy(iter));
+		}
+	}
+}
+
 static void parse_config_file(void)
 {
 	json_t			*root;
@@ -305,8 +795,14 @@ static void parse_config_file(void)
 
 	ctx->root = root;
 
-	if (dirty)
-		store_json_config_file();
+	if (replay_journal(ctx->filename, root))
+		dirty = 1;
+
+	init_shadow();
+
+	/* a fresh or replayed config is written out as a new snapshot */
+	if (init_journal(dirty) && dirty)
+		store_json_snapshot(root);
 }
 
 static inline int invalid_json_syntax(char *resp)
@@ -315,182 +811,400 @@ static inline int invalid_json_syntax(char *resp)
 	return -EINVAL;
 }
 
-/* walk all subsystem allowed host list for host name changes */
-static void rename_in_allowed_hosts(char *old, char *new)
+/* walk the allowed host lists of the targets that may list a host */
+static void rename_in_allowed_hosts(char *old, char *new)
+{
+	json_t			*targets;
+	json_t			*refs;
+	json_t			*prev;
+	json_t			*array;
+	json_t			*tgt;
+	json_t			*list;
+	json_t			*obj;
+	const char		*alias;
+	int			 idx;
+	int			 j, m;
+
+	refs = get_host_refs(old);
+	if (!refs)
+		return;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+
+	json_object_foreach(refs, alias, obj) {
+		if (find_array(targets, TAG_ALIAS, (char *) alias, &tgt) < 0)
+			continue;
+
+		array = json_object_get(tgt, TAG_SUBSYSTEMS);
+		m = json_array_size(array);
+
+		for (j = 0; j < m; j++) {
+			list = json_object_get(json_array_get(array, j),
+					       TAG_HOSTS);
+			if (!list)
+				continue;
+
+			idx = find_array_string(list, old);
+			if (idx >= 0) {
+				obj = json_array_get(list, idx);
+				json_string_set(obj, new);
+			}
+		}
+	}
+
+	prev = json_object_get(host_refs, new);
+	if (prev)
+		json_object_update(prev, refs);
+	else
+		json_object_set(host_refs, new, refs);
+
+	json_object_del(host_refs, old);
+}
+
+/* walk the allowed host lists of the targets that may list a host */
+static void del_from_allowed_hosts(char *alias)
+{
+	json_t			*targets;
+	json_t			*refs;
+	json_t			*array;
+	json_t			*tgt;
+	json_t			*list;
+	json_t			*obj;
+	const char		*key;
+	int			 idx;
+	int			 j, m;
+
+	refs = get_host_refs(alias);
+	if (!refs)
+		return;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+
+	json_object_foreach(refs, key, obj) {
+		if (find_array(targets, TAG_ALIAS, (char *) key, &tgt) < 0)
+			continue;
+
+		array = json_object_get(tgt, TAG_SUBSYSTEMS);
+		m = json_array_size(array);
+
+		for (j = 0; j < m; j++) {
+			list = json_object_get(json_array_get(array, j),
+					       TAG_HOSTS);
+			if (!list)
+				continue;
+
+			idx = find_array_string(list, alias);
+			if (idx >= 0)
+				json_array_remove(list, idx);
+		}
+	}
+
+	json_object_del(host_refs, alias);
+}
+
+/* command functions */
+
+/* set while a bulk request holds the config file back for one write */
+static __thread bool store_held;
+static __thread bool store_pending;
+
+/* an entry that differs from what was last stored is given a new
+ * generation and journaled, one that is gone is journaled as null
+ */
+static void journal_key(const char *section, const char *key, bool journal)
+{
+	json_t			*array;
+	json_t			*saved;
+	json_t			*iter;
+	json_t			*old;
+
+	array = json_object_get(ctx->root, section);
+	saved = json_object_get(ctx->shadow, section);
+	old = json_object_get(saved, key);
+
+	find_array(array, entry_key(section), (char *) key, &iter);
+
+	if (!iter) {
+		if (!old)
+			return;
+
+		touch_json_entry(section, key, true);
+		if (journal)
+			journal_entry(section, key, NULL);
+		json_object_del(saved, key);
+		return;
+	}
+
+	if (old && json_equal(old, iter))
+		return;
+
+	touch_json_entry(section, key, false);
+	if (journal)
+		journal_entry(section, key, iter);
+	json_object_set_new(saved, key, json_deep_copy(iter));
+}
+
+/* compares only the entries noted since the last store */
+static void journal_dirty(const char *section, bool journal)
+{
+	json_t			*keys;
+	json_t			*obj;
+	const char		*key;
+
+	keys = json_object_get(ctx->dirty, section);
+
+	json_object_foreach(keys, key, obj)
+		journal_key(section, key, journal);
+}
+
+/*
+ * Find every entry of a section that differs from what was last stored,
+ * give it a new generation and journal it.
+ */
+static void journal_section(const char *section, bool journal)
 {
-	json_t			*targets;
 	json_t			*array;
-	json_t			*tgt;
-	json_t			*subsys;
-	json_t			*list;
+	json_t			*saved;
+	json_t			*seen;
+	json_t			*gone;
+	json_t			*iter;
+	json_t			*old;
 	json_t			*obj;
-	int			 idx;
-	int			 i, j;
-	int			 n, m;
-
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	if (!targets)
-		return;
+	const char		*key;
+	int			 i, n;
 
-	n = json_array_size(targets);
+	array = json_object_get(ctx->root, section);
+	saved = json_object_get(ctx->shadow, section);
+	seen = json_object();
+	gone = json_array();
 
+	n = json_array_size(array);
 	for (i = 0; i < n; i++) {
-		tgt = json_array_get(targets, i);
-
-		array = json_object_get(tgt, TAG_SUBSYSTEMS);
-		if (!array)
+		iter = json_array_get(array, i);
+		obj = json_object_get(iter, entry_key(section));
+		if (!obj || !json_is_string(obj))
 			continue;
 
-		m = json_array_size(array);
+		key = json_string_value(obj);
+		json_object_set_new(seen, key, json_null());
 
-		for (j = 0; j < m; j++) {
-			subsys = json_array_get(array, j);
+		old = json_object_get(saved, key);
+		if (old && json_equal(old, iter))
+			continue;
 
-			list = json_object_get(subsys, TAG_HOSTS);
-			if (!list)
-				continue;
+		touch_json_entry(section, key, false);
+		if (journal)
+			journal_entry(section, key, iter);
+		json_object_set_new(saved, key, json_deep_copy(iter));
+	}
 
-			idx = find_array_string(list, old);
-			if (idx >= 0) {
-				obj = json_array_get(list, idx);
-				json_string_set(obj, new);
-			}
-		}
+	json_object_foreach(saved, key, old)
+		if (!json_object_get(seen, key))
+			json_array_append_new(gone, json_string(key));
+
+	n = json_array_size(gone);
+	for (i = 0; i < n; i++) {
+		key = json_string_value(json_array_get(gone, i));
+		touch_json_entry(section, key, true);
+		if (journal)
+			journal_entry(section, key, NULL);
+		json_object_del(saved, key);
 	}
+
+	json_decref(gone);
+	json_decref(seen);
 }
 
-/* walk all subsystem allowed host list for host deletions */
-static void del_from_allowed_hosts(char *alias)
+void store_json_config_file(void)
 {
-	json_t			*targets;
-	json_t			*array;
-	json_t			*tgt;
-	json_t			*subsys;
-	json_t			*list;
-	int			 idx;
-	int			 i, j;
-	int			 n, m;
+	json_t			*root = ctx->root;
+	bool			 journal = journal_active();
+	int			 ret;
+	int			 i;
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
-	if (!targets)
+	if (store_held) {
+		store_pending = true;
 		return;
+	}
 
-	n = json_array_size(targets);
+	/* looking an entry up again while journaling only marks it again */
+	for (i = 0; i < NUM_ENTRIES(journal_sections); i++)
+		if (ctx->all_dirty)
+			journal_section(journal_sections[i], journal);
+		else
+			journal_dirty(journal_sections[i], journal);
 
-	for (i = 0; i < n; i++) {
-		tgt = json_array_get(targets, i);
+	json_object_clear(ctx->dirty);
+	ctx->all_dirty = false;
 
-		array = json_object_get(tgt, TAG_SUBSYSTEMS);
-		if (!array)
-			continue;
+	if (journal)
+		return;
 
-		m = json_array_size(array);
+	ret = store_json_snapshot(root);
+	if (ret)
+		print_errno("unable to store config", ret);
+}
 
-		for (j = 0; j < m; j++) {
-			subsys = json_array_get(array, i);
+void hold_json_store(void)
+{
+	store_held = true;
+	store_pending = false;
+}
 
-			list = json_object_get(subsys, TAG_HOSTS);
-			if (!list)
-				continue;
+void release_json_store(void)
+{
+	store_held = false;
 
-			idx = find_array_string(list, alias);
-			if (idx >= 0)
-				json_array_remove(array, idx);
-		}
+	if (store_pending) {
+		store_pending = false;
+		store_json_config_file();
 	}
 }
 
-/* command functions */
+struct json_context *get_json_context(void)
+{
+	return ctx;
+}
 
-void store_json_config_file(void)
+/*
+ * Readers share the tree, writers hold it only to change it in memory.
+ * Going on without the lock would corrupt the tree, so a failure here is
+ * fatal.
+ */
+static void check_json_lock(const char *op, int ret)
 {
-	json_t			*root = ctx->root;
-	char			*filename = ctx->filename;
-	int			 ret;
+	if (!ret)
+		return;
 
-	ret = json_dump_file(root, filename, 2);
-	if (ret)
-		print_errno("json_dump_file failed", ret);
+	print_errno(op, ret);
+	abort();
 }
 
-struct json_context *get_json_context(void)
+void json_rdlock(void)
 {
-	return ctx;
+	check_json_lock("json read lock failed",
+			pthread_rwlock_rdlock(&ctx->lock));
 }
 
-void json_spinlock(void)
+void json_wrlock(void)
 {
-	pthread_spin_lock(&ctx->lock);
+	check_json_lock("json write lock failed",
+			pthread_rwlock_wrlock(&ctx->lock));
+	json_writer = true;
 }
 
-void json_spinunlock(void)
+void json_unlock(void)
 {
-	pthread_spin_unlock(&ctx->lock);
+	json_writer = false;
+	check_json_lock("json unlock failed",
+			pthread_rwlock_unlock(&ctx->lock));
 }
 
-int init_json(char *filename)
+bool json_write_held(void)
 {
-	ctx = malloc(sizeof(*ctx));
-	if (!ctx)
+	return json_writer;
+}
+
+/*
+ * A dry run lets a writer try changes on a copy of the tree: the config,
+ * its dirty set and pending store are put back as they were when it ends,
+ * and the mutators in config.c leave the targets alone while it lasts.
+ * Call with the json lock held for writing.
+ */
+static json_t *dry_run_root;
+static json_t *dry_run_dirty;
+static bool dry_run_all_dirty;
+static __thread bool dry_run;
+
+int begin_json_dry_run(void)
+{
+	json_t			*root;
+	json_t			*dirty;
+
+	root = json_deep_copy(ctx->root);
+	dirty = json_object();
+	if (!root || !dirty) {
+		json_decref(root);
+		json_decref(dirty);
 		return -ENOMEM;
+	}
 
-	strncpy(ctx->filename, filename, sizeof(ctx->filename));
+	dry_run_root = ctx->root;
+	dry_run_dirty = ctx->dirty;
+	dry_run_all_dirty = ctx->all_dirty;
 
-	pthread_spin_init(&ctx->lock, PTHREAD_PROCESS_SHARED);
+	ctx->root = root;
+	ctx->dirty = dirty;
 
-	parse_config_file();
+	/* the indexes point into the arrays of the tree they were built on */
+	cleanup_indexes();
+
+	dry_run = true;
 
 	return 0;
 }
 
-void cleanup_json(void)
+void end_json_dry_run(void)
 {
+	if (!dry_run)
+		return;
+
 	json_decref(ctx->root);
+	json_decref(ctx->dirty);
 
-	pthread_spin_destroy(&ctx->lock);
+	ctx->root = dry_run_root;
+	ctx->dirty = dry_run_dirty;
+	ctx->all_dirty = dry_run_all_dirty;
 
-	free(ctx);
+	dry_run_root = NULL;
+	dry_run_dirty = NULL;
+
+	cleanup_indexes();
+
+	store_pending = false;
+	dry_run = false;
 }
 
-static int _list_target(char *query, char **resp, int offset)
+bool json_dry_run(void)
 {
-	json_t			*targets;
-	char			*p = *resp + offset;
-	char			*new;
-	int			 n;
-	int			 cnt;
-	int			 max = BODY_SIZE - 32;
+	return dry_run;
+}
 
-	targets = json_object_get(ctx->root, TAG_TARGETS);
+int init_json(char *filename)
+{
+	ctx = malloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
 
-	start_json_array(TAG_TARGETS, p, n);
+	strncpy(ctx->filename, filename, sizeof(ctx->filename));
 
-	cnt = n;
+	pthread_rwlock_init(&ctx->lock, NULL);
 
-	if (targets) {
-		n = strlen_array(targets, TAG_ALIAS);
-		if (n > max) {
-			max += n - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + cnt + offset;
-		}
+	ctx->entry_gens = json_object();
+	ctx->section_gens = json_object();
+	ctx->dirty = json_object();
+	ctx->all_dirty = false;
+	ctx->gen = 0;
 
-		if (query == NULL)
-			n = list_array(targets, TAG_ALIAS, p);
-		else if (strncmp(query, URI_PARM_MODE, PARM_MODE_LEN) == 0)
-			n = filter_mode(targets, query, p);
-		else if (strncmp(query, URI_PARM_FABRIC, PARM_FABRIC_LEN) == 0)
-			n = filter_fabric(targets, query, p);
+	parse_config_file();
 
-		p += n;
-	}
-out:
-	end_json_array(p, n);
+	return 0;
+}
+
+void cleanup_json(void)
+{
+	cleanup_journal();
+	cleanup_indexes();
+
+	json_decref(ctx->section_gens);
+	json_decref(ctx->entry_gens);
+	json_decref(ctx->shadow);
+	json_decref(ctx->dirty);
+	json_decref(ctx->root);
+
+	pthread_rwlock_destroy(&ctx->lock);
 
-	return p - *resp;
+	free(ctx);
 }
 
 /* GROUPS */
@@ -517,6 +1231,7 @@ int add_json_group(char *group, char *resp)
 	iter = json_object();
 	json_set_string(iter, TAG_NAME, group);
 	json_array_append_new(groups, iter);
+	index_append(groups, TAG_NAME);
 
 	tmp = json_array();
 	json_object_set_new(iter, TAG_TARGETS, tmp);
@@ -578,12 +1293,14 @@ int update_json_group(char *group, char *data, char *resp, char *_name)
 			goto out;
 		}
 	}
-	if (group)
+	if (group) {
 		json_update_string(iter, new, TAG_NAME, value);
-	else {
+		index_rename(groups, TAG_NAME, group, newname);
+	} else {
 		iter = json_object();
 		json_set_string(iter, TAG_NAME, newname);
 		json_array_append_new(groups, iter);
+		index_append(groups, TAG_NAME);
 
 		tmp = json_array();
 		json_object_set_new(iter, TAG_HOSTS, tmp);
@@ -722,6 +1439,16 @@ int del_json_group_member(char *group, char *member, char *tag,
 	return ret;
 }
 
+/* the group walks below change groups they did not look up by name */
+static void mark_group_dirty(json_t *group)
+{
+	json_t			*name;
+
+	name = json_object_get(group, TAG_NAME);
+	if (name && json_is_string(name))
+		mark_dirty(TAG_GROUPS, json_string_value(name));
+}
+
 static void rename_in_groups(char *tag, char *member, char *alias)
 {
 	json_t			*groups;
@@ -748,6 +1475,7 @@ static void rename_in_groups(char *tag, char *member, char *alias)
 			if (json_is_string(item) &&
 			    !strcmp(member, json_string_value(item))) {
 				json_string_set(item, alias);
+				mark_group_dirty(group);
 				break;
 			}
 		}
@@ -779,6 +1507,7 @@ static void del_from_groups(char *tag, char *member)
 			if (json_is_string(item) &&
 			    !strcmp(member, json_string_value(item))) {
 				json_array_remove(array, j);
+				mark_group_dirty(group);
 				break;
 			}
 		}
@@ -803,47 +1532,16 @@ int del_json_group(char *group, char *resp)
 	}
 
 	json_array_remove(groups, i);
+	index_remove(groups, TAG_NAME, group, i);
 
 	sprintf(resp, "%s '%s' deleted", TAG_GROUP, group);
 
 	return 0;
 }
 
-int list_json_group(char **resp)
+int list_json_group(struct list_query *q, char **resp)
 {
-	json_t			*groups;
-	char			*p = *resp;
-	char			*new;
-	int			 n, m;
-	int			 max = BODY_SIZE - 32;
-	int			 len;
-
-	n = sprintf(p, "{");
-	p += n;
-
-	start_json_array(TAG_GROUPS, p, m);
-
-	groups = json_object_get(ctx->root, TAG_GROUPS);
-	if (groups) {
-		len = strlen_array(groups, TAG_NAME);
-		if (len > max) {
-			max += len - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + n + m;
-		}
-
-		n = list_array(groups, TAG_NAME, p);
-		p += n;
-	}
-out:
-	end_json_array(p, n);
-
-	sprintf(p, "}");
-
-	return 0;
+	return list_section(TAG_GROUPS, TAG_NAME, q, resp);
 }
 
 int show_json_group(char *group, char **resp)
@@ -896,6 +1594,7 @@ int add_json_host(char *host, char *resp)
 	json_set_string(iter, TAG_ALIAS, host);
 
 	json_array_append_new(hosts, iter);
+	index_append(hosts, TAG_ALIAS);
 
 	sprintf(resp, "%s '%s' added", TAG_HOST, host);
 
@@ -972,12 +1671,14 @@ int update_json_host(char *host, char *data, char *resp, char *alias, char *nqn)
 			}
 			if (host) {
 				json_update_string(iter, new, TAG_ALIAS, value);
+				index_rename(hosts, TAG_ALIAS, host, alias);
 				rename_in_allowed_hosts(host, alias);
 				rename_in_groups(TAG_HOSTS, host, alias);
 			} else {
 				iter = json_object();
 				json_set_string(iter, TAG_ALIAS, alias);
 				json_array_append_new(hosts, iter);
+				index_append(hosts, TAG_ALIAS);
 			}
 		}
 	} else if (!host) {
@@ -1028,6 +1729,7 @@ int del_json_host(char *alias, char *resp, char *nqn)
 	}
 
 	json_array_remove(hosts, i);
+	index_remove(hosts, TAG_ALIAS, alias, i);
 
 	del_from_allowed_hosts(alias);
 
@@ -1038,41 +1740,9 @@ int del_json_host(char *alias, char *resp, char *nqn)
 	return 0;
 }
 
-int list_json_host(char **resp)
+int list_json_host(struct list_query *q, char **resp)
 {
-	json_t			*hosts;
-	char			*p = *resp;
-	char			*new;
-	int			 m, n;
-	int			 max = BODY_SIZE - 32;
-	int			 len;
-
-	n = sprintf(p, "{");
-	p += n;
-
-	start_json_array(TAG_HOSTS, p, m);
-
-	hosts = json_object_get(ctx->root, TAG_HOSTS);
-	if (hosts) {
-		len = strlen_array(hosts, TAG_ALIAS);
-		if (len > max) {
-			max += len - BODY_SIZE;
-			new = realloc(*resp, max);
-			if (!new)
-				goto out;
-			*resp = new;
-			p = new + n + m;
-		}
-
-		n = list_array(hosts, TAG_ALIAS, p);
-		p += n;
-	}
-out:
-	end_json_array(p, n);
-
-	sprintf(p, "}");
-
-	return 0;
+	return list_section(TAG_HOSTS, TAG_ALIAS, q, resp);
 }
 
 static inline int match_string(json_t *item, char *str)
@@ -1126,8 +1796,9 @@ static void get_host_subsystems(char *host, json_t *parent)
 		if (!alias)
 			continue;
 
-		json_get_array(iter, TAG_SUBSYSTEMS, array);
-		if (!array)
+		/* only the json read lock is held here, do not add arrays */
+		array = json_object_get(iter, TAG_SUBSYSTEMS);
+		if (!json_is_array(array))
 			continue;
 
 		target = find_target((char *) json_string_value(alias));
@@ -1319,7 +1990,7 @@ int del_json_subsys(char *alias, char *subnqn, char *resp)
 
 /* set target lists */
 
-int set_json_oob_nsdevs(struct target *target, char *data)
+static int _set_json_oob_nsdevs(struct target *target, char *data)
 {
 	struct nsdev		*nsdev, *next;
 	json_t			*array;
@@ -1435,7 +2106,74 @@ out:
 	return ret;
 }
 
-int set_json_oob_interfaces(struct target *target, char *data)
+static json_t *copy_json_target(struct target *target)
+{
+	json_t			*targets;
+	json_t			*obj;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+	if (find_array(targets, TAG_ALIAS, target->alias, &obj) < 0)
+		return NULL;
+
+	return json_deep_copy(obj);
+}
+
+/* refreshes mostly read back what is already there, which is no change */
+static void touch_changed_target(struct target *target, json_t *old)
+{
+	json_t			*targets;
+	json_t			*obj;
+
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+	find_array(targets, TAG_ALIAS, target->alias, &obj);
+
+	if ((old || obj) && !(old && obj && json_equal(old, obj)))
+		touch_json_entry(TAG_TARGETS, target->alias, false);
+
+	json_decref(old);
+}
+
+/*
+ * Target config is read back by the worker threads outside of any REST
+ * request, so the helpers used by get_config() take the json lock and
+ * give the target a new generation themselves when they change it.  A
+ * REST request already holds the lock, they then run under that.
+ */
+static bool hold_json_target(struct target *target, json_t **old)
+{
+	bool			 locked = !json_writer;
+
+	if (locked)
+		json_wrlock();
+
+	*old = copy_json_target(target);
+
+	return locked;
+}
+
+static void release_json_target(struct target *target, json_t *old,
+				bool locked)
+{
+	touch_changed_target(target, old);
+
+	if (locked)
+		json_unlock();
+}
+
+int set_json_oob_nsdevs(struct target *target, char *data)
+{
+	json_t			*old;
+	bool			 locked;
+	int			 ret;
+
+	locked = hold_json_target(target, &old);
+	ret = _set_json_oob_nsdevs(target, data);
+	release_json_target(target, old, locked);
+
+	return ret;
+}
+
+static int _set_json_oob_interfaces(struct target *target, char *data)
 {
 	json_t			*new;
 	json_t			*trtype, *tradr, *trfam;
@@ -1549,7 +2287,20 @@ out:
 	return ret;
 }
 
-int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
+int set_json_oob_interfaces(struct target *target, char *data)
+{
+	json_t			*old;
+	bool			 locked;
+	int			 ret;
+
+	locked = hold_json_target(target, &old);
+	ret = _set_json_oob_interfaces(target, data);
+	release_json_target(target, old, locked);
+
+	return ret;
+}
+
+static int _set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
 {
 	json_t			*iter;
 	json_t			*targets;
@@ -1581,7 +2332,20 @@ int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
 	return 0;
 }
 
-int init_json_inb_fabric_iface(struct target *target)
+int set_json_inb_nsdev(struct target *target, struct nsdev *nsdev)
+{
+	json_t			*old;
+	bool			 locked;
+	int			 ret;
+
+	locked = hold_json_target(target, &old);
+	ret = _set_json_inb_nsdev(target, nsdev);
+	release_json_target(target, old, locked);
+
+	return ret;
+}
+
+static int _init_json_inb_fabric_iface(struct target *target)
 {
 	json_t			*targets;
 	json_t			*ifaces;
@@ -1602,7 +2366,21 @@ int init_json_inb_fabric_iface(struct target *target)
 	return 0;
 }
 
-int set_json_inb_fabric_iface(struct target *target, struct fabric_iface *iface)
+int init_json_inb_fabric_iface(struct target *target)
+{
+	json_t			*old;
+	bool			 locked;
+	int			 ret;
+
+	locked = hold_json_target(target, &old);
+	ret = _init_json_inb_fabric_iface(target);
+	release_json_target(target, old, locked);
+
+	return ret;
+}
+
+static int _set_json_inb_fabric_iface(struct target *target,
+				      struct fabric_iface *iface)
 {
 	json_t			*iter;
 	json_t			*targets;
@@ -1631,6 +2409,19 @@ int set_json_inb_fabric_iface(struct target *target, struct fabric_iface *iface)
 	return 0;
 }
 
+int set_json_inb_fabric_iface(struct target *target, struct fabric_iface *iface)
+{
+	json_t			*old;
+	bool			 locked;
+	int			 ret;
+
+	locked = hold_json_target(target, &old);
+	ret = _set_json_inb_fabric_iface(target, iface);
+	release_json_target(target, old, locked);
+
+	return ret;
+}
+
 /* PORTID */
 
 int set_json_portid(char *target, int id, char *data, char *resp,
@@ -1894,6 +2685,7 @@ int del_json_target(char *alias, char *resp)
 	}
 
 	json_array_remove(targets, idx);
+	index_remove(targets, TAG_ALIAS, alias, idx);
 
 	del_from_groups(TAG_TARGETS, alias);
 
@@ -1902,20 +2694,25 @@ int del_json_target(char *alias, char *resp)
 	return 0;
 }
 
-int list_json_target(char *query, char **resp)
+/* the management mode as configured, -ENOENT for an unknown target */
+int get_json_mgmt_mode(char *alias)
 {
-	char			*p = *resp;
-	int			 n, m;
+	json_t			*targets;
+	json_t			*iter;
+	const char		*mode;
 
-	n = sprintf(p, "{");
-	p += n;
+	targets = json_object_get(ctx->root, TAG_TARGETS);
+	if (find_array(targets, TAG_ALIAS, alias, &iter) < 0)
+		return -ENOENT;
 
-	m = _list_target(query, resp, n);
-	p = *resp + n + m - 1;
+	mode = json_string_value(json_object_get(iter, TAG_MGMT_MODE));
 
-	sprintf(p, "}");
+	return get_mgmt_mode(mode ? (char *) mode : "");
+}
 
-	return 0;
+int list_json_target(struct list_query *q, char **resp)
+{
+	return list_section(TAG_TARGETS, TAG_ALIAS, q, resp);
 }
 
 int set_json_inb_interface(char *alias, char *data, char *resp,
@@ -2151,6 +2948,7 @@ int add_json_target(char *alias, char *resp)
 	json_object_set_new(iter, TAG_SUBSYSTEMS, tmp);
 
 	json_array_append_new(targets, iter);
+	index_append(targets, TAG_ALIAS);
 
 	sprintf(resp, "%s '%s' added", TAG_TARGET, alias);
 
@@ -2212,6 +3010,8 @@ int update_json_target(char *alias, char *data, char *resp,
 				json_update_string(iter, new, TAG_ALIAS, value);
 
 				newalias = (char *) json_string_value(value);
+				index_rename(targets, TAG_ALIAS, alias, buf);
+				ref_target_hosts(iter);
 				rename_in_groups(TAG_TARGETS, alias, newalias);
 			} else {
 				iter = json_object();
@@ -2224,6 +3024,7 @@ int update_json_target(char *alias, char *data, char *resp,
 				json_object_set_new(iter, TAG_SUBSYSTEMS, tmp);
 
 				json_array_append_new(targets, iter);
+				index_append(targets, TAG_ALIAS);
 			}
 		}
 	} else if (alias)
@@ -2415,6 +3216,8 @@ int set_json_acl(char *tgt, char *subnqn, char *alias, char *data,
 	strcpy(hostnqn, json_string_value(value));
 
 	json_array_append_new(array, json_string(newalias));
+	if (host_refs)
+		add_host_ref(newalias, tgt);
 
 	sprintf(resp, "%s '%s' added for %s '%s' in %s '%s'",
 		TAG_HOST, newalias, TAG_SUBSYSTEM, subnqn, TAG_TARGET, tgt);
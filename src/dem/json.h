@@ -45,8 +45,40 @@ struct fabric_iface;
 
 struct json_context *get_json_context(void);
 void store_json_config_file(void);
+void hold_json_store(void);
+void release_json_store(void);
+int begin_json_dry_run(void);
+void end_json_dry_run(void);
 
-int list_json_group(char **resp);
+int replay_journal(const char *config, json_t *root);
+int init_journal(bool compact);
+void cleanup_journal(void);
+bool journal_active(void);
+void journal_entry(const char *section, const char *key, json_t *value);
+void journal_sync(void);
+void sync_dir(const char *path);
+int store_json_snapshot(json_t *root);
+
+u64 json_section_gen(const char *section);
+u64 json_entry_gen(const char *section, const char *key);
+
+/*
+ * A page of a target, host or group listing.  Paged entries come in name
+ * order, starting after the name of the cursor, and a reply that stops
+ * short of the end names its last entry as the next cursor.  Without a
+ * cursor or limit they come in config order.
+ */
+struct list_query {
+	char			*after;		/* cursor, NULL from the start */
+	char			*fields;	/* comma separated tags to show */
+	char			*mode;		/* targets by management mode */
+	char			*fabric;	/* targets with a port of type */
+	char			*group;		/* members of a group */
+	char			*nqn;		/* hosts by host NQN */
+	int			 limit;		/* entries per page, 0 for all */
+};
+
+int list_json_group(struct list_query *q, char **resp);
 int show_json_group(char *grp, char **resp);
 int add_json_group(char *grp, char *resp);
 int update_json_group(char *grp, char *data, char *resp, char *new_name);
@@ -61,14 +93,15 @@ int del_json_group_member(char *group, char *member, char *tag,
 int add_json_target(char *alias, char *resp);
 int update_json_target(char *alias, char *data, char *resp,
 		       struct target *target);
-int list_json_target(char *query, char **resp);
+int list_json_target(struct list_query *q, char **resp);
 int show_json_target(char *alias, char **resp);
 int del_json_target(char *alias, char *resp);
+int get_json_mgmt_mode(char *alias);
 
 int add_json_host(char *alias, char *resp);
 int update_json_host(char *alias, char *data, char *resp,
 		     char *newalias, char *nqn);
-int list_json_host(char **resp);
+int list_json_host(struct list_query *q, char **resp);
 int show_json_host(char *alias, char **resp);
 int del_json_host(char *alias, char *resp, char *nqn);
 int get_json_host_nqn(char *host, char *nqn);
@@ -143,11 +176,21 @@ int update_signature(char *data, char *resp);
 #define MAX_STRING		128
 
 struct json_context {
-	pthread_spinlock_t	 lock;
+	pthread_rwlock_t	 lock;
 	json_t			*root;
+	json_t			*shadow;	/* entries as last journaled */
+	json_t			*dirty;		/* section -> name to compare */
+	bool			 all_dirty;	/* compare every entry */
+	json_t			*entry_gens;	/* section -> name -> gen */
+	json_t			*section_gens;	/* section -> gen */
+	u64			 gen;		/* last generation handed out */
 	char			 filename[128];
 };
 
+/* journal records name top level entries by the tag that keys them */
+#define entry_key(section) \
+	(strcmp(section, TAG_GROUPS) ? TAG_ALIAS : TAG_NAME)
+
 /* json parsing helpers */
 
 #define json_set_string(x, y, z) \
@@ -253,20 +296,3 @@ struct json_context {
 #define JSEMPTYARRAY	"\"%s\":[]"
 #define JSSTR		"\"%s\":\"%s\""
 #define JSINT		"\"%s\":%lld"
-
-#define array_json_string(obj, p, i, n)				\
-	do {							\
-		n = sprintf(p, "%s\"%s\"", i ? "," : "",	\
-			    json_string_value(obj));		\
-		p += n;						\
-	} while (0)
-#define start_json_array(tag, p, n)				\
-	do {							\
-		n = sprintf(p, JSARRAY, tag);			\
-		p += n;						\
-	} while (0)
-#define end_json_array(p, n)					\
-	do {							\
-		n = sprintf(p, "]");				\
-		p += n;						\
-	} while (0)
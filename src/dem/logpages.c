@@ -37,32 +37,67 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 
 #include "common.h"
 
-void del_unattached_logpage_list(struct target *target)
+/*
+ * Log pages are rebuilt off to the side on every refresh and only swapped
+ * into the subsystem / unattached lists once all discovery queues have been
+ * read.  Readers in the discovery controller take the read lock, so they
+ * always see either the complete old set or the complete new set.
+ */
+static pthread_rwlock_t	 logpage_lock = PTHREAD_RWLOCK_INITIALIZER;
+static u64		 logpage_genctr = 1;
+
+void logpage_rdlock(void)
+{
+	pthread_rwlock_rdlock(&logpage_lock);
+}
+
+void logpage_wrlock(void)
+{
+	pthread_rwlock_wrlock(&logpage_lock);
+}
+
+void logpage_unlock(void)
+{
+	pthread_rwlock_unlock(&logpage_lock);
+}
+
+/* caller must hold the logpage lock */
+u64 get_logpage_genctr(void)
+{
+	return logpage_genctr;
+}
+
+static void free_logpage_list(struct linked_list *list)
 {
 	struct logpage		*lp, *n;
 
-	list_for_each_entry_safe(lp, n, &target->unattached_logpage_list,
-				 node) {
+	list_for_each_entry_safe(lp, n, list, node) {
 		list_del(&lp->node);
 		free(lp);
 	}
 }
 
-static inline void invalidate_log_pages(struct target *target)
+void del_unattached_logpage_list(struct target *target)
 {
-	struct subsystem		*subsys;
-	struct logpage			*logpage;
+	logpage_wrlock();
 
-	list_for_each_entry(subsys, &target->subsys_list, node)
-		list_for_each_entry(logpage, &subsys->logpage_list, node)
-			logpage->valid = 0;
+	free_logpage_list(&target->unattached_logpage_list);
+
+	logpage_genctr++;
+
+	logpage_unlock();
 
-	del_unattached_logpage_list(target);
+	save_logpage_snapshot(target);
 }
 
 static inline int match_logpage(struct logpage *logpage,
@@ -76,90 +111,443 @@ static inline int match_logpage(struct logpage *logpage,
 	return 1;
 }
 
-static inline void store_logpage(struct logpage *logpage,
-				 struct nvmf_disc_rsp_page_entry *e,
-				 struct ctrl_queue *dq)
+static inline int same_logpage(struct logpage *logpage,
+			       struct logpage *lp)
 {
+	return logpage->portid == lp->portid &&
+		!memcmp(&logpage->e, &lp->e, sizeof(lp->e));
+}
+
+static struct logpage *find_logpage(struct linked_list *list,
+				    struct nvmf_disc_rsp_page_entry *e)
+{
+	struct logpage		*logpage;
+
+	list_for_each_entry(logpage, list, node)
+		if (!strcmp(logpage->e.subnqn, e->subnqn) &&
+		    match_logpage(logpage, e))
+			return logpage;
+
+	return NULL;
+}
+
+static int stage_logpage(struct linked_list *staged,
+			 struct nvmf_disc_rsp_page_entry *e,
+			 struct portid *portid)
+{
+	struct logpage		*logpage;
+
+	if (find_logpage(staged, e))
+		return 0;
+
+	logpage = malloc(sizeof(*logpage));
+	if (!logpage) {
+		print_err("alloc new logpage failed");
+		return -ENOMEM;
+	}
+
 	logpage->e = *e;
 	logpage->valid = 1;
-	logpage->portid = dq->portid;
+	logpage->portid = portid;
+
+	list_add_tail(&logpage->node, staged);
+
+	return 0;
 }
 
-static void save_log_pages(struct nvmf_disc_rsp_page_hdr *log, int numrec,
-			   struct target *target, struct ctrl_queue *dq)
+/* carry entries of the current set over into the staged set */
+static void stage_current_log_pages(struct target *target,
+				    struct linked_list *staged,
+				    struct portid *portid)
 {
-	int				 i;
-	int				 found;
-	int				 create;
-	struct subsystem		*subsys;
-	struct logpage			*logpage, *lp;
-	struct nvmf_disc_rsp_page_entry *e;
-
-	for (i = 0; i < numrec; i++) {
-		e = &log->entries[i];
-		found = 0;
-		create = 1;
-		list_for_each_entry(subsys, &target->subsys_list, node)
-			if ((strcmp(subsys->nqn, e->subnqn) == 0)) {
-				found = 1;
-				list_for_each_entry(logpage,
-						    &subsys->logpage_list,
-						    node)
-					if (match_logpage(logpage, e)) {
-						store_logpage(logpage, e, dq);
-						create = 0;
-						goto next;
-					}
-next:
-				break;
-			}
+	struct subsystem	*subsys;
+	struct logpage		*logpage;
 
-		if (!create)
-			continue;
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			if (!portid || logpage->portid == portid)
+				stage_logpage(staged, &logpage->e,
+					      logpage->portid);
 
-		logpage = malloc(sizeof(*logpage));
-		if (!logpage) {
-			print_err("alloc new logpage failed");
-			return;
-		}
+	list_for_each_entry(logpage, &target->unattached_logpage_list, node)
+		if (!portid || logpage->portid == portid)
+			stage_logpage(staged, &logpage->e, logpage->portid);
+}
 
-		store_logpage(logpage, e, dq);
+/*
+ * What a queue reports: the entries of its port for its own subsystem and
+ * for any that lets any host in.  A subsystem queue connects as one of the
+ * subsystem's hosts, so other restricted subsystems are not its to drop.
+ */
+static inline bool dq_reports(struct ctrl_queue *dq, struct subsystem *subsys,
+			      struct logpage *logpage)
+{
+	if (logpage->portid != dq->portid)
+		return false;
 
-		if (found) {
-			list_add_tail(&logpage->node, &subsys->logpage_list);
-			continue;
-		}
+	return !subsys || subsys == dq->subsys || !is_restricted(subsys);
+}
 
-		list_for_each_entry(lp, &target->unattached_logpage_list, node)
-			if (!strcmp(lp->e.subnqn, e->subnqn) &&
-			    match_logpage(lp, e)) {
-				found = 1;
-				free(logpage);
-				break;
-			}
+/* keep what a refresh of dq alone cannot tell anything about */
+static void stage_other_log_pages(struct ctrl_queue *dq,
+				  struct linked_list *staged)
+{
+	struct target		*target = dq->target;
+	struct subsystem	*subsys;
+	struct logpage		*logpage;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			if (!dq_reports(dq, subsys, logpage))
+				stage_logpage(staged, &logpage->e,
+					      logpage->portid);
+
+	list_for_each_entry(logpage, &target->unattached_logpage_list, node)
+		if (!dq_reports(dq, NULL, logpage))
+			stage_logpage(staged, &logpage->e, logpage->portid);
+}
+
+static struct linked_list *logpage_home(struct target *target,
+					struct logpage *logpage)
+{
+	struct subsystem	*subsys;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		if (!strcmp(subsys->nqn, logpage->e.subnqn))
+			return &subsys->logpage_list;
+
+	return &target->unattached_logpage_list;
+}
 
-		if (!found)
-			list_add_tail(&logpage->node,
-				      &target->unattached_logpage_list);
+static int log_pages_changed(struct target *target,
+			     struct linked_list *staged)
+{
+	struct subsystem	*subsys;
+	struct logpage		*logpage, *lp;
+	int			 count = 0;
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			count--;
+
+	list_for_each_entry(logpage, &target->unattached_logpage_list, node)
+		count--;
+
+	list_for_each_entry(logpage, staged, node) {
+		lp = find_logpage(logpage_home(target, logpage), &logpage->e);
+		if (!lp || !same_logpage(lp, logpage))
+			return 1;
+		count++;
 	}
+
+	return count != 0;
 }
 
-void fetch_log_pages(struct ctrl_queue *dq)
+/*
+ * Swap the staged set in as the current set of log pages for the target.
+ * Returns 1 if the content changed, in which case the generation counter
+ * has been bumped, the hosts with access to the target are notified and
+ * a change event is sent to watchers.
+ */
+static int commit_log_pages(struct target *target,
+			    struct linked_list *staged)
+{
+	struct subsystem	*subsys;
+	struct logpage		*logpage, *next;
+	u64			 gen;
+
+	if (!log_pages_changed(target, staged)) {
+		free_logpage_list(staged);
+		return 0;
+	}
+
+	logpage_wrlock();
+
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		free_logpage_list(&subsys->logpage_list);
+
+	free_logpage_list(&target->unattached_logpage_list);
+
+	list_for_each_entry_safe(logpage, next, staged, node) {
+		list_del(&logpage->node);
+		list_add_tail(&logpage->node, logpage_home(target, logpage));
+	}
+
+	gen = ++logpage_genctr;
+
+	logpage_unlock();
+
+	print_info("log pages for target %s changed", target->alias);
+
+	notify_target_hosts(target);
+
+	watch_event(URI_LOG_PAGE, target->alias, gen, false);
+
+	return 1;
+}
+
+/*
+ * The last known log pages of each target are kept on disk so discovery
+ * can answer right after a restart, before the targets are reached again.
+ * A snapshot is a header followed by fixed size records and is replaced
+ * atomically (write to a temp file, fsync, rename) whenever the set changes.
+ */
+#define SNAPSHOT_MAGIC		0x504e5344 /* "DSNP" */
+#define SNAPSHOT_VERSION	1
+
+struct snapshot_hdr {
+	u32			 magic;
+	u16			 version;
+	u16			 entry_size;
+	u32			 numrec;
+	u32			 rsvd;
+};
+
+struct snapshot_entry {
+	u32			 portid;
+	u32			 rsvd;
+	struct nvmf_disc_rsp_page_entry e;
+};
+
+static void snapshot_path(struct target *target, char *path, int len)
+{
+	char			 name[MAX_ALIAS_SIZE + 1];
+	char			*p;
+
+	strncpy(name, target->alias, MAX_ALIAS_SIZE);
+	name[MAX_ALIAS_SIZE] = 0;
+
+	for (p = name; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	snprintf(path, len, "%s%s", SNAPSHOT_DIR, name);
+}
+
+static int write_snapshot_entries(int fd, struct linked_list *list)
+{
+	struct snapshot_entry	 entry;
+	struct logpage		*logpage;
+	int			 numrec = 0;
+
+	memset(&entry, 0, sizeof(entry));
+
+	list_for_each_entry(logpage, list, node) {
+		entry.portid = logpage->portid->portid;
+		entry.e = logpage->e;
+
+		if (write(fd, &entry, sizeof(entry)) != sizeof(entry))
+			return -errno;
+
+		numrec++;
+	}
+
+	return numrec;
+}
+
+void save_logpage_snapshot(struct target *target)
+{
+	struct snapshot_hdr	 hdr;
+	struct subsystem	*subsys;
+	char			 path[FILENAME_MAX];
+	char			 tmp[FILENAME_MAX + 4];
+	int			 numrec = 0;
+	int			 fd;
+	int			 ret;
+
+	mkdir(SNAPSHOT_DIR, 0700);
+
+	snapshot_path(target, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		print_errno("unable to create log page snapshot", -errno);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	/* header is rewritten with the record count once the records are out */
+	ret = write(fd, &hdr, sizeof(hdr));
+	if (ret != sizeof(hdr))
+		goto err;
+
+	list_for_each_entry(subsys, &target->subsys_list, node) {
+		ret = write_snapshot_entries(fd, &subsys->logpage_list);
+		if (ret < 0)
+			goto err;
+		numrec += ret;
+	}
+
+	ret = write_snapshot_entries(fd, &target->unattached_logpage_list);
+	if (ret < 0)
+		goto err;
+	numrec += ret;
+
+	hdr.magic = SNAPSHOT_MAGIC;
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.entry_size = sizeof(struct snapshot_entry);
+	hdr.numrec = numrec;
+
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		goto err;
+
+	if (fsync(fd))
+		goto err;
+
+	close(fd);
+
+	if (rename(tmp, path)) {
+		print_errno("unable to store log page snapshot", -errno);
+		unlink(tmp);
+		return;
+	}
+
+	sync_dir(path);
+
+	return;
+err:
+	print_err("unable to write log page snapshot for %s", target->alias);
+	close(fd);
+	unlink(tmp);
+}
+
+void del_logpage_snapshot(struct target *target)
+{
+	char			 path[FILENAME_MAX];
+
+	snapshot_path(target, path, sizeof(path));
+
+	if (!unlink(path))
+		sync_dir(path);
+}
+
+/* the snapshot is named after the alias, it follows a rename */
+void rename_logpage_snapshot(struct target *target, const char *alias)
+{
+	del_logpage_snapshot(target);
+
+	strcpy(target->alias, alias);
+
+	save_logpage_snapshot(target);
+}
+
+static struct portid *find_target_portid(struct target *target, int id)
+{
+	struct portid		*portid;
+
+	list_for_each_entry(portid, &target->portid_list, node)
+		if (portid->portid == id)
+			return portid;
+
+	return NULL;
+}
+
+/* seed the log pages of a target from its last snapshot, if any */
+void load_logpage_snapshot(struct target *target)
+{
+	struct snapshot_hdr	*hdr;
+	struct snapshot_entry	*entry;
+	struct portid		*portid;
+	struct stat		 st;
+	char			 path[FILENAME_MAX];
+	void			*map;
+	u32			 i;
+	int			 fd;
+	LINKED_LIST(staged);
+
+	snapshot_path(target, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*hdr))
+		goto out;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto out;
+
+	hdr = map;
+
+	if (hdr->magic != SNAPSHOT_MAGIC ||
+	    hdr->version != SNAPSHOT_VERSION ||
+	    hdr->entry_size != sizeof(*entry) ||
+	    st.st_size < (off_t) (sizeof(*hdr) + hdr->numrec * sizeof(*entry))) {
+		print_err("ignoring bad log page snapshot for %s",
+			  target->alias);
+		goto unmap;
+	}
+
+	entry = (struct snapshot_entry *) &hdr[1];
+
+	for (i = 0; i < hdr->numrec; i++, entry++) {
+		/* drop entries for ports no longer configured */
+		portid = find_target_portid(target, entry->portid);
+		if (!portid)
+			continue;
+
+		if (stage_logpage(&staged, &entry->e, portid))
+			break;
+	}
+
+	print_debug("loaded %d log pages for %s from snapshot", hdr->numrec,
+		    target->alias);
+
+	commit_log_pages(target, &staged);
+unmap:
+	munmap(map, st.st_size);
+out:
+	close(fd);
+}
+
+static int stage_log_pages(struct ctrl_queue *dq, struct linked_list *staged)
 {
 	struct nvmf_disc_rsp_page_hdr	*log = NULL;
 	struct target			*target = dq->target;
 	u32				 num_records = 0;
+	u32				 i;
+	int				 ret;
 
-	if (get_logpages(dq, &log, &num_records)) {
+	ret = get_logpages(dq, &log, &num_records);
+	if (ret) {
 		print_err("get logpages for target %s failed", target->alias);
-		return;
+		return ret;
 	}
 
-	save_log_pages(log, num_records, target, dq);
+	for (i = 0; i < num_records; i++) {
+		ret = stage_logpage(staged, &log->entries[i], dq->portid);
+		if (ret)
+			break;
+	}
 
 	print_discovery_log(log, num_records);
 
 	free(log);
+
+	return ret;
+}
+
+void fetch_log_pages(struct ctrl_queue *dq)
+{
+	struct target		*target = dq->target;
+	LINKED_LIST(staged);
+
+	if (stage_log_pages(dq, &staged)) {
+		free_logpage_list(&staged);
+		return;
+	}
+
+	/*
+	 * A single queue only sees part of the target; keep the rest, but
+	 * what it no longer reports goes.
+	 */
+	stage_other_log_pages(dq, &staged);
+
+	if (commit_log_pages(target, &staged))
+		save_logpage_snapshot(target);
 }
 
 static int target_with_allow_any_subsys(struct target *target)
@@ -181,80 +569,83 @@ static int avilable_dq(struct ctrl_queue *dq)
 	return !list_empty(&dq->subsys->host_list);
 }
 
-void refresh_log_pages(struct target *target)
+/* returns -EAGAIN if any port could not be reached */
+int refresh_log_pages(struct target *target)
 {
 	struct ctrl_queue	*dq;
-
-	invalidate_log_pages(target);
+	struct logpage		*logpage;
+	u64			 start = time_usec();
+	int			 count = 0;
+	int			 ret = 0;
+	LINKED_LIST(staged);
 
 	list_for_each_entry(dq, &target->discovery_queue_list, node) {
 		if (!dq->connected) {
 			if (!avilable_dq(dq))
 				continue;
 			if (connect_ctrl(dq)) {
-				target->log_page_retry_count = LOG_PAGE_RETRY;
+				stage_current_log_pages(target, &staged,
+							dq->portid);
+				ret = -EAGAIN;
 				continue;
 			}
+			dq->connected = 1;
 		}
 
-		fetch_log_pages(dq);
+		/* an unreachable port keeps what it last reported */
+		if (stage_log_pages(dq, &staged)) {
+			stage_current_log_pages(target, &staged, dq->portid);
+			ret = -EAGAIN;
+		}
 
 		if (dq->failed_kato)
 			disconnect_ctrl(dq, 0);
 	}
+
+	list_for_each_entry(logpage, &staged, node)
+		count++;
+
+	if (commit_log_pages(target, &staged))
+		save_logpage_snapshot(target);
+
+	time_refresh(target, time_usec() - start, count);
+
+	return ret;
 }
 
-static void format_logpage(char *buf, struct nvmf_disc_rsp_page_entry *e)
-{
-	int			 n;
-	char			*p = buf;
-
-	n = sprintf(p, "<p>subnqn=<b>\"%s\"</b> ", e->subnqn);
-	p += n;
-	n = sprintf(p, "subtype=<b>\"%s\"</b> ", subtype_str(e->subtype));
-	p += n;
-	n = sprintf(p, "portid=<b>%d</b> ", e->portid);
-	p += n;
-	n = sprintf(p, "trtype=<b>\"%s\"</b> ", trtype_str(e->trtype));
-	p += n;
-	n = sprintf(p, "adrfam=<b>\"%s\"</b> ", adrfam_str(e->adrfam));
-	p += n;
-	n = sprintf(p, "traddr=<b>%s</b> ", e->traddr);
-	p += n;
-	n = sprintf(p, "trsvcid=<b>%s</b> ", e->trsvcid);
-	p += n;
-	n = sprintf(p, "treq=<b>\"%s\"</b><br>", treq_str(e->treq));
-	p += n;
+static void format_logpage(struct writer *w,
+			   struct nvmf_disc_rsp_page_entry *e)
+{
+	write_resp(w, "<p>subnqn=<b>\"%s\"</b> ", e->subnqn);
+	write_resp(w, "subtype=<b>\"%s\"</b> ", subtype_str(e->subtype));
+	write_resp(w, "portid=<b>%d</b> ", e->portid);
+	write_resp(w, "trtype=<b>\"%s\"</b> ", trtype_str(e->trtype));
+	write_resp(w, "adrfam=<b>\"%s\"</b> ", adrfam_str(e->adrfam));
+	write_resp(w, "traddr=<b>%s</b> ", e->traddr);
+	write_resp(w, "trsvcid=<b>%s</b> ", e->trsvcid);
+	write_resp(w, "treq=<b>\"%s\"</b><br>", treq_str(e->treq));
 
 	switch (e->trtype) {
 	case NVMF_TRTYPE_RDMA:
-		n = sprintf(p, " &nbsp; rdma: ");
-		p += n;
-		n = sprintf(p, "prtype=<b>\"%s\"</b> ",
-			    prtype_str(e->tsas.rdma.prtype));
-		p += n;
-		n = sprintf(p, "qptype=<b>\"%s\"</b> ",
-			    qptype_str(e->tsas.rdma.qptype));
-		p += n;
-		n = sprintf(p, "cms=<b>\"%s\"</b> ", cms_str(e->tsas.rdma.cms));
-		p += n;
-		n = sprintf(p, "pkey=<b>0x%04x</b>", e->tsas.rdma.pkey);
-		p += n;
+		write_resp(w, " &nbsp; rdma: ");
+		write_resp(w, "prtype=<b>\"%s\"</b> ",
+			   prtype_str(e->tsas.rdma.prtype));
+		write_resp(w, "qptype=<b>\"%s\"</b> ",
+			   qptype_str(e->tsas.rdma.qptype));
+		write_resp(w, "cms=<b>\"%s\"</b> ",
+			   cms_str(e->tsas.rdma.cms));
+		write_resp(w, "pkey=<b>0x%04x</b>", e->tsas.rdma.pkey);
 		break;
 	}
-	n = sprintf(p, "</p>");
-	p += n;
+	write_resp(w, "</p>");
 }
 
-int target_logpage(char *alias, char **resp)
+static int _target_logpage(char *alias, char **resp)
 {
 	struct target		*target;
 	struct subsystem	*subsys;
 	struct logpage		*logpage;
-	char			 buf[MAX_BODY_SIZE + 1];
-	char			*p = *resp;
-	u64			 n, len = 0;
-	u64			 bytes = MAX_BODY_SIZE;
+	struct writer		 w;
 
 	list_for_each_entry(target, target_list, node)
 		if (!strcmp(target->alias, alias))
@@ -262,78 +653,52 @@ int target_logpage(char *alias, char **resp)
 
 	return -ENOENT;
 found:
-	list_for_each_entry(subsys, &target->subsys_list, node)
-		list_for_each_entry(logpage, &subsys->logpage_list, node) {
-			if (!logpage->valid)
-				continue;
-
-			format_logpage(buf, &logpage->e);
+	**resp = 0;
+	init_writer(&w, resp, BODY_SIZE);
 
-			if ((len + strlen(buf)) > bytes) {
-				bytes += MAX_BODY_SIZE;
-				p = realloc(*resp, bytes);
-				if (!p)
-					return -ENOMEM;
-				*resp = p;
-				p += len;
-			}
-			strcpy(p, buf);
-			n = strlen(buf);
-			p += n;
-			len += n;
-		}
+	list_for_each_entry(subsys, &target->subsys_list, node)
+		list_for_each_entry(logpage, &subsys->logpage_list, node)
+			if (logpage->valid)
+				format_logpage(&w, &logpage->e);
 
 	if (list_empty(&target->unattached_logpage_list))
 		goto out;
 
-	sprintf(buf, "<p><p><b style='color:red'>Unattached Log Pages</b><p>");
-	if ((len + strlen(buf)) > bytes) {
-		bytes += MAX_BODY_SIZE;
-		p = realloc(*resp, bytes);
-		if (!p)
-			return -ENOMEM;
-		*resp = p;
-		p += len;
-	}
-	strcpy(p, buf);
-	n = strlen(buf);
-	p += n;
-	len += n;
-
-	list_for_each_entry(logpage, &target->unattached_logpage_list, node) {
-		format_logpage(buf, &logpage->e);
-
-		if ((len + strlen(buf)) > bytes) {
-			bytes += MAX_BODY_SIZE;
-			p = realloc(*resp, bytes);
-			if (!p)
-				return -ENOMEM;
-			*resp = p;
-			p += len;
-		}
-		strcpy(p, buf);
-		n = strlen(buf);
-		p += n;
-		len += n;
-	}
+	write_resp(&w, "<p><p><b style='color:red'>Unattached Log Pages</b><p>");
 
+	list_for_each_entry(logpage, &target->unattached_logpage_list, node)
+		format_logpage(&w, &logpage->e);
 out:
-	if (!len)
+	if (w.err)
+		return w.err;
+
+	if (!w.len)
 		sprintf(*resp, "No valid Log Pages");
 
 	return 0;
 }
 
-int host_logpage(char *alias, char **resp)
+int target_logpage(char *alias, char **resp)
+{
+	int			 ret;
+
+	logpage_rdlock();
+	ret = _target_logpage(alias, resp);
+	logpage_unlock();
+
+	return ret;
+}
+
+static int _host_logpage(char *alias, char **resp)
 {
 	struct host		*host;
 	struct target		*target;
 	struct subsystem	*subsys;
 	struct logpage		*logpage;
-	char			 buf[MAX_BODY_SIZE + 1];
-	char			*p = *resp;
-	u64			 n, len = 0;
-	u64			 bytes = MAX_BODY_SIZE;
+	struct writer		 w;
+
+	**resp = 0;
+	init_writer(&w, resp, BODY_SIZE);
 
 	list_for_each_entry(target, target_list, node) {
 		if (target->group_member &&
@@ -350,30 +715,28 @@ int host_logpage(char *alias, char **resp)
 			continue;
 found:
 			list_for_each_entry(logpage, &subsys->logpage_list,
-					    node) {
-				if (!logpage->valid)
-					continue;
-
-				format_logpage(buf, &logpage->e);
-
-				if ((len + strlen(buf)) > bytes) {
-					bytes += MAX_BODY_SIZE;
-					p = realloc(*resp, bytes);
-					if (!p)
-						return -ENOMEM;
-					*resp = p;
-					p += len;
-				}
-				strcpy(p, buf);
-				n = strlen(buf);
-				p += n;
-				len += n;
-			}
+					    node)
+				if (logpage->valid)
+					format_logpage(&w, &logpage->e);
 		}
 	}
 
-	if (!len)
+	if (w.err)
+		return w.err;
+
+	if (!w.len)
 		sprintf(*resp, "No valid Log Pages");
 
 	return 0;
 }
+
+int host_logpage(char *alias, char **resp)
+{
+	int			 ret;
+
+	logpage_rdlock();
+	ret = _host_logpage(alias, resp);
+	logpage_unlock();
+
+	return ret;
+}
@@ -0,0 +1,460 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+
+#define NUM_BUCKETS		14
+#define LABEL_SIZE		(CONFIG_TYPE_SIZE + CONFIG_ADDRESS_SIZE + \
+				 CONFIG_PORT_SIZE + MAX_ALIAS_SIZE + 64)
+
+/*
+ * GET /dem/metrics reports counters and latencies in the Prometheus text
+ * format.  Counters are kept per thread: a thread only ever writes its own
+ * block, so counting takes no lock and no atomic read-modify-write, and a
+ * scrape sums the blocks.  Stores and loads are relaxed atomics; a scrape
+ * may be slightly behind but never sees a torn value.  The per target
+ * counters follow the same rule since only the thread doing the target's
+ * work writes them.
+ */
+
+/* upper bounds in usec, the bucket after the last one is +Inf */
+static const u64 buckets[NUM_BUCKETS] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+	250000, 1000000, 5000000,
+};
+
+struct histogram {
+	u64			 bucket[NUM_BUCKETS + 1];
+	u64			 usec;
+};
+
+struct metrics {
+	struct metrics		*next;
+	struct host_iface	*iface;		/* served by this thread */
+	u64			 connects;
+	u64			 disconnects;
+	u64			 aens;
+	struct histogram	 disc[NUM_DISC_OPS];
+	struct histogram	 rest[NUM_REST_METHODS];
+	struct histogram	 refresh;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	struct metrics		*blocks;
+} metrics = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread struct metrics *local;
+
+static const char * const disc_ops[NUM_DISC_OPS] = {
+	[DISC_OP_CONNECT]	= "connect",
+	[DISC_OP_PROPERTY_GET]	= "property_get",
+	[DISC_OP_PROPERTY_SET]	= "property_set",
+	[DISC_OP_IDENTIFY]	= "identify",
+	[DISC_OP_KEEP_ALIVE]	= "keep_alive",
+	[DISC_OP_GET_LOG_PAGE]	= "get_log_page",
+	[DISC_OP_GET_FEATURES]	= "get_features",
+	[DISC_OP_SET_FEATURES]	= "set_features",
+	[DISC_OP_ASYNC_EVENT]	= "async_event",
+	[DISC_OP_OTHER]		= "other",
+};
+
+static const char * const rest_methods[NUM_REST_METHODS] = {
+	[REST_GET]		= "GET",
+	[REST_PUT]		= "PUT",
+	[REST_POST]		= "POST",
+	[REST_PATCH]		= "PATCH",
+	[REST_DELETE]		= "DELETE",
+	[REST_OTHER]		= "other",
+};
+
+static inline void bump(u64 *ctr, u64 n)
+{
+	__atomic_store_n(ctr, *ctr + n, __ATOMIC_RELAXED);
+}
+
+static inline u64 peek(u64 *ctr)
+{
+	return __atomic_load_n(ctr, __ATOMIC_RELAXED);
+}
+
+static inline struct host_iface *peek_iface(struct metrics *m)
+{
+	return __atomic_load_n(&m->iface, __ATOMIC_RELAXED);
+}
+
+/* the block of this thread, NULL (nothing is counted) if out of memory */
+static struct metrics *local_metrics(void)
+{
+	struct metrics		*m;
+
+	if (local)
+		return local;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	pthread_mutex_lock(&metrics.lock);
+	m->next = metrics.blocks;
+	metrics.blocks = m;
+	pthread_mutex_unlock(&metrics.lock);
+
+	local = m;
+
+	return m;
+}
+
+static void observe(struct histogram *h, u64 usec)
+{
+	int			 i;
+
+	for (i = 0; i < NUM_BUCKETS; i++)
+		if (usec <= buckets[i])
+			break;
+
+	bump(&h->bucket[i], 1);
+	bump(&h->usec, usec);
+}
+
+/* the calling thread serves the hosts connected to iface */
+void bind_metrics(struct host_iface *iface)
+{
+	struct metrics		*m = local_metrics();
+
+	if (m)
+		__atomic_store_n(&m->iface, iface, __ATOMIC_RELAXED);
+}
+
+void count_host_conn(bool connected)
+{
+	struct metrics		*m = local_metrics();
+
+	if (!m)
+		return;
+
+	if (connected)
+		bump(&m->connects, 1);
+	else
+		bump(&m->disconnects, 1);
+}
+
+void time_disc_cmd(int op, u64 usec)
+{
+	struct metrics		*m = local_metrics();
+
+	if (m)
+		observe(&m->disc[op], usec);
+}
+
+void time_rest_request(int method, u64 usec)
+{
+	struct metrics		*m = local_metrics();
+
+	if (m)
+		observe(&m->rest[method], usec);
+}
+
+void count_aen_sent(void)
+{
+	struct metrics		*m = local_metrics();
+
+	if (m)
+		bump(&m->aens, 1);
+}
+
+void time_refresh(struct target *target, u64 usec, int logpages)
+{
+	struct target_metrics	*t = &target->metrics;
+	struct metrics		*m = local_metrics();
+
+	if (m)
+		observe(&m->refresh, usec);
+
+	bump(&t->refreshes, 1);
+	bump(&t->refresh_usec, usec);
+	__atomic_store_n(&t->logpages, logpages, __ATOMIC_RELAXED);
+}
+
+void time_keep_alive(struct target *target, u64 usec, bool failed)
+{
+	struct target_metrics	*t = &target->metrics;
+
+	if (failed) {
+		bump(&t->keep_alive_failures, 1);
+		return;
+	}
+
+	bump(&t->keep_alives, 1);
+	bump(&t->keep_alive_usec, usec);
+	__atomic_store_n(&t->keep_alive_last_usec, usec, __ATOMIC_RELAXED);
+}
+
+static void write_header(struct writer *w, const char *name,
+			 const char *type, const char *help)
+{
+	write_resp(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_histogram(struct writer *w, const char *name,
+			    const char *labels, struct histogram *h)
+{
+	const char		*sep = *labels ? "," : "";
+	u64			 n = 0;
+	int			 i;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		n += h->bucket[i];
+		write_resp(w, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels,
+			   sep, buckets[i] / 1e6, n);
+	}
+
+	n += h->bucket[NUM_BUCKETS];
+	write_resp(w, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+		   n);
+
+	if (*labels) {
+		write_resp(w, "%s_sum{%s} %.6f\n", name, labels, h->usec / 1e6);
+		write_resp(w, "%s_count{%s} %llu\n", name, labels, n);
+	} else {
+		write_resp(w, "%s_sum %.6f\n", name, h->usec / 1e6);
+		write_resp(w, "%s_count %llu\n", name, n);
+	}
+}
+
+static void add_histogram(struct histogram *sum, struct histogram *h)
+{
+	int			 i;
+
+	for (i = 0; i <= NUM_BUCKETS; i++)
+		sum->bucket[i] += peek(&h->bucket[i]);
+
+	sum->usec += peek(&h->usec);
+}
+
+static void iface_labels(struct host_iface *iface, char *labels)
+{
+	snprintf(labels, LABEL_SIZE,
+		 "trtype=\"%s\",traddr=\"%s\",trsvcid=\"%s\"",
+		 iface->type, iface->address, iface->port);
+}
+
+/* call with metrics.lock held */
+static void write_iface_metrics(struct writer *w)
+{
+	struct host_iface	*iface;
+	struct histogram	 sum;
+	struct metrics		*m;
+	char			 labels[LABEL_SIZE];
+	char			 op_labels[LABEL_SIZE];
+	u64			 connects, disconnects;
+	int			 i, op;
+
+	write_header(w, "dem_host_connections_total", "counter",
+		     "Host connections accepted on the interface.");
+	write_header(w, "dem_host_connections", "gauge",
+		     "Host connections open on the interface.");
+
+	for (i = 0, iface = interfaces; i < num_interfaces; i++, iface++) {
+		connects = disconnects = 0;
+
+		for (m = metrics.blocks; m; m = m->next)
+			if (peek_iface(m) == iface) {
+				connects += peek(&m->connects);
+				disconnects += peek(&m->disconnects);
+			}
+
+		iface_labels(iface, labels);
+		write_resp(w, "dem_host_connections_total{%s} %llu\n",
+			   labels, connects);
+		write_resp(w, "dem_host_connections{%s} %llu\n", labels,
+			   connects - disconnects);
+	}
+
+	write_header(w, "dem_discovery_command_seconds", "histogram",
+		     "Discovery commands handled, by opcode.");
+
+	for (i = 0, iface = interfaces; i < num_interfaces; i++, iface++) {
+		iface_labels(iface, labels);
+
+		for (op = 0; op < NUM_DISC_OPS; op++) {
+			memset(&sum, 0, sizeof(sum));
+
+			for (m = metrics.blocks; m; m = m->next)
+				if (peek_iface(m) == iface)
+					add_histogram(&sum, &m->disc[op]);
+
+			snprintf(op_labels, LABEL_SIZE, "%s,opcode=\"%s\"",
+				 labels, disc_ops[op]);
+			write_histogram(w, "dem_discovery_command_seconds",
+					op_labels, &sum);
+		}
+	}
+}
+
+/* call with metrics.lock held */
+static void write_thread_metrics(struct writer *w)
+{
+	struct histogram	 sum;
+	struct metrics		*m;
+	char			 labels[LABEL_SIZE];
+	u64			 aens = 0;
+	int			 method;
+
+	write_header(w, "dem_aens_sent_total", "counter",
+		     "Log page change notices sent to hosts.");
+
+	for (m = metrics.blocks; m; m = m->next)
+		aens += peek(&m->aens);
+
+	write_resp(w, "dem_aens_sent_total %llu\n", aens);
+
+	write_header(w, "dem_refresh_seconds", "histogram",
+		     "Log page refreshes of all targets.");
+
+	memset(&sum, 0, sizeof(sum));
+	for (m = metrics.blocks; m; m = m->next)
+		add_histogram(&sum, &m->refresh);
+
+	write_histogram(w, "dem_refresh_seconds", "", &sum);
+
+	write_header(w, "dem_rest_request_seconds", "histogram",
+		     "REST requests from being queued to the reply being ready.");
+
+	for (method = 0; method < NUM_REST_METHODS; method++) {
+		memset(&sum, 0, sizeof(sum));
+
+		for (m = metrics.blocks; m; m = m->next)
+			add_histogram(&sum, &m->rest[method]);
+
+		snprintf(labels, LABEL_SIZE, "method=\"%s\"",
+			 rest_methods[method]);
+		write_histogram(w, "dem_rest_request_seconds", labels, &sum);
+	}
+}
+
+static void write_target_metrics(struct writer *w)
+{
+	struct target		*target;
+	struct target_metrics	*t;
+
+	write_header(w, "dem_target_keep_alives_total", "counter",
+		     "Keep alives answered by the target.");
+	list_for_each_entry(target, target_list, node)
+		write_resp(w, "dem_target_keep_alives_total{target=\"%s\"} "
+			   "%llu\n", target->alias,
+			   peek(&target->metrics.keep_alives));
+
+	write_header(w, "dem_target_keep_alive_failures_total", "counter",
+		     "Keep alives the target failed to answer.");
+	list_for_each_entry(target, target_list, node)
+		write_resp(w, "dem_target_keep_alive_failures_total"
+			   "{target=\"%s\"} %llu\n", target->alias,
+			   peek(&target->metrics.keep_alive_failures));
+
+	write_header(w, "dem_target_keep_alive_rtt_seconds", "gauge",
+		     "Round trip of the last keep alive answered.");
+	list_for_each_entry(target, target_list, node)
+		write_resp(w, "dem_target_keep_alive_rtt_seconds"
+			   "{target=\"%s\"} %.6f\n", target->alias,
+			   peek(&target->metrics.keep_alive_last_usec) / 1e6);
+
+	write_header(w, "dem_target_keep_alive_rtt_seconds_total", "counter",
+		     "Round trips of all keep alives answered.");
+	list_for_each_entry(target, target_list, node)
+		write_resp(w, "dem_target_keep_alive_rtt_seconds_total"
+			   "{target=\"%s\"} %.6f\n", target->alias,
+			   peek(&target->metrics.keep_alive_usec) / 1e6);
+
+	write_header(w, "dem_target_refresh_seconds", "summary",
+		     "Log page refreshes of the target.");
+	list_for_each_entry(target, target_list, node) {
+		t = &target->metrics;
+		write_resp(w, "dem_target_refresh_seconds_sum{target=\"%s\"} "
+			   "%.6f\n", target->alias,
+			   peek(&t->refresh_usec) / 1e6);
+		write_resp(w, "dem_target_refresh_seconds_count"
+			   "{target=\"%s\"} %llu\n", target->alias,
+			   peek(&t->refreshes));
+	}
+
+	write_header(w, "dem_target_log_pages", "gauge",
+		     "Log page entries found by the last refresh.");
+	list_for_each_entry(target, target_list, node)
+		write_resp(w, "dem_target_log_pages{target=\"%s\"} %llu\n",
+			   target->alias, peek(&target->metrics.logpages));
+}
+
+/* call with the json lock held so the targets stay put */
+int format_metrics(char **resp)
+{
+	struct writer		 w;
+
+	**resp = 0;
+	init_writer(&w, resp, BODY_SIZE);
+
+	pthread_mutex_lock(&metrics.lock);
+
+	write_iface_metrics(&w);
+	write_thread_metrics(&w);
+
+	pthread_mutex_unlock(&metrics.lock);
+
+	write_target_metrics(&w);
+
+	return w.err;
+}
+
+void cleanup_metrics(void)
+{
+	struct metrics		*m, *next;
+
+	pthread_mutex_lock(&metrics.lock);
+
+	for (m = metrics.blocks; m; m = next) {
+		next = m->next;
+		free(m);
+	}
+
+	metrics.blocks = NULL;
+
+	pthread_mutex_unlock(&metrics.lock);
+}
@@ -168,7 +168,7 @@ static int handle_async_event(struct host_conn *host)
 	strcpy(entry->nqn, host->ep->nqn);
 	entry->ep = host->ep;
 
-	list_add(&entry->node, aen_req_list);
+	queue_aen_request(entry);
 
 	return ret;
 }
@@ -266,6 +266,8 @@ static int handle_get_log_page_count(struct endpoint *ep,
 	int				 numrec = 0;
 	int				 ret;
 
+	logpage_rdlock();
+
 	list_for_each_entry(target, target_list, node) {
 		if (target->group_member && !shared_group(target, ep->nqn))
 			continue;
@@ -282,7 +284,9 @@ static int handle_get_log_page_count(struct endpoint *ep,
 	}
 
 	log->numrec = numrec;
-	log->genctr = 1;
+	log->genctr = get_logpage_genctr();
+
+	logpage_unlock();
 
 #ifdef DEBUG_COMMANDS
 	print_debug("log_page count %d", numrec);
@@ -322,6 +326,8 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 
 	e = (void *) (&log[1]);
 
+	logpage_rdlock();
+
 	list_for_each_entry(target, target_list, node) {
 		if (target->group_member && !shared_group(target, ep->nqn))
 			continue;
@@ -331,6 +337,10 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 				if (!p->valid)
 					continue;
 
+				/* set may have grown since the count */
+				if ((void *) &e[1] > (void *) log + len)
+					goto done;
+
 				if (subsys->access ||
 				    host_access(subsys, ep->nqn)) {
 					memcpy(e, &p->e, sizeof(*e));
@@ -339,9 +349,11 @@ static int handle_get_log_pages(struct endpoint *ep, struct nvme_command *cmd,
 				}
 			}
 	}
-
+done:
 	log->numrec = numrec;
-	log->genctr = 1;
+	log->genctr = get_logpage_genctr();
+
+	logpage_unlock();
 
 	ret = ep->ops->rma_write(ep->ep, log, addr, len, key, mr, cmd);
 	if (ret) {
@@ -362,9 +374,11 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 	struct nvme_command		*cmd = (struct nvme_command *) buf;
 	struct nvme_completion		*resp = (void *) ep->cmd;
 	struct nvmf_connect_command	*c = &cmd->connect;
+	u64				 start = time_usec();
 	u64				 addr;
 	u32				 len;
 	u32				 key;
+	int				 op = DISC_OP_OTHER;
 	int				 ret;
 
 	addr	= c->dptr.ksgl.addr;
@@ -385,12 +399,15 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 	case nvme_fabrics_command:
 		switch (cmd->fabrics.fctype) {
 		case nvme_fabrics_type_property_set:
+			op = DISC_OP_PROPERTY_SET;
 			ret = handle_property_set(cmd, &ep->csts);
 			break;
 		case nvme_fabrics_type_property_get:
+			op = DISC_OP_PROPERTY_GET;
 			ret = handle_property_get(cmd, resp, ep->csts);
 			break;
 		case nvme_fabrics_type_connect:
+			op = DISC_OP_CONNECT;
 			ret = handle_connect(ep, addr, key, len);
 			break;
 		default:
@@ -399,12 +416,15 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 		}
 		break;
 	case nvme_admin_identify:
+		op = DISC_OP_IDENTIFY;
 		ret = handle_identify(ep, cmd, addr, key, len);
 		break;
 	case nvme_admin_keep_alive:
+		op = DISC_OP_KEEP_ALIVE;
 		ret = 0;
 		break;
 	case nvme_admin_get_log_page:
+		op = DISC_OP_GET_LOG_PAGE;
 		if (len == 16)
 			ret = handle_get_log_page_count(ep, cmd, addr, key,
 							len);
@@ -412,12 +432,15 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 			ret = handle_get_log_pages(ep, cmd, addr, key, len);
 		break;
 	case nvme_admin_get_features:
+		op = DISC_OP_GET_FEATURES;
 		ret = handle_get_features(cmd, resp, host);
 		break;
 	case nvme_admin_set_features:
+		op = DISC_OP_SET_FEATURES;
 		ret = handle_set_features(cmd, host);
 		break;
 	case nvme_admin_async_event:
+		op = DISC_OP_ASYNC_EVENT;
 		ret = handle_async_event(host);
 		break;
 	default:
@@ -431,11 +454,14 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 	ep->ops->send_rsp(ep->ep, resp, sizeof(*resp), ep->mr);
 	ep->ops->repost_recv(ep->ep, qe->qe);
 
+	time_disc_cmd(op, time_usec() - start);
+
 	return ret;
 }
 
 #define HOST_QUEUE_MAX 3 /* min of 3 otherwise cannot tell if full */
 struct host_queue {
+	struct host_iface	*iface;
 	struct endpoint		*ep[HOST_QUEUE_MAX];
 	int			 tail, head;
 };
@@ -505,6 +531,8 @@ static void *host_thread(void *arg)
 
 	INIT_LINKED_LIST(&host_list);
 
+	bind_metrics(q->iface);
+
 	while (!stopped) {
 		gettimeofday(&timeval, NULL);
 
@@ -526,6 +554,7 @@ static void *host_thread(void *arg)
 						host->inst);
 
 				list_add_tail(&host->node, &host_list);
+				count_host_conn(true);
 			}
 		} while (!ret && !stopped);
 
@@ -548,6 +577,7 @@ loop:
 					continue;
 
 			disconnect_endpoint(ep, !stopped);
+			count_host_conn(false);
 
 			if (ep->nqn[0])
 				print_info("host '%s' disconnected", ep->nqn);
@@ -638,6 +668,7 @@ void *interface_thread(void *arg)
 	signal(SIGTERM, SIG_IGN);
 
 	memset(&q, 0, sizeof(q));
+	q.iface = iface;
 
 	pthread_attr_init(&pthread_attr);
 
@@ -32,8 +32,11 @@
  * SOFTWARE.
  */
 
+#include <stdarg.h>
+
 #include "mongoose.h"
 #include "common.h"
+#include "curl.h"
 
 static const struct mg_str s_get_method = MG_MK_STR("GET");
 static const struct mg_str s_put_method = MG_MK_STR("PUT");
@@ -52,26 +55,76 @@ struct mg_str *s_signature = (struct mg_str *) &s_signature_default;
 #define LARGE_RSP			512
 
 #define HTTP_OK				200
+#define HTTP_ACCEPTED			202
+#define HTTP_NOT_MODIFIED		304
+#define HTTP_ERR_BAD_REQUEST		400
 #define HTTP_ERR_NOT_FOUND		402
 #define HTTP_ERR_INTERNAL		403
 #define HTTP_ERR_PAGE_NOT_FOUND		404
 #define HTTP_ERR_NOT_IMPLEMENTED	405
 #define HTTP_ERR_FORBIDDEN		403
 #define HTTP_ERR_CONFLICT		409
+#define HTTP_ERR_UNAVAILABLE		503
 #define HTTP_ERR_CONNECT_TIMEOUT	599
 
 #define HTTP_ALLOW			"Access-Control-Allow-Origin:*"
+#define ETAG_SIZE			40
+#define LIST_QUERY_SIZE			1024
+#define LIST_QUERY_PARMS		8
+#define MAX_CACHED_GETS			64
 #define HTTP_ALLOW_CONTROL \
 "Access-Control-Allow-Methods:GET,PUT,POST,DELETE,PATCH,OPTIONS\r\n" \
 "Access-Control-Allow-Headers:" \
 "access-control-allow-origin,origin,content-type,accept,x-requested-with," \
-"authorization,client-security-token,accept-encoding"
+"authorization,client-security-token,accept-encoding,prefer"
+
+static inline const char *http_error_str(int err)
+{
+	if (err == HTTP_ERR_BAD_REQUEST || err == HTTP_ERR_NOT_FOUND)
+		return "Bad Request";
+
+	if (err == HTTP_ERR_FORBIDDEN)
+		return "Forbidden";
+
+	if (err == HTTP_ERR_PAGE_NOT_FOUND)
+		return "Not Found";
+
+	if (err == HTTP_ERR_NOT_IMPLEMENTED)
+		return "Not Implemented";
+
+	if (err == HTTP_ERR_CONFLICT)
+		return "Conflict";
+
+	if (err == HTTP_ERR_UNAVAILABLE)
+		return "Service Unavailable";
+
+	if (err == HTTP_ERR_CONNECT_TIMEOUT)
+		return "Network Connect Timeout Error";
+
+	return "Internal Server Error";
+}
 
 static int is_equal(const struct mg_str *s1, const struct mg_str *s2)
 {
 	return s1->len == s2->len && memcmp(s1->p, s2->p, s2->len) == 0;
 }
 
+static int rest_method(struct http_message *hm)
+{
+	if (is_equal(&hm->method, &s_get_method))
+		return REST_GET;
+	if (is_equal(&hm->method, &s_put_method))
+		return REST_PUT;
+	if (is_equal(&hm->method, &s_post_method))
+		return REST_POST;
+	if (is_equal(&hm->method, &s_patch_method))
+		return REST_PATCH;
+	if (is_equal(&hm->method, &s_delete_method))
+		return REST_DELETE;
+
+	return REST_OTHER;
+}
+
 static inline int http_error(int err)
 {
 	if (err == 0)
@@ -117,6 +170,7 @@ static int parse_uri(char *p, int depth, char *part[])
 static int get_dem_request(char *verb, char *resp)
 {
 	struct host_iface	*iface = interfaces;
+	int			 total, ready, failed;
 	int			 i;
 	int			 n = 0;
 
@@ -145,11 +199,21 @@ static int get_dem_request(char *verb, char *resp)
 		resp += n;
 	}
 
-	sprintf(resp, "]}");
+	get_startup_status(&total, &ready, &failed);
+
+	sprintf(resp, "]," JSTAG "{" JSINDX "," JSINDX "," JSINDX ","
+		JSTAG "%s}}", TAG_STARTUP, TAG_TARGETS, total,
+		TAG_READY, ready, TAG_FAILED, failed, TAG_COMPLETE,
+		(ready + failed == total) ? "true" : "false");
 
 	return 0;
 }
 
+static int import_request(struct mg_str *body, char *resp);
+static int get_job_request(char *id, char **resp);
+static bool async_request(struct http_message *hm);
+static int submit_job(struct http_message *hm, char **resp);
+
 static int post_dem_request(char *verb, struct mg_str *body, char *resp)
 {
 	char			 data[LARGE_RSP + 1];
@@ -163,6 +227,13 @@ static int post_dem_request(char *verb, struct mg_str *body, char *resp)
 		strncpy(data, body->p, min(LARGE_RSP, body->len));
 
 		ret = update_signature(data, resp);
+	} else if (strcmp(verb, URI_IMPORT) == 0) {
+		ret = import_request(body, resp);
+	} else if (strcmp(verb, METHOD_COMMIT) == 0) {
+		ret = commit_queued_config(NULL, resp);
+		sprintf(resp + strlen(resp), "%s%d targets committed",
+			*resp ? "; " : "", ret);
+		ret = 0;
 	} else {
 		ret = HTTP_ERR_NOT_IMPLEMENTED;
 		strcpy(resp, "Method Not Implemented");
@@ -171,43 +242,105 @@ static int post_dem_request(char *verb, struct mg_str *body, char *resp)
 	return ret;
 }
 
-static int handle_dem_requests(char *verb, struct http_message *hm, char *resp)
+static int handle_dem_requests(char *parts[], struct http_message *hm,
+			       char **resp)
 {
+	bool			 get = is_equal(&hm->method, &s_get_method);
+	char			*verb = parts[1];
 	int			 ret;
 
-	if (is_equal(&hm->method, &s_get_method))
-		ret = get_dem_request(verb, resp);
+	if (get && verb && !strcmp(verb, URI_METRICS))
+		ret = http_error(format_metrics(resp));
+	else if (get && verb && !strcmp(verb, URI_JOB))
+		ret = http_error(get_job_request(parts[2], resp));
+	else if (get)
+		ret = get_dem_request(verb, *resp);
 	else if (is_equal(&hm->method, &s_post_method))
-		ret = post_dem_request(verb, &hm->body, resp);
+		ret = post_dem_request(verb, &hm->body, *resp);
 	else
-		ret = bad_request(resp);
+		ret = bad_request(*resp);
 
 	return ret;
 }
 
-static int get_target_request(char *target, char **p, int n, char *query,
-			      char **resp)
+/* a query parameter decoded into buf, NULL if absent or empty */
+static char *query_param(struct mg_str *qs, const char *name, char **buf,
+			 int *size)
+{
+	char			*p = *buf;
+	int			 n;
+
+	n = mg_get_http_var(qs, name, p, *size);
+	if (n <= 0)
+		return NULL;
+
+	*buf += n + 1;
+	*size -= n + 1;
+
+	return p;
+}
+
+/*
+ * Decoded values are never longer than the query string, so a buffer that
+ * holds it and a terminator per parameter cannot truncate any of them.
+ */
+static int list_request(int (*list)(struct list_query *q, char **resp),
+			struct mg_str *qs, char **resp)
+{
+	struct list_query	 q;
+	char			 buf[LIST_QUERY_SIZE];
+	char			*p = buf;
+	char			*limit;
+	char			*end;
+	int			 size = sizeof(buf);
+
+	memset(&q, 0, sizeof(q));
+
+	if (qs->len > sizeof(buf) - LIST_QUERY_PARMS) {
+		strcpy(*resp, "Query too long");
+		return HTTP_ERR_BAD_REQUEST;
+	}
+
+	q.after = query_param(qs, URI_PARM_AFTER, &p, &size);
+	q.fields = query_param(qs, URI_PARM_FIELDS, &p, &size);
+	q.mode = query_param(qs, URI_PARM_MODE, &p, &size);
+	q.fabric = query_param(qs, URI_PARM_FABRIC, &p, &size);
+	q.group = query_param(qs, URI_PARM_GROUP, &p, &size);
+	q.nqn = query_param(qs, URI_PARM_NQN, &p, &size);
+
+	limit = query_param(qs, URI_PARM_LIMIT, &p, &size);
+	if (limit) {
+		q.limit = strtol(limit, &end, 10);
+		if (*end || q.limit < 0) {
+			sprintf(*resp, "Bad %s '%.32s'", URI_PARM_LIMIT, limit);
+			return HTTP_ERR_BAD_REQUEST;
+		}
+	}
+
+	return http_error(list(&q, resp));
+}
+
+static int get_target_request(char *target, char **p, int n,
+			      struct mg_str *query, char **resp)
 {
 	int			 ret;
 
-	if (!target || !*target) {
-		if ((strncmp(query, URI_PARM_MODE, PARM_MODE_LEN) == 0)
-		    && (query[PARM_MODE_LEN]))
-			ret = list_json_target(query, resp);
-		else if ((strncmp(query, URI_PARM_FABRIC, PARM_FABRIC_LEN) == 0)
-			 && (query[PARM_FABRIC_LEN]))
-			ret = list_json_target(query, resp);
-		else
-			ret = list_json_target(NULL, resp);
-	} else if (n == 0)
+	if (!target || !*target)
+		return list_request(list_json_target, query, resp);
+
+	if (n == 0)
 		ret = show_json_target(target, resp);
 	else if (n == 1 && !strcmp(*p, URI_USAGE)) {
 		ret = target_usage(target, resp);
 		if (ret)
 			sprintf(*resp, "%s '%s' not found", TAG_TARGET, target);
+	} else if (n == 1 && !strcmp(*p, URI_HEALTH)) {
+		ret = target_health(target, resp);
+		if (ret)
+			sprintf(*resp, "%s '%s' not found", TAG_TARGET, target);
 	} else if (n == 1 && !strcmp(*p, URI_LOG_PAGE)) {
 		ret = target_logpage(target, resp);
-		if (ret)
+		if (ret == -ENOENT)
 			sprintf(*resp, "%s '%s' not found", TAG_TARGET, target);
 	} else
 		ret = bad_request(*resp);
@@ -306,6 +439,31 @@ bad_req:
 	return 0;
 }
 
+static int commit_target(char *alias, char *resp)
+{
+	struct target		*target;
+
+	/* a dry run only checks the target is configured */
+	if (json_dry_run()) {
+		if (get_json_mgmt_mode(alias) >= 0)
+			return 0;
+		target = NULL;
+	} else
+		target = find_target(alias);
+
+	if (!target) {
+		sprintf(resp, "%s '%s' not found", TAG_TARGET, alias);
+		return -ENOENT;
+	}
+
+	if (!commit_queued_config(target, resp))
+		sprintf(resp, "%s '%s' has nothing queued", TAG_TARGET, alias);
+	else if (!*resp)
+		sprintf(resp, "%s '%s' committed", TAG_TARGET, alias);
+
+	return 0;
+}
+
 static int post_target_request(char *target, char **p, int n,
 			       struct mg_str *body, char *resp)
 {
@@ -340,6 +498,8 @@ static int post_target_request(char *target, char **p, int n,
 		else
 			sprintf(resp, "Unable to reconfigure %s '%s' error %d",
 				TAG_TARGET, target, ret);
+	} else if (!strcmp(*p, METHOD_COMMIT)) {
+		ret = commit_target(target, resp);
 	} else if (!strcmp(*p, METHOD_REFRESH)) {
 		ret = target_refresh(target);
 		if (!ret)
@@ -405,19 +565,15 @@ static int handle_target_requests(char *p[], int n, struct http_message *hm,
 				  char **resp)
 {
 	char			*target;
-	char			 query[32] = { 0 };
 	int			 ret;
 
 	target = p[1];
 	p += 2;
 	n = (n > 2) ? n - 2 : 0;
 
-	if (hm->query_string.len)
-		strncpy(query, hm->query_string.p,
-			min(hm->query_string.len, sizeof(query) - 1));
-
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_target_request(target, p, n, query, resp);
+		ret = get_target_request(target, p, n, &hm->query_string,
+					 resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_target_request(target, p, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -432,17 +588,19 @@ static int handle_target_requests(char *p[], int n, struct http_message *hm,
 	return ret;
 }
 
-static int get_host_request(char *host, char **p, int n, char **resp)
+static int get_host_request(char *host, char **p, int n,
+			    struct mg_str *query, char **resp)
 {
 	int			 ret = -EINVAL;
 
 	if (!host)
-		ret = list_json_host(resp);
-	else if (n == 0)
+		return list_request(list_json_host, query, resp);
+
+	if (n == 0)
 		ret = show_json_host(host, resp);
 	else if (n == 1 && !strcmp(*p, URI_LOG_PAGE)) {
 		ret = host_logpage(host, resp);
-		if (ret)
+		if (ret == -ENOENT)
 			sprintf(*resp, "%s '%s' not found", TAG_HOST, host);
 	}
 
@@ -547,14 +705,14 @@ out:
 	return 0;
 }
 
-static int get_group_request(char *group, char **resp)
+static int get_group_request(char *group, struct mg_str *query, char **resp)
 {
 	int			 ret;
 
 	if (!group)
-		ret = list_json_group(resp);
-	else
-		ret = show_json_group(group, resp);
+		return list_request(list_json_group, query, resp);
+
+	ret = show_json_group(group, resp);
 
 	return http_error(ret);
 }
@@ -691,7 +849,7 @@ static int handle_group_requests(char *p[], int n, struct http_message *hm,
 	p += 2;
 
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_group_request(group, resp);
+		ret = get_group_request(group, &hm->query_string, resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_group_request(group, p, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -717,7 +875,7 @@ static int handle_host_requests(char *p[], int n, struct http_message *hm,
 	n = (n > 2) ? n - 2 : 0;
 
 	if (is_equal(&hm->method, &s_get_method))
-		ret = get_host_request(host, p, n, resp);
+		ret = get_host_request(host, p, n, &hm->query_string, resp);
 	else if (is_equal(&hm->method, &s_put_method))
 		ret = put_host_request(host, n, &hm->body, *resp);
 	else if (is_equal(&hm->method, &s_delete_method))
@@ -732,114 +890,1587 @@ static int handle_host_requests(char *p[], int n, struct http_message *hm,
 	return ret;
 }
 
+static int handle_request(char *parts[], int n, struct http_message *hm,
+			  char **resp)
+{
+	if (strncmp(parts[0], URI_DEM, DEM_LEN) == 0)
+		return handle_dem_requests(parts, hm, resp);
+
+	if (strncmp(parts[0], URI_V1, V1_LEN) == 0)
+		return handle_redfish_requests(parts, n, hm, resp);
+
+	if (strncmp(parts[0], URI_GROUP, GROUP_LEN) == 0)
+		return handle_group_requests(parts, n, hm, resp);
+
+	if (strncmp(parts[0], URI_HOST, HOST_LEN) == 0)
+		return handle_host_requests(parts, n, hm, resp);
+
+	if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0)
+		return handle_target_requests(parts, n, hm, resp);
+
+	sprintf(*resp, "Bad page %.*s", (int) hm->uri.len, hm->uri.p);
+
+	return HTTP_ERR_PAGE_NOT_FOUND;
+}
+
+/*
+ * Keep background target work from running underneath a request that
+ * changes the configuration.  A request against a single existing target
+ * only waits for that target; anything else waits for all target work.
+ */
+static struct target *hold_target_work(char *parts[], int n,
+				       struct http_message *hm,
+				       bool *suspended)
+{
+	struct target		*target = NULL;
+
+	*suspended = false;
+
+	if (is_equal(&hm->method, &s_get_method))
+		return NULL;
+
+	if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0 &&
+	    parts[1] && *parts[1] &&
+	    !(is_equal(&hm->method, &s_delete_method) && n <= 2))
+		target = find_target(parts[1]);
+
+	if (target)
+		lock_target(target);
+	else {
+		suspend_workers();
+		*suspended = true;
+	}
+
+	return target;
+}
+
+static void release_target_work(struct target *target, bool suspended)
+{
+	if (target)
+		unlock_target(target);
+
+	if (suspended)
+		resume_workers();
+}
+
 #define MAX_DEPTH 8
 
-void handle_http_request(struct mg_connection *c, void *ev_data)
+/*
+ * Bulk import: POST /dem/import with {"Operations":[{"Method":"PUT",
+ * "URI":"/target/t1/subsystem/s1","Body":{...}},...]}.  The whole document
+ * is checked before anything is applied, then every operation is run in a
+ * dry run against a copy of the config, so one that would fail leaves it
+ * untouched.  Operations then run in order against the configuration with
+ * pushes to targets held back; the config file is written once and each
+ * target touched gets a single delta push.
+ */
+#define MAX_IMPORT_OPS		4096
+
+struct import_op {
+	const char		*method;
+	char			*uri;
+	char			*body;
+};
+
+static int check_import_op(json_t *op, int i, struct import_op *iop,
+			   char *resp)
 {
-	struct http_message	*hm = (struct http_message *) ev_data;
-	char			*resp = NULL;
-	char			*uri = NULL;
+	json_t			*body;
+	const char		*method;
+	const char		*uri;
+	size_t			 max = LARGE_RSP;
+
+	method = json_string_value(json_object_get(op, TAG_METHOD));
+	uri = json_string_value(json_object_get(op, TAG_URI));
+	if (!method || !uri) {
+		sprintf(resp, "operation %d needs a %s and a %s", i,
+			TAG_METHOD, TAG_URI);
+		return -EINVAL;
+	}
+
+	if (strcmp(method, "PUT") && strcmp(method, "POST") &&
+	    strcmp(method, "PATCH") && strcmp(method, "DELETE")) {
+		sprintf(resp, "operation %d: bad method %.16s", i, method);
+		return -EINVAL;
+	}
+
+	if (*uri == '/')
+		uri++;
+
+	if (strncmp(uri, URI_TARGET "/", TARGET_LEN + 1) &&
+	    strncmp(uri, URI_HOST "/", HOST_LEN + 1) &&
+	    strncmp(uri, URI_GROUP "/", GROUP_LEN + 1)) {
+		sprintf(resp, "operation %d: bad uri %.64s", i, uri);
+		return -EINVAL;
+	}
+
+	body = json_object_get(op, TAG_BODY);
+	if (!body || json_is_null(body))
+		iop->body = strdup("");
+	else if (json_is_string(body))
+		iop->body = strdup(json_string_value(body));
+	else if (json_is_object(body))
+		iop->body = json_dumps(body, JSON_COMPACT);
+	else {
+		sprintf(resp, "operation %d: bad %s", i, TAG_BODY);
+		return -EINVAL;
+	}
+
+	iop->uri = malloc(strlen(uri) + 2);
+	if (!iop->uri || !iop->body) {
+		strcpy(resp, "No memory!");
+		return -ENOMEM;
+	}
+
+	sprintf(iop->uri, "/%s", uri);
+	iop->method = method;
+
+	if (!strcmp(method, "POST"))
+		max = SMALL_RSP;
+
+	if (strlen(iop->body) > max) {
+		sprintf(resp, "operation %d: %s too large", i, TAG_BODY);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int apply_import_op(struct import_op *op, char *resp)
+{
+	struct http_message	 hm;
 	char			*parts[MAX_DEPTH] = { NULL };
+	char			*uri;
+	int			 n;
 	int			 ret;
-	int			 i, n;
 
-	json_spinlock();
+	uri = strdup(op->uri);
+	if (!uri)
+		return HTTP_ERR_INTERNAL;
 
-	if (!hm->uri.len) {
+	memset(&hm, 0, sizeof(hm));
+
+	hm.method = mg_mk_str_n(op->method, strlen(op->method));
+	hm.uri = mg_mk_str_n(op->uri, strlen(op->uri));
+	hm.body = mg_mk_str_n(op->body, strlen(op->body));
+
+	n = parse_uri(uri, MAX_DEPTH, parts);
+	if (n < 0) {
+		sprintf(resp, "Bad page %s", op->uri);
 		ret = HTTP_ERR_PAGE_NOT_FOUND;
+	} else
+		ret = handle_request(parts, n, &hm, &resp);
+
+	free(uri);
+
+	return ret;
+}
+
+static int apply_import_ops(struct import_op *ops, int n, char *msg,
+			    char *resp)
+{
+	int			 i;
+	int			 ret = 0;
+
+	for (i = 0; i < n; i++) {
+		memset(msg, 0, BODY_SIZE);
+
+		ret = apply_import_op(&ops[i], msg);
+		if (ret)
+			break;
+	}
+
+	if (ret)
+		snprintf(resp, BODY_SIZE - 1, "operation %d (%s %s) failed: %s",
+			 i, ops[i].method, ops[i].uri, msg);
+
+	return ret;
+}
+
+static int import_request(struct mg_str *body, char *resp)
+{
+	struct import_op	*ops = NULL;
+	json_error_t		 error;
+	json_t			*root;
+	json_t			*array;
+	char			*msg;
+	int			 i, n = 0;
+	int			 targets;
+	int			 ret;
+
+	root = json_loadb(body->p, body->len, 0, &error);
+	if (!root) {
+		sprintf(resp, "invalid json syntax at line %d", error.line);
+		return HTTP_ERR_BAD_REQUEST;
+	}
+
+	array = json_object_get(root, TAG_OPERATIONS);
+	if (!json_is_array(array) || !json_array_size(array) ||
+	    json_array_size(array) > MAX_IMPORT_OPS) {
+		sprintf(resp, "%s must hold 1 to %d operations",
+			TAG_OPERATIONS, MAX_IMPORT_OPS);
+		ret = HTTP_ERR_BAD_REQUEST;
 		goto out;
 	}
 
-	resp = malloc(BODY_SIZE);
-	if (!resp) {
+	n = json_array_size(array);
+
+	ops = calloc(n, sizeof(*ops));
+	msg = malloc(BODY_SIZE);
+	if (!ops || !msg) {
+		free(msg);
+		strcpy(resp, "No memory!");
 		ret = HTTP_ERR_INTERNAL;
 		goto out;
 	}
 
-	resp[0] = 0;
+	for (i = 0; i < n; i++) {
+		ret = check_import_op(json_array_get(array, i), i, &ops[i],
+				      resp);
+		if (ret) {
+			free(msg);
+			ret = (ret == -ENOMEM) ? HTTP_ERR_INTERNAL :
+						 HTTP_ERR_BAD_REQUEST;
+			goto out;
+		}
+	}
+
+	/* the caller pushes once the config lock is dropped */
+	hold_json_store();
+	defer_target_pushes();
 
-	if (is_equal(&hm->method, &s_options_method)) {
-		ret = -1;
+	ret = begin_json_dry_run();
+	if (ret) {
+		release_json_store();
+		free(msg);
+		strcpy(resp, "No memory!");
+		ret = HTTP_ERR_INTERNAL;
 		goto out;
 	}
 
-	print_debug("%.*s %.*s", (int) hm->method.len, hm->method.p,
-		    (int) hm->uri.len, hm->uri.p);
+	ret = apply_import_ops(ops, n, msg, resp);
+
+	end_json_dry_run();
+
+	/* only applied for real once every operation went through */
+	if (!ret)
+		ret = apply_import_ops(ops, n, msg, resp);
+
+	release_json_store();
+
+	targets = deferred_config_count();
+
+	if (!ret)
+		snprintf(resp, BODY_SIZE, "%d operations applied, "
+			 "%d targets updated", n, targets);
+
+	free(msg);
+out:
+	if (ops)
+		for (i = 0; i < n; i++) {
+			free(ops[i].uri);
+			free(ops[i].body);
+		}
+	free(ops);
+	json_decref(root);
+
+	return ret;
+}
+
+/* write requests are run one at a time, reads run alongside them */
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int is_authorized(struct http_message *hm)
+{
+	int			 i;
+	int			 ret = 1;
 
 	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++)
 		if (is_equal(&hm->header_names[i], &s_authorization))
 			break;
 
+	/* the signature can be changed by a request on another thread */
+	json_rdlock();
+
 	if ((i < MG_MAX_HTTP_HEADERS) &&
-	    (!is_equal(&hm->header_values[i], s_signature))) {
-		ret = HTTP_ERR_FORBIDDEN;
-		goto out;
+	    (!is_equal(&hm->header_values[i], s_signature)))
+		ret = 0;
+
+	json_unlock();
+
+	return ret;
+}
+
+/*
+ * GETs of the target, host and group collections and of single entries
+ * are answered from bodies kept at the generation they were built at,
+ * until a change moves that generation on.  Replies carry it as an ETag
+ * so pollers sending it back in If-None-Match get a bodiless 304.
+ */
+struct cached_get {
+	struct linked_list	 node;
+	char			*uri;
+	char			*body;
+	char			*gz;		/* made on first use */
+	size_t			 len;
+	size_t			 gz_len;
+	u64			 gen;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	struct linked_list	 list;		/* most recently used first */
+	int			 count;
+	time_t			 boot;		/* tells apart DEM restarts */
+} get_cache = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.list		= LINKED_LIST_INIT(get_cache.list),
+};
+
+static void free_cached_get(struct cached_get *entry)
+{
+	list_del(&entry->node);
+	free(entry->uri);
+	free(entry->body);
+	free(entry->gz);
+	free(entry);
+	get_cache.count--;
+}
+
+/* call with the json lock held; usage, health and log pages are live */
+static bool request_generation(char *parts[], struct mg_str *qs, u64 *gen)
+{
+	const char		*section;
+	char			*name = parts[1];
+	char			 buf[LIST_QUERY_SIZE];
+	bool			 host = false;
+
+	if (name && *name && parts[2] && *parts[2])
+		return false;
+
+	if (strncmp(parts[0], URI_GROUP, GROUP_LEN) == 0)
+		section = TAG_GROUPS;
+	else if (strncmp(parts[0], URI_HOST, HOST_LEN) == 0) {
+		section = TAG_HOSTS;
+		host = true;
+	} else if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0)
+		section = TAG_TARGETS;
+	else
+		return false;
+
+	if (!name || !*name) {
+		*gen = json_section_gen(section);
+
+		/* a list filtered by group also changes with the groups */
+		if (mg_get_http_var(qs, URI_PARM_GROUP, buf, sizeof(buf)) > 0 &&
+		    json_section_gen(TAG_GROUPS) > *gen)
+			*gen = json_section_gen(TAG_GROUPS);
+
+		return true;
 	}
 
-	if (hm->body.len)
-		print_debug("%.*s", (int) hm->body.len, hm->body.p);
+	*gen = json_entry_gen(section, name);
 
-	memset(resp, 0, BODY_SIZE);
+	/* a host is shown with the subsystems of the targets allowing it */
+	if (host && json_section_gen(TAG_TARGETS) > *gen)
+		*gen = json_section_gen(TAG_TARGETS);
 
-	uri = malloc(hm->uri.len + 1);
-	if (!uri) {
-		strcpy(resp, "No memory!");
-		ret = HTTP_ERR_INTERNAL;
+	return true;
+}
+
+static bool etag_matches(struct http_message *hm, const char *etag)
+{
+	struct mg_str		*hdr;
+	size_t			 len = strlen(etag);
+	size_t			 i;
+
+	hdr = mg_get_http_header(hm, "If-None-Match");
+	if (!hdr)
+		return false;
+
+	if (mg_vcmp(hdr, "*") == 0)
+		return true;
+
+	/* a list of tags, possibly weak ones */
+	for (i = 0; i + len <= hdr->len; i++)
+		if (memcmp(hdr->p + i, etag, len) == 0)
+			return true;
+
+	return false;
+}
+
+static char *request_key(struct http_message *hm)
+{
+	char			*key;
+
+	key = malloc(hm->uri.len + hm->query_string.len + 2);
+	if (!key)
+		return NULL;
+
+	sprintf(key, "%.*s?%.*s", (int) hm->uri.len, hm->uri.p,
+		(int) hm->query_string.len, hm->query_string.p);
+
+	return key;
+}
+
+static int lookup_cached_get(const char *key, u64 gen, char **resp)
+{
+	struct cached_get	*entry;
+	char			*p;
+	int			 ret = -ENOENT;
+
+	pthread_mutex_lock(&get_cache.lock);
+
+	list_for_each_entry(entry, &get_cache.list, node)
+		if (!strcmp(entry->uri, key))
+			goto found;
+	goto out;
+found:
+	if (entry->gen != gen) {
+		free_cached_get(entry);
 		goto out;
 	}
-	memcpy(uri, (char *) hm->uri.p, hm->uri.len);
-	uri[hm->uri.len] = 0;
 
-	n = parse_uri(uri, MAX_DEPTH, parts);
-	if (n < 0)
-		goto bad_page;
+	if (entry->len >= BODY_SIZE) {
+		p = realloc(*resp, entry->len + 1);
+		if (!p)
+			goto out;
+		*resp = p;
+	}
 
-	if (strncmp(parts[0], URI_DEM, DEM_LEN) == 0)
-		ret = handle_dem_requests(parts[1], hm, resp);
-	else if (strncmp(parts[0], URI_V1, V1_LEN) == 0) {
-		ret = handle_redfish_requests(parts, n, hm, &resp);
-	}
-	else if (strncmp(parts[0], URI_GROUP, GROUP_LEN) == 0)
-		ret = handle_group_requests(parts, n, hm, &resp);
-	else if (strncmp(parts[0], URI_HOST, HOST_LEN) == 0)
-		ret = handle_host_requests(parts, n, hm, &resp);
-	else if (strncmp(parts[0], URI_TARGET, TARGET_LEN) == 0)
-		ret = handle_target_requests(parts, n, hm, &resp);
-	else
-		goto bad_page;
+	memcpy(*resp, entry->body, entry->len + 1);
 
-	goto out;
+	list_del(&entry->node);
+	list_add(&entry->node, &get_cache.list);
 
-bad_page:
-	sprintf(resp, "Bad page %.*s", (int) hm->uri.len, hm->uri.p);
-	ret = HTTP_ERR_PAGE_NOT_FOUND;
+	ret = 0;
 out:
-	if (!ret)
-		mg_printf(c, "%s %d OK\r\n%s", HTTP_HDR, HTTP_OK, HTTP_ALLOW);
-	else if (ret == -1)
-		mg_printf(c, "%s %d OK\r\n%s\r\n%s", HTTP_HDR, HTTP_OK,
-			  HTTP_ALLOW, HTTP_ALLOW_CONTROL);
-	else if (resp)
-		mg_printf(c, "%s %d\r\n%s\r\n%s", HTTP_HDR, ret, resp,
-			  HTTP_ALLOW);
-	else
-		mg_printf(c, "%s %d\r\nInternal Error\r\n%s", HTTP_HDR, ret,
-			  HTTP_ALLOW);
+	pthread_mutex_unlock(&get_cache.lock);
 
-	mg_printf(c, "\r\nContent-Type: plain/text");
-	if (resp) {
-		mg_printf(c, "\r\nContent-Length: %ld\r\n", strlen(resp));
-		mg_printf(c, "\r\n%s\r\n\r\n", resp);
-		free(resp);
-	} else {
-		mg_printf(c, "\r\nContent-Length: 14\r\n");
-		mg_printf(c, "\r\nInternal Error\r\n\r\n");
+	return ret;
+}
+
+static void cache_get(const char *key, u64 gen, const char *body)
+{
+	struct cached_get	*entry;
+	struct cached_get	*next;
+	struct cached_get	*old;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return;
+
+	entry->uri = strdup(key);
+	entry->body = strdup(body);
+	if (!entry->uri || !entry->body) {
+		free(entry->uri);
+		free(entry->body);
+		free(entry);
+		return;
+	}
+
+	entry->len = strlen(body);
+	entry->gen = gen;
+	entry->gz = NULL;
+	entry->gz_len = 0;
+
+	pthread_mutex_lock(&get_cache.lock);
+
+	/* another reader may have built the same body meanwhile */
+	list_for_each_entry_safe(old, next, &get_cache.list, node)
+		if (!strcmp(old->uri, key))
+			free_cached_get(old);
+
+	list_add(&entry->node, &get_cache.list);
+	get_cache.count++;
+
+	while (get_cache.count > MAX_CACHED_GETS)
+		free_cached_get(list_entry(get_cache.list.prev,
+					   struct cached_get, node));
+
+	pthread_mutex_unlock(&get_cache.lock);
+}
+
+/* call with get_cache.lock held */
+static struct cached_get *find_cached_body(const char *key, const char *body,
+					   size_t len)
+{
+	struct cached_get	*entry;
+
+	list_for_each_entry(entry, &get_cache.list, node)
+		if (!strcmp(entry->uri, key))
+			goto found;
+
+	return NULL;
+found:
+	if (entry->len != len || memcmp(entry->body, body, len))
+		return NULL;
+
+	return entry;
+}
+
+/*
+ * A gzip copy of a large reply for a client that takes it.  A cached GET
+ * keeps its copy, so each body is only compressed once.
+ */
+static char *gzip_reply(struct http_message *hm, int ret, const char *resp,
+			size_t *gz_len)
+{
+	struct cached_get	*entry;
+	struct mg_str		*hdr;
+	size_t			 len;
+	char			*key;
+	char			*gz = NULL;
+
+	if (ret || !resp)
+		return NULL;
+
+	len = strlen(resp);
+	if (len < GZIP_MIN_SIZE)
+		return NULL;
+
+	hdr = mg_get_http_header(hm, "Accept-Encoding");
+	if (!hdr || !gzip_accepted(hdr->p, hdr->len))
+		return NULL;
+
+	if (!is_equal(&hm->method, &s_get_method))
+		return gzip_body(resp, len, gz_len);
+
+	key = request_key(hm);
+	if (!key)
+		return gzip_body(resp, len, gz_len);
+
+	pthread_mutex_lock(&get_cache.lock);
+
+	entry = find_cached_body(key, resp, len);
+	if (entry && entry->gz) {
+		gz = malloc(entry->gz_len);
+		if (gz) {
+			memcpy(gz, entry->gz, entry->gz_len);
+			*gz_len = entry->gz_len;
+		}
 	}
 
-	if (uri)
-		free(uri);
+	pthread_mutex_unlock(&get_cache.lock);
+
+	if (gz)
+		goto out;
+
+	gz = gzip_body(resp, len, gz_len);
+	if (!gz)
+		goto out;
+
+	pthread_mutex_lock(&get_cache.lock);
 
-	c->flags = MG_F_SEND_AND_CLOSE;
+	entry = find_cached_body(key, resp, len);
+	if (entry && !entry->gz) {
+		entry->gz = malloc(*gz_len);
+		if (entry->gz) {
+			memcpy(entry->gz, gz, *gz_len);
+			entry->gz_len = *gz_len;
+		}
+	}
+
+	pthread_mutex_unlock(&get_cache.lock);
+out:
+	free(key);
+
+	return gz;
+}
+
+/* call with the json lock held so the body matches the generation */
+static int cached_request(char *parts[], int n, struct http_message *hm,
+			  char **resp, char *etag)
+{
+	char			*key;
+	u64			 gen;
+	int			 ret;
+
+	if (!request_generation(parts, &hm->query_string, &gen))
+		return handle_request(parts, n, hm, resp);
+
+	pthread_mutex_lock(&get_cache.lock);
+	if (!get_cache.boot)
+		get_cache.boot = time(NULL);
+	snprintf(etag, ETAG_SIZE, "\"%lx-%llx\"",
+		 (unsigned long) get_cache.boot, gen);
+	pthread_mutex_unlock(&get_cache.lock);
+
+	if (etag_matches(hm, etag))
+		return HTTP_NOT_MODIFIED;
+
+	key = request_key(hm);
+	if (!key)
+		return handle_request(parts, n, hm, resp);
+
+	if (lookup_cached_get(key, gen, resp) == 0) {
+		ret = 0;
+		goto out;
+	}
+
+	ret = handle_request(parts, n, hm, resp);
+	if (!ret)
+		cache_get(key, gen, *resp);
+out:
+	free(key);
+
+	return ret;
+}
+
+static int run_request(struct http_message *hm, char **resp, char *etag)
+{
+	struct target		*target;
+	bool			 suspended;
+	bool			 get = is_equal(&hm->method, &s_get_method);
+	char			*uri;
+	char			*parts[MAX_DEPTH] = { NULL };
+	int			 ret;
+	int			 n;
+
+	memset(*resp, 0, BODY_SIZE);
+	*etag = 0;
+
+	/* only seen here when pipelined behind another request */
+	if (!hm->uri.len)
+		return HTTP_ERR_PAGE_NOT_FOUND;
+
+	if (is_equal(&hm->method, &s_options_method))
+		return -1;
+
+	print_debug("%.*s %.*s", (int) hm->method.len, hm->method.p,
+		    (int) hm->uri.len, hm->uri.p);
+
+	if (!is_authorized(hm))
+		return HTTP_ERR_FORBIDDEN;
+
+	if (hm->body.len)
+		print_debug("%.*s", (int) hm->body.len, hm->body.p);
+
+	if (!get && async_request(hm))
+		return submit_job(hm, resp);
+
+	uri = malloc(hm->uri.len + 1);
+	if (!uri) {
+		strcpy(*resp, "No memory!");
+		return HTTP_ERR_INTERNAL;
+	}
+	memcpy(uri, (char *) hm->uri.p, hm->uri.len);
+	uri[hm->uri.len] = 0;
+
+	n = parse_uri(uri, MAX_DEPTH, parts);
+	if (n < 0) {
+		sprintf(*resp, "Bad page %.*s", (int) hm->uri.len, hm->uri.p);
+		ret = HTTP_ERR_PAGE_NOT_FOUND;
+		goto out;
+	}
+
+	/*
+	 * Writers only hold the config while changing it in memory; what
+	 * they changed is pushed to the targets once the lock is dropped.
+	 */
+	if (get) {
+		json_rdlock();
+		ret = cached_request(parts, n, hm, resp, etag);
+		json_unlock();
+		if (ret && ret != HTTP_NOT_MODIFIED)
+			*etag = 0;
+		goto out;
+	}
+
+	pthread_mutex_lock(&write_lock);
+
+	target = hold_target_work(parts, n, hm, &suspended);
+
+	json_wrlock();
+	defer_target_pushes();
+	ret = handle_request(parts, n, hm, resp);
+	json_unlock();
+
+	/* do not acknowledge a change before it is on disk */
+	journal_sync();
+
+	finish_deferred_config(*resp);
+
+	release_target_work(target, suspended);
+
+	pthread_mutex_unlock(&write_lock);
+out:
+	free(uri);
+
+	return ret;
+}
+
+/* HTTP/1.1 connections persist unless the client asks to close them */
+static bool keep_alive(struct http_message *hm)
+{
+	struct mg_str		*hdr;
+
+	hdr = mg_get_http_header(hm, "Connection");
+	if (hdr)
+		return mg_vcasecmp(hdr, "close") != 0;
+
+	return mg_vcmp(&hm->proto, HTTP_HDR) == 0;
+}
+
+/*
+ * Large bodies (log pages, lists) are appended to the response through a
+ * writer that doubles the buffer when it runs out, so building them stays
+ * linear.  A failure sticks, replaces the partial body and drops later
+ * writes, so the caller only checks w->err once at the end.
+ */
+void init_writer(struct writer *w, char **buf, size_t size)
+{
+	w->buf = buf;
+	w->len = strlen(*buf);
+	w->size = size;
+	w->err = 0;
+}
+
+int write_resp(struct writer *w, const char *fmt, ...)
+{
+	va_list			 args;
+	size_t			 size;
+	char			*p;
+	int			 n;
+
+	if (w->err)
+		return w->err;
+
+	va_start(args, fmt);
+	n = vsnprintf(*w->buf + w->len, w->size - w->len, fmt, args);
+	va_end(args);
+
+	if (n < 0)
+		goto err;
+
+	if (w->len + n < w->size)
+		goto out;
+
+	for (size = w->size * 2; size <= w->len + n; size *= 2)
+		;
+
+	p = realloc(*w->buf, size);
+	if (!p)
+		goto err;
+
+	*w->buf = p;
+	w->size = size;
+
+	va_start(args, fmt);
+	vsnprintf(p + w->len, size - w->len, fmt, args);
+	va_end(args);
+out:
+	w->len += n;
+	return 0;
+err:
+	w->err = -ENOMEM;
+	strcpy(*w->buf, "No memory!");
+	return w->err;
+}
+
+/*
+ * The body is exactly Content-Length bytes so the connection can be reused.
+ * With gz the body sent is that gzip copy of resp, and the ETag is weak as
+ * the bytes differ from the plain reply with the same tag.
+ */
+static void send_encoded_reply(struct mg_connection *c, int ret,
+			       const char *resp, const struct mg_str *gz,
+			       bool keep, const char *etag)
+{
+	int			 len;
+
+	if (ret == HTTP_NOT_MODIFIED)
+		mg_printf(c, "%s %d Not Modified\r\n%s", HTTP_HDR, ret,
+			  HTTP_ALLOW);
+	else if (ret == HTTP_ACCEPTED)
+		mg_printf(c, "%s %d Accepted\r\n%s", HTTP_HDR, ret,
+			  HTTP_ALLOW);
+	else if (!ret)
+		mg_printf(c, "%s %d OK\r\n%s", HTTP_HDR, HTTP_OK, HTTP_ALLOW);
+	else if (ret == -1)
+		mg_printf(c, "%s %d OK\r\n%s\r\n%s", HTTP_HDR, HTTP_OK,
+			  HTTP_ALLOW, HTTP_ALLOW_CONTROL);
+	else
+		mg_printf(c, "%s %d %s\r\n%s", HTTP_HDR, ret,
+			  http_error_str(ret), HTTP_ALLOW);
+
+	/* have browsers revalidate every time rather than guess */
+	if (etag && *etag)
+		mg_printf(c, "\r\nETag: %s%s\r\nCache-Control: no-cache",
+			  gz ? "W/" : "", etag);
+
+	mg_printf(c, "\r\nConnection: %s", keep ? "keep-alive" : "close");
+	if (ret == HTTP_NOT_MODIFIED) {
+		mg_printf(c, "\r\n\r\n");
+		goto out;
+	}
+
+	mg_printf(c, "\r\nContent-Type: plain/text");
+	if (gz) {
+		mg_printf(c, "\r\nContent-Encoding: gzip");
+		mg_printf(c, "\r\nVary: Accept-Encoding");
+		mg_printf(c, "\r\nContent-Length: %d\r\n\r\n",
+			  (int) gz->len);
+		mg_send(c, gz->p, gz->len);
+	} else if (resp) {
+		len = strlen(resp);
+		if (len >= GZIP_MIN_SIZE)
+			mg_printf(c, "\r\nVary: Accept-Encoding");
+		mg_printf(c, "\r\nContent-Length: %d\r\n\r\n", len);
+		mg_send(c, resp, len);
+	} else {
+		mg_printf(c, "\r\nContent-Length: 14\r\n");
+		mg_printf(c, "\r\nInternal Error");
+	}
+out:
+	if (!keep)
+		c->flags |= MG_F_SEND_AND_CLOSE;
+}
+
+static inline void send_reply(struct mg_connection *c, int ret,
+			      const char *resp, bool keep, const char *etag)
+{
+	send_encoded_reply(c, ret, resp, NULL, keep, etag);
+}
+
+/*
+ * The mongoose thread only does the socket I/O and parsing.  Requests are
+ * copied and run on a pool of REST threads; a finished request goes on the
+ * done list and mg_broadcast() wakes the mongoose thread to send the reply.
+ * The connection and its user_data are only touched on the mongoose thread,
+ * a request whose client went away meanwhile is just dropped.
+ *
+ * Connections are kept open and may pipeline requests.  Those are chained
+ * off the one in flight and each is only queued once the reply before it
+ * was sent, so replies go out in request order.
+ */
+#define DEFAULT_REST_THREADS	4
+#define MAX_REST_THREADS	64
+
+struct rest_request {
+	struct linked_list	 node;
+	struct rest_request	*next;		/* pipelined after this one */
+	struct mg_connection	*conn;
+	struct http_message	 hm;
+	char			*buf;
+	char			*resp;
+	char			*gz;		/* gzip copy of resp */
+	size_t			 gz_len;
+	char			 etag[ETAG_SIZE];
+	u64			 queued;	/* usec, for the metrics */
+	int			 ret;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 ready;
+	struct linked_list	 queue;
+	struct linked_list	 done;
+	struct mg_mgr		*mgr;
+	pthread_t		*threads;
+	int			 count;
+	int			 stopping;
+} rest = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.ready		= PTHREAD_COND_INITIALIZER,
+	.queue		= LINKED_LIST_INIT(rest.queue),
+	.done		= LINKED_LIST_INIT(rest.done),
+};
+
+static inline void rebase_str(struct mg_str *str, const char *from,
+			      size_t len, char *to)
+{
+	if (str->p >= from && str->p + str->len <= from + len)
+		str->p = to + (str->p - from);
+	else
+		*str = mg_mk_str_n(NULL, 0);
+}
+
+static struct rest_request *copy_request(struct mg_connection *c,
+					 struct http_message *hm)
+{
+	struct rest_request	*req;
+	const char		*from = hm->message.p;
+	size_t			 len = hm->message.len;
+	int			 i;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return NULL;
+
+	req->buf = malloc(len + hm->body.len + 1);
+	req->resp = malloc(BODY_SIZE);
+	if (!req->buf || !req->resp) {
+		free(req->buf);
+		free(req->resp);
+		free(req);
+		return NULL;
+	}
+
+	memcpy(req->buf, from, len);
+
+	req->conn = c;
+	req->hm = *hm;
+
+	rebase_str(&req->hm.message, from, len, req->buf);
+	rebase_str(&req->hm.method, from, len, req->buf);
+	rebase_str(&req->hm.uri, from, len, req->buf);
+	rebase_str(&req->hm.proto, from, len, req->buf);
+	rebase_str(&req->hm.query_string, from, len, req->buf);
+
+	for (i = 0; i < MG_MAX_HTTP_HEADERS; i++) {
+		rebase_str(&req->hm.header_names[i], from, len, req->buf);
+		rebase_str(&req->hm.header_values[i], from, len, req->buf);
+	}
+
+	/* the body is normally part of the message, copy it if not */
+	memcpy(req->buf + len, hm->body.p, hm->body.len);
+	req->buf[len + hm->body.len] = 0;
+	req->hm.body.p = req->buf + len;
+
+	return req;
+}
+
+static void free_request(struct rest_request *req)
+{
+	free(req->gz);
+	free(req->resp);
+	free(req->buf);
+	free(req);
+}
+
+static void free_pipelined(struct rest_request *req)
+{
+	struct rest_request	*next;
+
+	for (; req; req = next) {
+		next = req->next;
+		free_request(req);
+	}
+}
+
+/*
+ * A write sent with "Prefer: respond-async" is run as a job: it is
+ * answered 202 with the job right away and run later on the job thread,
+ * in the order submitted, so no client waits on the fabric.  GET /dem/job
+ * lists the jobs and GET /dem/job/<id> shows one with the status and reply
+ * of its request once run.  Every state change is sent on the watch feed
+ * as a job event.  The last MAX_JOBS finished jobs are kept.
+ */
+#define MAX_JOBS		256
+#define MAX_QUEUED_JOBS		1024
+#define JOB_ID_SIZE		24
+
+enum { JOB_QUEUED = 1, JOB_RUNNING, JOB_DONE };
+
+struct job {
+	struct linked_list	 node;
+	struct rest_request	*req;		/* until it has run */
+	char			*method;
+	char			*uri;
+	char			*result;
+	u64			 id;
+	int			 state;
+	int			 status;
+	time_t			 submitted;
+	time_t			 finished;
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 ready;
+	struct linked_list	 list;		/* oldest first */
+	pthread_t		 thread;
+	u64			 seq;
+	int			 queued;
+	int			 done;
+	bool			 started;
+	bool			 stopping;
+} jobs = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.ready		= PTHREAD_COND_INITIALIZER,
+	.list		= LINKED_LIST_INIT(jobs.list),
+};
+
+static __thread bool on_job_thread;
+
+static const char *job_state_str(int state)
+{
+	switch (state) {
+	case JOB_QUEUED:
+		return "queued";
+	case JOB_RUNNING:
+		return "running";
+	default:
+		return "done";
+	}
+}
+
+static void job_event(u64 id, int state)
+{
+	char			 name[JOB_ID_SIZE];
+
+	snprintf(name, sizeof(name), "%llu", id);
+
+	watch_event(URI_JOB, name, state, false);
+}
+
+static void free_job(struct job *job)
+{
+	if (job->req)
+		free_request(job->req);
+
+	free(job->method);
+	free(job->uri);
+	free(job->result);
+	free(job);
+}
+
+/* Prefer: respond-async (RFC 7240), honored once the job thread is up */
+static bool async_request(struct http_message *hm)
+{
+	struct mg_str		*hdr;
+	char			 pref[64];
+
+	if (!jobs.started || on_job_thread)
+		return false;
+
+	hdr = mg_get_http_header(hm, "Prefer");
+	if (!hdr || hdr->len >= sizeof(pref))
+		return false;
+
+	memcpy(pref, hdr->p, hdr->len);
+	pref[hdr->len] = 0;
+
+	return strstr(pref, "respond-async") != NULL;
+}
+
+/* call with jobs.lock held */
+static json_t *job_json(struct job *job, bool full)
+{
+	json_t			*obj;
+
+	obj = json_object();
+	if (!obj)
+		return NULL;
+
+	json_object_set_new(obj, TAG_ID, json_integer(job->id));
+	json_object_set_new(obj, TAG_METHOD, json_string(job->method));
+	json_object_set_new(obj, TAG_URI, json_string(job->uri));
+	json_object_set_new(obj, TAG_STATE,
+			    json_string(job_state_str(job->state)));
+
+	if (!full || job->state != JOB_DONE)
+		return obj;
+
+	json_object_set_new(obj, TAG_STATUS, json_integer(job->status));
+	json_object_set_new(obj, TAG_RESULT,
+			    json_string(job->result ? job->result : ""));
+
+	return obj;
+}
+
+static int write_json(json_t *obj, char **resp)
+{
+	struct writer		 w;
+	char			*str;
+
+	if (!obj)
+		return -ENOMEM;
+
+	str = json_dumps(obj, 0);
+	json_decref(obj);
+	if (!str)
+		return -ENOMEM;
+
+	init_writer(&w, resp, BODY_SIZE);
+	write_resp(&w, "%s", str);
+
+	free(str);
+
+	return w.err;
+}
+
+static int submit_job(struct http_message *hm, char **resp)
+{
+	struct job		*job;
+	json_t			*obj;
+	u64			 id;
+	int			 ret;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		goto nomem;
+
+	job->req = copy_request(NULL, hm);
+	job->method = strndup(hm->method.p, hm->method.len);
+	job->uri = strndup(hm->uri.p, hm->uri.len);
+	if (!job->req || !job->method || !job->uri) {
+		free_job(job);
+		goto nomem;
+	}
+
+	job->state = JOB_QUEUED;
+	job->submitted = time(NULL);
+
+	pthread_mutex_lock(&jobs.lock);
+
+	if (jobs.queued >= MAX_QUEUED_JOBS) {
+		pthread_mutex_unlock(&jobs.lock);
+		free_job(job);
+		strcpy(*resp, "Too many jobs queued");
+		return HTTP_ERR_UNAVAILABLE;
+	}
+
+	id = job->id = ++jobs.seq;
+	list_add_tail(&job->node, &jobs.list);
+	jobs.queued++;
+
+	obj = job_json(job, false);
+
+	pthread_cond_signal(&jobs.ready);
+	pthread_mutex_unlock(&jobs.lock);
+
+	job_event(id, JOB_QUEUED);
+
+	ret = write_json(obj, resp);
+	if (ret)
+		return http_error(ret);
+
+	return HTTP_ACCEPTED;
+nomem:
+	strcpy(*resp, "No memory!");
+	return HTTP_ERR_INTERNAL;
+}
+
+/* call with jobs.lock held */
+static void prune_jobs(void)
+{
+	struct job		*job, *next;
+
+	list_for_each_entry_safe(job, next, &jobs.list, node) {
+		if (jobs.done <= MAX_JOBS)
+			break;
+
+		if (job->state != JOB_DONE)
+			continue;
+
+		list_del(&job->node);
+		free_job(job);
+		jobs.done--;
+	}
+}
+
+/* call with jobs.lock held */
+static struct job *next_job(void)
+{
+	struct job		*job;
+
+	list_for_each_entry(job, &jobs.list, node)
+		if (job->state == JOB_QUEUED)
+			return job;
+
+	return NULL;
+}
+
+static void *job_thread(void *arg)
+{
+	struct rest_request	*req;
+	struct job		*job;
+	char			 etag[ETAG_SIZE];
+	u64			 id;
+	int			 ret;
+
+	UNUSED(arg);
+
+	on_job_thread = true;
+
+	pthread_mutex_lock(&jobs.lock);
+
+	while (!jobs.stopping) {
+		job = next_job();
+		if (!job) {
+			pthread_cond_wait(&jobs.ready, &jobs.lock);
+			continue;
+		}
+
+		job->state = JOB_RUNNING;
+		jobs.queued--;
+		req = job->req;
+		id = job->id;
+
+		pthread_mutex_unlock(&jobs.lock);
+
+		job_event(id, JOB_RUNNING);
+
+		ret = run_request(&req->hm, &req->resp, etag);
+
+		pthread_mutex_lock(&jobs.lock);
+
+		job->status = ret ? ret : HTTP_OK;
+		job->result = req->resp;
+		job->req = NULL;
+		job->state = JOB_DONE;
+		job->finished = time(NULL);
+		jobs.done++;
+
+		req->resp = NULL;
+		free_request(req);
+
+		prune_jobs();
+
+		pthread_mutex_unlock(&jobs.lock);
+
+		job_event(id, JOB_DONE);
+
+		pthread_mutex_lock(&jobs.lock);
+	}
+
+	pthread_mutex_unlock(&jobs.lock);
+
+	free_curl_context();
+
+	return NULL;
+}
+
+static int get_job_request(char *id, char **resp)
+{
+	struct job		*job;
+	json_t			*obj;
+	json_t			*array;
+	u64			 n;
+
+	pthread_mutex_lock(&jobs.lock);
+
+	if (id && *id) {
+		n = strtoull(id, NULL, 10);
+
+		list_for_each_entry(job, &jobs.list, node)
+			if (job->id == n)
+				goto found;
+
+		pthread_mutex_unlock(&jobs.lock);
+
+		sprintf(*resp, "job '%.32s' not found", id);
+		return -ENOENT;
+found:
+		obj = job_json(job, true);
+		goto out;
+	}
+
+	array = json_array();
+	obj = json_object();
+	if (!array || !obj) {
+		json_decref(array);
+		json_decref(obj);
+		obj = NULL;
+		goto out;
+	}
+
+	json_object_set_new(obj, TAG_JOBS, array);
+
+	list_for_each_entry(job, &jobs.list, node)
+		json_array_append_new(array, job_json(job, false));
+out:
+	pthread_mutex_unlock(&jobs.lock);
+
+	return write_json(obj, resp);
+}
+
+static void init_job_thread(void)
+{
+	if (pthread_create(&jobs.thread, NULL, job_thread, NULL)) {
+		print_err("failed to start job thread");
+		return;
+	}
+
+	jobs.started = true;
+}
+
+/* jobs not yet run are dropped */
+static void cleanup_job_thread(void)
+{
+	struct job		*job, *next;
+
+	if (jobs.started) {
+		pthread_mutex_lock(&jobs.lock);
+		jobs.stopping = true;
+		pthread_cond_broadcast(&jobs.ready);
+		pthread_mutex_unlock(&jobs.lock);
+
+		pthread_join(jobs.thread, NULL);
+		jobs.started = false;
+	}
+
+	list_for_each_entry_safe(job, next, &jobs.list, node) {
+		list_del(&job->node);
+		free_job(job);
+	}
+
+	jobs.queued = jobs.done = 0;
+}
+
+/* call with rest.lock held */
+static inline void queue_request(struct rest_request *req)
+{
+	req->queued = time_usec();
+	list_add_tail(&req->node, &rest.queue);
+	pthread_cond_signal(&rest.ready);
+}
+
+/* runs on the mongoose thread for each connection, the first sends all */
+static void send_replies(struct mg_connection *c, int ev, void *ev_data)
+{
+	struct rest_request	*req;
+	struct mg_str		 gz;
+
+	UNUSED(c);
+	UNUSED(ev);
+	UNUSED(ev_data);
+
+	pthread_mutex_lock(&rest.lock);
+
+	while (!list_empty(&rest.done)) {
+		req = list_first_entry(&rest.done, struct rest_request, node);
+		list_del(&req->node);
+
+		if (req->conn) {
+			gz = mg_mk_str_n(req->gz, req->gz_len);
+			send_encoded_reply(req->conn, req->ret, req->resp,
+					   req->gz ? &gz : NULL,
+					   keep_alive(&req->hm), req->etag);
+			req->conn->user_data = req->next;
+		}
+
+		if (req->next && !rest.stopping)
+			queue_request(req->next);
+		else
+			free_pipelined(req->next);
+
+		free_request(req);
+	}
+
+	pthread_mutex_unlock(&rest.lock);
+}
+
+static void *rest_thread(void *arg)
+{
+	struct rest_request	*req;
+
+	UNUSED(arg);
+
+	pthread_mutex_lock(&rest.lock);
+
+	while (!rest.stopping) {
+		if (list_empty(&rest.queue)) {
+			pthread_cond_wait(&rest.ready, &rest.lock);
+			continue;
+		}
+
+		req = list_first_entry(&rest.queue, struct rest_request, node);
+		list_del(&req->node);
+
+		pthread_mutex_unlock(&rest.lock);
+
+		req->ret = run_request(&req->hm, &req->resp, req->etag);
+
+		/* compressed here rather than on the mongoose thread */
+		req->gz = gzip_reply(&req->hm, req->ret, req->resp,
+				     &req->gz_len);
+
+		time_rest_request(rest_method(&req->hm),
+				  time_usec() - req->queued);
+
+		pthread_mutex_lock(&rest.lock);
+
+		list_add_tail(&req->node, &rest.done);
+
+		pthread_mutex_unlock(&rest.lock);
+
+		mg_broadcast(rest.mgr, send_replies, &req, sizeof(req));
+
+		pthread_mutex_lock(&rest.lock);
+	}
+
+	pthread_mutex_unlock(&rest.lock);
+
+	free_curl_context();
+
+	return NULL;
+}
+
+int init_rest_threads(struct mg_mgr *mgr, int count)
+{
+	int			 i;
+
+	if (count <= 0)
+		count = DEFAULT_REST_THREADS;
+	else if (count > MAX_REST_THREADS)
+		count = MAX_REST_THREADS;
+
+	rest.threads = calloc(count, sizeof(pthread_t));
+	if (!rest.threads)
+		return -ENOMEM;
+
+	rest.mgr = mgr;
+
+	/* before the REST threads, which may hand it work */
+	init_job_thread();
+
+	for (i = 0; i < count; i++)
+		if (pthread_create(&rest.threads[i], NULL, rest_thread,
+				   NULL)) {
+			print_err("failed to start REST thread");
+			break;
+		}
+
+	rest.count = i;
+
+	if (!rest.count) {
+		free(rest.threads);
+		rest.threads = NULL;
+		return -EAGAIN;
+	}
+
+	print_info("Started %d REST threads", rest.count);
+
+	return 0;
+}
+
+/* called on the mongoose thread before the manager is freed */
+void cleanup_rest_threads(void)
+{
+	struct rest_request	*req, *next;
+	struct cached_get	*entry, *tmp;
+	int			 i;
+
+	pthread_mutex_lock(&rest.lock);
+	rest.stopping = 1;
+	pthread_cond_broadcast(&rest.ready);
+	pthread_mutex_unlock(&rest.lock);
+
+	for (i = 0; i < rest.count; i++)
+		pthread_join(rest.threads[i], NULL);
+
+	list_for_each_entry_safe(req, next, &rest.queue, node) {
+		list_del(&req->node);
+		if (req->conn)
+			req->conn->user_data = NULL;
+		free_pipelined(req);
+	}
+
+	send_replies(NULL, 0, NULL);
+
+	cleanup_job_thread();
+
+	list_for_each_entry_safe(entry, tmp, &get_cache.list, node)
+		free_cached_get(entry);
+
+	free(rest.threads);
+	rest.threads = NULL;
+	rest.count = 0;
+}
+
+/* the request in flight is freed when done, those behind it right away */
+void close_http_request(struct mg_connection *c)
+{
+	struct rest_request	*req = c->user_data;
+
+	if (c->flags & MG_F_WATCH) {
+		stop_watch(c);
+		return;
+	}
+
+	if (!req)
+		return;
+
+	pthread_mutex_lock(&rest.lock);
+
+	req->conn = NULL;
+	free_pipelined(req->next);
+	req->next = NULL;
+
+	pthread_mutex_unlock(&rest.lock);
+
+	c->user_data = NULL;
+}
+
+void handle_http_request(struct mg_connection *c, void *ev_data)
+{
+	struct http_message	*hm = (struct http_message *) ev_data;
+	struct rest_request	*req;
+	struct rest_request	*last;
+	struct mg_str		 gz;
+	bool			 keep = keep_alive(hm);
+	char			 etag[ETAG_SIZE];
+	char			*resp;
+	u64			 start;
+	int			 ret;
+
+	/* a watch stream has the connection to itself */
+	if (c->flags & MG_F_WATCH)
+		return;
+
+	if (!c->user_data && is_equal(&hm->method, &s_get_method) &&
+	    mg_vcmp(&hm->uri, "/" URI_DEM "/" URI_WATCH) == 0) {
+		if (!is_authorized(hm))
+			send_reply(c, HTTP_ERR_FORBIDDEN, "", false, NULL);
+		else if (start_watch(c, hm))
+			send_reply(c, HTTP_ERR_INTERNAL, NULL, false, NULL);
+		return;
+	}
+
+	/* answered right away only if nothing is ahead of it */
+	if (!c->user_data && !hm->uri.len) {
+		send_reply(c, HTTP_ERR_PAGE_NOT_FOUND, NULL, keep, NULL);
+		return;
+	}
+
+	if (!c->user_data && is_equal(&hm->method, &s_options_method)) {
+		send_reply(c, -1, "", keep, NULL);
+		return;
+	}
+
+	if (!rest.count) {
+		resp = malloc(BODY_SIZE);
+		if (!resp) {
+			send_reply(c, HTTP_ERR_INTERNAL, NULL, keep, NULL);
+			return;
+		}
+
+		start = time_usec();
+		ret = run_request(hm, &resp, etag);
+		time_rest_request(rest_method(hm), time_usec() - start);
+
+		gz.p = gzip_reply(hm, ret, resp, &gz.len);
+		send_encoded_reply(c, ret, resp, gz.p ? &gz : NULL, keep,
+				   etag);
+		free((char *) gz.p);
+		free(resp);
+		return;
+	}
+
+	req = copy_request(c, hm);
+	if (!req) {
+		/* a reply now would overtake the ones still pending */
+		if (c->user_data)
+			c->flags |= MG_F_CLOSE_IMMEDIATELY;
+		else
+			send_reply(c, HTTP_ERR_INTERNAL, NULL, false, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&rest.lock);
+
+	last = c->user_data;
+	if (last) {
+		while (last->next)
+			last = last->next;
+		last->next = req;
+	} else {
+		c->user_data = req;
+		queue_request(req);
+	}
 
-	json_spinunlock();
+	pthread_mutex_unlock(&rest.lock);
 }
@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+
+#define HEAP_CHUNK		64
+#define REFRESH_JITTER		10 /* percent */
+#define KEEP_ALIVE_JITTER	10 /* percent */
+#define RETRY_JITTER		20 /* percent */
+#define RETRY_BASE		(LOG_PAGE_RETRY * IDLE_TIMEOUT)
+#define RETRY_MAX		(30 * MINUTES)
+#define DOWN_THRESHOLD		3 /* consecutive failures */
+
+/*
+ * Per target deadlines (keep-alive, refresh and log page retry) are kept
+ * as absolute times; a target sits in a min-heap keyed by the earliest of
+ * them so the poll loop only ever looks at the targets that are due.
+ */
+static struct {
+	pthread_mutex_t		 lock;
+	struct target		**heap;
+	int			 count;
+	int			 size;
+} timers = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+u64 time_msec(void)
+{
+	struct timespec		 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+u64 time_usec(void)
+{
+	struct timespec		 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* spread interval by up to +/- percent so targets don't fire in lock step */
+static u64 jitter(u64 interval, int percent, bool late)
+{
+	u64			 range = interval * percent / 100;
+
+	if (!range)
+		return interval;
+
+	if (!late)
+		return interval - random() % range;
+
+	return interval - range + random() % (2 * range);
+}
+
+static inline void heap_swap(int i, int j)
+{
+	struct target		*t = timers.heap[i];
+
+	timers.heap[i] = timers.heap[j];
+	timers.heap[j] = t;
+
+	timers.heap[i]->timer_index = i;
+	timers.heap[j]->timer_index = j;
+}
+
+static void heap_up(int i)
+{
+	int			 parent;
+
+	while (i) {
+		parent = (i - 1) / 2;
+		if (timers.heap[parent]->timer <= timers.heap[i]->timer)
+			break;
+		heap_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(int i)
+{
+	int			 child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= timers.count)
+			break;
+		if (child + 1 < timers.count &&
+		    timers.heap[child + 1]->timer < timers.heap[child]->timer)
+			child++;
+		if (timers.heap[i]->timer <= timers.heap[child]->timer)
+			break;
+		heap_swap(i, child);
+		i = child;
+	}
+}
+
+static void heap_remove(struct target *target)
+{
+	int			 i = target->timer_index;
+
+	target->timer_index = -1;
+
+	if (--timers.count == i)
+		return;
+
+	timers.heap[i] = timers.heap[timers.count];
+	timers.heap[i]->timer_index = i;
+
+	heap_up(i);
+	heap_down(i);
+}
+
+static int heap_insert(struct target *target)
+{
+	struct target		**heap;
+
+	if (timers.count == timers.size) {
+		heap = realloc(timers.heap, (timers.size + HEAP_CHUNK) *
+			       sizeof(*heap));
+		if (!heap)
+			return -ENOMEM;
+
+		timers.heap = heap;
+		timers.size += HEAP_CHUNK;
+	}
+
+	target->timer_index = timers.count;
+	timers.heap[timers.count++] = target;
+
+	heap_up(target->timer_index);
+
+	return 0;
+}
+
+/* (re)queue the target to be looked at again at the given time */
+void set_target_timer(struct target *target, u64 when)
+{
+	pthread_mutex_lock(&timers.lock);
+
+	if (target->timer_index >= 0)
+		heap_remove(target);
+
+	target->timer = when;
+
+	if (heap_insert(target))
+		print_err("unable to arm timer for target %s", target->alias);
+
+	pthread_mutex_unlock(&timers.lock);
+}
+
+void del_target_timer(struct target *target)
+{
+	pthread_mutex_lock(&timers.lock);
+
+	if (target->timer_index >= 0)
+		heap_remove(target);
+
+	pthread_mutex_unlock(&timers.lock);
+}
+
+/* pop the next target whose timer has expired, if any */
+struct target *next_expired_target(u64 now)
+{
+	struct target		*target = NULL;
+
+	pthread_mutex_lock(&timers.lock);
+
+	if (timers.count && timers.heap[0]->timer <= now) {
+		target = timers.heap[0];
+		heap_remove(target);
+	}
+
+	pthread_mutex_unlock(&timers.lock);
+
+	return target;
+}
+
+u64 next_refresh(struct target *target, u64 now)
+{
+	if (target->refresh <= 0)
+		return TIMER_NEVER;
+
+	return now + jitter((u64) target->refresh * MINUTES, REFRESH_JITTER,
+			    true);
+}
+
+u64 next_keep_alive(u64 now)
+{
+	return now + jitter(KEEP_ALIVE_TIMER / 2, KEEP_ALIVE_JITTER, false);
+}
+
+void set_log_page_retry(struct target *target)
+{
+	set_target_state(target, retry_deadline,
+			 time_msec() + LOG_PAGE_RETRY * IDLE_TIMEOUT);
+}
+
+static u64 retry_backoff(int failures)
+{
+	u64			 delay = RETRY_BASE;
+
+	while (--failures > 0 && delay < RETRY_MAX)
+		delay <<= 1;
+
+	return jitter(min(delay, (u64) RETRY_MAX), RETRY_JITTER, true);
+}
+
+/*
+ * A failed keep-alive, refresh or probe degrades the target and backs off
+ * its retry exponentially; after DOWN_THRESHOLD failures in a row the
+ * circuit opens and the target is left alone until the retry is due.
+ */
+void target_failed(struct target *target)
+{
+	set_target_state(target, failures, target->failures + 1);
+
+	if (target->failures >= DOWN_THRESHOLD) {
+		if (target->health != TARGET_DOWN &&
+		    target->health != TARGET_PROBING)
+			print_info("target %s is down", target->alias);
+		set_target_state(target, health, TARGET_DOWN);
+	} else
+		set_target_state(target, health, TARGET_DEGRADED);
+
+	set_target_state(target, retry_deadline,
+			 time_msec() + retry_backoff(target->failures));
+}
+
+void target_succeeded(struct target *target)
+{
+	if (target->health == TARGET_DOWN || target->health == TARGET_PROBING)
+		print_info("target %s is back up", target->alias);
+
+	set_target_state(target, health, TARGET_HEALTHY);
+	set_target_state(target, failures, 0);
+	set_target_state(target, retry_deadline, TIMER_NEVER);
+}
+
+const char *target_health_str(int health)
+{
+	switch (health) {
+	case TARGET_HEALTHY:
+		return "healthy";
+	case TARGET_DEGRADED:
+		return "degraded";
+	case TARGET_DOWN:
+		return "down";
+	case TARGET_PROBING:
+		return "probing";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+ * earliest deadline, a pending retry holds off the periodic refresh and
+ * a target that is down has nothing due before its next probe
+ */
+u64 target_deadline(struct target *target)
+{
+	u64			 refresh = target->refresh_deadline;
+	u64			 deadline;
+
+	if (target->health == TARGET_DOWN)
+		return target->retry_deadline;
+
+	if (target->retry_deadline != TIMER_NEVER)
+		refresh = target->retry_deadline;
+
+	deadline = min(target->kato_deadline, refresh);
+
+	return min(deadline, target->push_deadline);
+}
+
+void arm_target_timers(struct target *target)
+{
+	u64			 now = time_msec();
+
+	target->kato_deadline = next_keep_alive(now);
+	target->refresh_deadline = next_refresh(target, now);
+	set_target_state(target, retry_deadline, TIMER_NEVER);
+
+	set_target_timer(target, target_deadline(target));
+}
+
+void init_timers(void)
+{
+	srandom(time(NULL) ^ getpid());
+}
+
+void cleanup_timers(void)
+{
+	pthread_mutex_lock(&timers.lock);
+
+	while (timers.count)
+		heap_remove(timers.heap[0]);
+
+	free(timers.heap);
+	timers.heap = NULL;
+	timers.size = 0;
+
+	pthread_mutex_unlock(&timers.lock);
+}
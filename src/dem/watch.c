@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mongoose.h"
+#include "common.h"
+
+#define WATCH_EVENTS		1024	/* events kept for resuming */
+#define WATCH_PING		30	/* seconds between keep-alives */
+#define WATCH_ID_SIZE		24
+
+/*
+ * GET /dem/watch streams config and log page changes as server-sent
+ * events.  Each changed target, host or group, and each target whose log
+ * pages changed, is one event carrying the name and its generation.  Events
+ * are numbered and the last WATCH_EVENTS are kept, so a client that drops
+ * can resume with ?since=<id> or the Last-Event-ID header.  A client that
+ * fell further behind, or comes from before a restart, gets a reset event
+ * and should reread what it follows.
+ *
+ * Changes are recorded from any thread, often with the json lock held, so
+ * recording one never waits on the mongoose thread: it only flags the news.
+ * The connections are only written on the mongoose thread, which looks at
+ * the flag after every poll, so events go out within IDLE_TIMEOUT.
+ */
+struct watch_event {
+	u64			 id;
+	u64			 gen;
+	const char		*type;
+	char			*name;
+	bool			 deleted;
+};
+
+struct watcher {
+	u64			 seq;		/* last event sent */
+};
+
+static struct {
+	pthread_mutex_t		 lock;
+	struct watch_event	 events[WATCH_EVENTS];
+	u64			 first;		/* first id of this run */
+	u64			 seq;		/* id of the last event */
+	struct mg_mgr		*mgr;
+	int			 count;		/* open watch connections */
+	bool			 pending;	/* events not yet flushed */
+	time_t			 ping;
+} watch = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* ids carry on from the previous run so stale ones are never replayed */
+static void seed_ids(void)
+{
+	if (watch.first)
+		return;
+
+	watch.seq = (u64) time(NULL) << 20;
+	watch.first = watch.seq + 1;
+}
+
+/* call with watch.lock held */
+static void send_events(struct mg_connection *c)
+{
+	struct watcher		*w = c->user_data;
+	struct watch_event	*e;
+	u64			 oldest = watch.first;
+
+	if (watch.seq >= oldest + WATCH_EVENTS)
+		oldest = watch.seq - WATCH_EVENTS + 1;
+
+	if (w->seq + 1 < oldest) {
+		mg_printf(c, "id: %llu\nevent: reset\ndata: {}\n\n",
+			  watch.seq);
+		w->seq = watch.seq;
+	}
+
+	while (w->seq < watch.seq) {
+		e = &watch.events[++w->seq % WATCH_EVENTS];
+		mg_printf(c, "id: %llu\nevent: %s\ndata: {"
+			  JSSTR "," JSINT ",\"%s\":%s}\n\n",
+			  e->id, e->type, TAG_NAME, e->name ? e->name : "",
+			  TAG_GENERATION, e->gen, TAG_DELETED,
+			  e->deleted ? "true" : "false");
+	}
+}
+
+void watch_event(const char *type, const char *name, u64 gen, bool deleted)
+{
+	struct watch_event	*e;
+
+	pthread_mutex_lock(&watch.lock);
+
+	seed_ids();
+
+	e = &watch.events[++watch.seq % WATCH_EVENTS];
+	free(e->name);
+	e->id = watch.seq;
+	e->gen = gen;
+	e->type = type;
+	e->name = strdup(name);
+	e->deleted = deleted;
+
+	if (watch.count)
+		watch.pending = true;
+
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/* runs on the mongoose thread after each poll, takes no other lock */
+void flush_watchers(void)
+{
+	struct mg_connection	*c;
+
+	pthread_mutex_lock(&watch.lock);
+
+	if (watch.pending && watch.mgr)
+		for (c = mg_next(watch.mgr, NULL); c; c = mg_next(watch.mgr, c))
+			if (c->flags & MG_F_WATCH)
+				send_events(c);
+
+	watch.pending = false;
+
+	pthread_mutex_unlock(&watch.lock);
+}
+
+int start_watch(struct mg_connection *c, struct http_message *hm)
+{
+	struct watcher		*w;
+	struct mg_str		*hdr;
+	char			 id[WATCH_ID_SIZE];
+
+	w = malloc(sizeof(*w));
+	if (!w)
+		return -ENOMEM;
+
+	*id = 0;
+	hdr = mg_get_http_header(hm, "Last-Event-ID");
+	if (mg_get_http_var(&hm->query_string, URI_PARM_SINCE, id,
+			    sizeof(id)) <= 0 && hdr && hdr->len < sizeof(id))
+		sprintf(id, "%.*s", (int) hdr->len, hdr->p);
+
+	pthread_mutex_lock(&watch.lock);
+
+	seed_ids();
+
+	/* ids from the future are from another run, start them over */
+	w->seq = *id ? strtoull(id, NULL, 10) : watch.seq;
+	if (w->seq > watch.seq)
+		w->seq = 0;
+
+	watch.count++;
+
+	c->user_data = w;
+	c->flags |= MG_F_WATCH;
+
+	mg_printf(c, "HTTP/1.1 200 OK\r\n"
+		  "Access-Control-Allow-Origin:*\r\n"
+		  "Content-Type: text/event-stream\r\n"
+		  "Cache-Control: no-cache\r\n"
+		  "Connection: keep-alive\r\n\r\n");
+
+	send_events(c);
+
+	pthread_mutex_unlock(&watch.lock);
+
+	return 0;
+}
+
+void stop_watch(struct mg_connection *c)
+{
+	pthread_mutex_lock(&watch.lock);
+	watch.count--;
+	pthread_mutex_unlock(&watch.lock);
+
+	free(c->user_data);
+	c->user_data = NULL;
+	c->flags &= ~MG_F_WATCH;
+}
+
+/* comments keep idle streams from being dropped by proxies */
+void ping_watchers(void)
+{
+	struct mg_connection	*c;
+	time_t			 now = time(NULL);
+
+	if (!watch.count || now - watch.ping < WATCH_PING)
+		return;
+
+	watch.ping = now;
+
+	for (c = mg_next(watch.mgr, NULL); c; c = mg_next(watch.mgr, c))
+		if (c->flags & MG_F_WATCH)
+			mg_printf(c, ": ping\n\n");
+}
+
+void init_watch(struct mg_mgr *mgr)
+{
+	pthread_mutex_lock(&watch.lock);
+	seed_ids();
+	watch.mgr = mgr;
+	watch.ping = time(NULL);
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/* before the manager goes away, changes are still recorded after this */
+void cleanup_watch(void)
+{
+	pthread_mutex_lock(&watch.lock);
+	watch.mgr = NULL;
+	pthread_mutex_unlock(&watch.lock);
+}
@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: DUAL GPL-2.0/BSD
+/*
+ * NVMe over Fabrics Distributed Endpoint Management (NVMe-oF DEM).
+ * Copyright (c) 2017-2019 Intel Corporation, Inc. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "curl.h"
+
+#define MAX_WORKERS		64
+
+/*
+ * Background target work (keep-alive, get config, log page refresh) runs
+ * on a pool of worker threads so a slow or unreachable target no longer
+ * stalls the poll loop or the other targets.  A target is only ever on the
+ * queue once and only ever run by one worker at a time; the work itself is
+ * done with the target lock held so REST requests against the same target
+ * are serialized with it.
+ */
+struct work_pool {
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work_ready;
+	pthread_cond_t		 work_done;
+	struct linked_list	 queue;
+	struct linked_list	 fan_outs;	/* see fan_out_targets() */
+	pthread_t		*threads;
+	void			(*work)(struct target *target, int flags);
+	int			 count;
+	int			 running;
+	int			 suspended;
+	int			 stopping;
+};
+
+static struct work_pool pool = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.work_ready	= PTHREAD_COND_INITIALIZER,
+	.work_done	= PTHREAD_COND_INITIALIZER,
+	.queue		= LINKED_LIST_INIT(pool.queue),
+	.fan_outs	= LINKED_LIST_INIT(pool.fan_outs),
+};
+
+/*
+ * A REST request that changes many targets at once has the per target
+ * pushes run by the worker pool, so the request takes about one round trip
+ * rather than one per target, and the pushes use the connections the
+ * workers keep open.  Workers take fan out items even while suspended:
+ * the caller must keep the pool off the targets, e.g. with
+ * suspend_workers(), and fn() may only touch the target it is given.
+ */
+struct fan_out {
+	struct linked_list	 node;
+	struct target		**targets;
+	int			*results;
+	int			 count;
+	int			 next;
+	int			 done;
+	int			(*fn)(struct target *target, void *arg);
+	void			*arg;
+};
+
+/* call with pool.lock held */
+static struct fan_out *next_fan_out(void)
+{
+	struct fan_out		*f;
+
+	list_for_each_entry(f, &pool.fan_outs, node)
+		if (f->next < f->count)
+			return f;
+
+	return NULL;
+}
+
+/* call with pool.lock held and items left, it is dropped while fn() runs */
+static void run_fan_out_item(struct fan_out *f)
+{
+	int			 i;
+
+	i = f->next++;
+
+	pthread_mutex_unlock(&pool.lock);
+
+	f->results[i] = f->fn(f->targets[i], f->arg);
+
+	pthread_mutex_lock(&pool.lock);
+
+	if (++f->done == f->count)
+		pthread_cond_broadcast(&pool.work_done);
+}
+
+void lock_target(struct target *target)
+{
+	pthread_mutex_lock(&target->lock);
+}
+
+bool trylock_target(struct target *target)
+{
+	return !pthread_mutex_trylock(&target->lock);
+}
+
+void unlock_target(struct target *target)
+{
+	pthread_mutex_unlock(&target->lock);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct target		*target;
+	struct fan_out		*f;
+	int			 flags;
+
+	UNUSED(arg);
+
+	pthread_mutex_lock(&pool.lock);
+
+	while (!pool.stopping) {
+		f = next_fan_out();
+		if (f) {
+			run_fan_out_item(f);
+			continue;
+		}
+
+		if (pool.suspended || list_empty(&pool.queue)) {
+			pthread_cond_wait(&pool.work_ready, &pool.lock);
+			continue;
+		}
+
+		target = list_first_entry(&pool.queue, struct target,
+					  work_node);
+		list_del(&target->work_node);
+
+		flags = target->work_flags;
+		target->work_flags = 0;
+		target->work_state = WORK_RUNNING;
+		pool.running++;
+
+		pthread_mutex_unlock(&pool.lock);
+
+		lock_target(target);
+		pool.work(target, flags);
+		unlock_target(target);
+
+		pthread_mutex_lock(&pool.lock);
+
+		target->work_state = WORK_IDLE;
+		pool.running--;
+
+		pthread_cond_broadcast(&pool.work_done);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+
+	free_curl_context();
+
+	return NULL;
+}
+
+bool target_work_pending(struct target *target)
+{
+	bool			 pending;
+
+	pthread_mutex_lock(&pool.lock);
+	pending = target->work_state != WORK_IDLE;
+	pthread_mutex_unlock(&pool.lock);
+
+	return pending;
+}
+
+void schedule_target_work(struct target *target, int flags)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	target->work_flags |= flags;
+
+	if (target->work_state == WORK_IDLE) {
+		target->work_state = WORK_QUEUED;
+		list_add_tail(&target->work_node, &pool.queue);
+		pthread_cond_signal(&pool.work_ready);
+	}
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* must not be called with the target lock held */
+void cancel_target_work(struct target *target)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	if (target->work_state == WORK_QUEUED) {
+		list_del(&target->work_node);
+		target->work_state = WORK_IDLE;
+	}
+
+	while (target->work_state == WORK_RUNNING)
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+
+	target->work_flags = 0;
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/* wait for running work to finish and hold off new work until resumed */
+void suspend_workers(void)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	pool.suspended++;
+
+	while (pool.running)
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void resume_workers(void)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	if (!--pool.suspended)
+		pthread_cond_broadcast(&pool.work_ready);
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*
+ * The poll loop counts as running while it decides what is due, so a
+ * request that suspended the workers to change targets without locking
+ * them is not raced by it.  Returns false while the workers are suspended.
+ */
+bool begin_periodic_work(void)
+{
+	bool			 ok;
+
+	pthread_mutex_lock(&pool.lock);
+
+	ok = !pool.suspended;
+	if (ok)
+		pool.running++;
+
+	pthread_mutex_unlock(&pool.lock);
+
+	return ok;
+}
+
+void end_periodic_work(void)
+{
+	pthread_mutex_lock(&pool.lock);
+
+	pool.running--;
+	pthread_cond_broadcast(&pool.work_done);
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void fan_out_targets(struct target **targets, int count, int *results,
+		     int (*fn)(struct target *target, void *arg), void *arg)
+{
+	struct fan_out		 f = {
+		.targets	= targets,
+		.results	= results,
+		.count		= count,
+		.fn		= fn,
+		.arg		= arg,
+	};
+
+	if (!count)
+		return;
+
+	pthread_mutex_lock(&pool.lock);
+
+	list_add_tail(&f.node, &pool.fan_outs);
+	pthread_cond_broadcast(&pool.work_ready);
+
+	/* the calling thread does its share too */
+	while (f.next < f.count)
+		run_fan_out_item(&f);
+
+	while (f.done < f.count)
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+
+	list_del(&f.node);
+
+	pthread_mutex_unlock(&pool.lock);
+}
+
+int init_workers(int count, void (*work)(struct target *target, int flags))
+{
+	int			 i;
+
+	if (count <= 0)
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count <= 0)
+		count = 1;
+	else if (count > MAX_WORKERS)
+		count = MAX_WORKERS;
+
+	pool.threads = calloc(count, sizeof(pthread_t));
+	if (!pool.threads)
+		return -ENOMEM;
+
+	pool.work = work;
+
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&pool.threads[i], NULL, worker_thread,
+				   NULL)) {
+			print_err("failed to start worker thread");
+			break;
+		}
+	}
+
+	pool.count = i;
+
+	if (!pool.count) {
+		free(pool.threads);
+		pool.threads = NULL;
+		return -EAGAIN;
+	}
+
+	print_info("Started %d worker threads", pool.count);
+
+	return 0;
+}
+
+void cleanup_workers(void)
+{
+	struct target		*target, *next;
+	int			 i;
+
+	pthread_mutex_lock(&pool.lock);
+
+	pool.stopping = 1;
+
+	list_for_each_entry_safe(target, next, &pool.queue, work_node) {
+		list_del(&target->work_node);
+		target->work_state = WORK_IDLE;
+	}
+
+	pthread_cond_broadcast(&pool.work_ready);
+
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.count; i++)
+		pthread_join(pool.threads[i], NULL);
+
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.count = 0;
+}
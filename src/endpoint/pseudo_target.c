@@ -434,88 +434,165 @@ static int handle_mi_receive(struct endpoint *ep, struct nvme_command *cmd,
 	return ret;
 }
 
-static int handle_mi_send(struct endpoint *ep, struct nvme_command *cmd,
-			  u64 addr, u64 key, u64 len)
+static int set_config(int fcid, void *data)
 {
-	struct nvme_mi_command	 *c = &cmd->mi_cmd;
 	int			  ret;
 
-	ret = ep->ops->rma_read(ep->ep, ep->data, addr, len, key, ep->data_mr);
-	if (ret) {
-		print_errno("rma_read failed", ret);
-		goto out;
-	}
-
-	switch (c->fcid) {
+	switch (fcid) {
 	case nvmf_reset_config:
 		ops->reset_config();
-		ret = 0;
-		break;
+		return 0;
 	case nvmf_set_port_config:
-		ret = set_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_portid(data);
 		break;
 	case nvmf_del_port_config:
-		ret = del_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_portid(data);
 		break;
 	case nvmf_link_port_config:
-		ret = link_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = link_portid(data);
 		break;
 	case nvmf_unlink_port_config:
-		ret = unlink_portid(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = unlink_portid(data);
 		break;
 	case nvmf_set_subsys_config:
-		ret = set_subsys(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_subsys(data);
 		break;
 	case nvmf_del_subsys_config:
-		ret = del_subsys(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_subsys(data);
 		break;
 	case nvmf_set_ns_config:
-		ret = set_ns(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_ns(data);
 		break;
 	case nvmf_del_ns_config:
-		ret = del_ns(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_ns(data);
 		break;
 	case nvmf_set_host_config:
-		ret = set_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = set_host(data);
 		break;
 	case nvmf_del_host_config:
-		ret = del_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = del_host(data);
 		break;
 	case nvmf_link_host_config:
-		ret = link_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = link_host(data);
 		break;
 	case nvmf_unlink_host_config:
-		ret = unlink_host(ep->data);
-		if (ret)
-			ret = NVME_SC_ACCESS_DENIED;
+		ret = unlink_host(data);
 		break;
 	default:
-		print_err("unknown set config id %x", c->command_id);
-		ret = NVME_SC_INVALID_FIELD;
+		print_err("unknown set config id %x", fcid);
+		return NVME_SC_INVALID_FIELD;
+	}
+
+	return ret ? NVME_SC_ACCESS_DENIED : 0;
+}
+
+/* what set_config() reads for each fcid, unknown ones it rejects unread */
+static size_t config_entry_size(int fcid)
+{
+	switch (fcid) {
+	case nvmf_set_port_config:
+		return sizeof(struct nvmf_port_config_entry);
+	case nvmf_del_port_config:
+		return sizeof(struct nvmf_port_delete_entry);
+	case nvmf_link_port_config:
+	case nvmf_unlink_port_config:
+		return sizeof(struct nvmf_link_port_entry);
+	case nvmf_set_subsys_config:
+		return sizeof(struct nvmf_subsys_config_entry);
+	case nvmf_del_subsys_config:
+		return sizeof(struct nvmf_subsys_delete_entry);
+	case nvmf_set_ns_config:
+		return sizeof(struct nvmf_ns_config_entry);
+	case nvmf_del_ns_config:
+		return sizeof(struct nvmf_ns_delete_entry);
+	case nvmf_set_host_config:
+		return sizeof(struct nvmf_host_config_entry);
+	case nvmf_del_host_config:
+		return sizeof(struct nvmf_host_delete_entry);
+	case nvmf_link_host_config:
+	case nvmf_unlink_host_config:
+		return sizeof(struct nvmf_link_host_entry);
+	default:
+		return 0;
+	}
+}
+
+/* the whole batch is checked before any of it is applied */
+static int handle_batch_config(void *data, u64 len, u64 *failed)
+{
+	struct nvmf_batch_config_hdr *hdr = data;
+	struct nvmf_batch_config_entry *entry;
+	u64			  offset;
+	int			  n;
+	int			  i;
+
+	if (len < sizeof(*hdr))
+		return NVME_SC_INVALID_FIELD;
+
+	n = le16toh(hdr->num_entries);
+	if (n > NVMF_BATCH_MAX_ENTRIES)
+		return NVME_SC_INVALID_FIELD;
+
+	offset = sizeof(*hdr);
+	for (i = 0; i < n; i++) {
+		entry = (void *) ((char *) data + offset);
+		if (offset + sizeof(*entry) > len ||
+		    entry->fcid == nvmf_batch_config ||
+		    le16toh(entry->len) < config_entry_size(entry->fcid))
+			return NVME_SC_INVALID_FIELD;
+
+		offset += NVMF_BATCH_ENTRY_SIZE(le16toh(entry->len));
+		if (offset > len)
+			return NVME_SC_INVALID_FIELD;
+	}
+
+	*failed = 0;
+
+	offset = sizeof(*hdr);
+	for (i = 0; i < n; i++) {
+		entry = (void *) ((char *) data + offset);
+		if (set_config(entry->fcid, entry + 1))
+			*failed |= 1ULL << i;
+
+		offset += NVMF_BATCH_ENTRY_SIZE(le16toh(entry->len));
+	}
+
+#ifdef DEBUG_COMMANDS
+	print_debug("nvme_fabrics_set_config - batch of %d, failed %llx", n,
+		    (unsigned long long) *failed);
+#endif
+
+	return 0;
+}
+
+static int handle_mi_send(struct endpoint *ep, struct nvme_command *cmd,
+			  struct nvme_completion *resp, u64 addr, u64 key,
+			  u64 len)
+{
+	struct nvme_mi_command	 *c = &cmd->mi_cmd;
+	u64			  failed;
+	int			  ret;
+
+	if (len > PAGE_SIZE)
+		return NVME_SC_INVALID_FIELD;
+
+	ret = ep->ops->rma_read(ep->ep, ep->data, addr, len, key, ep->data_mr);
+	if (ret) {
+		print_errno("rma_read failed", ret);
+		goto out;
+	}
+
+	if (c->fcid != nvmf_batch_config) {
+		if (len < config_entry_size(c->fcid))
+			return NVME_SC_INVALID_FIELD;
+
+		ret = set_config(c->fcid, ep->data);
+		goto out;
 	}
 
+	ret = handle_batch_config(ep->data, len, &failed);
+	if (!ret)
+		resp->result.U64 = htole64(failed);
 out:
 	return ret;
 }
@@ -563,7 +640,7 @@ static int handle_request(struct host_conn *host, struct qe *qe, void *buf,
 			ret = NVME_SC_INVALID_OPCODE;
 		}
 	} else if (cmd->common.opcode == nvme_mi_send)
-		ret = handle_mi_send(ep, cmd, addr, key, len);
+		ret = handle_mi_send(ep, cmd, resp, addr, key, len);
 	else if (cmd->common.opcode == nvme_mi_receive)
 		ret = handle_mi_receive(ep, cmd, addr, key, len);
 	else if (cmd->common.opcode == nvme_admin_identify)
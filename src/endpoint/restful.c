@@ -701,12 +701,28 @@ static int handle_target_requests(char *p[], int n, struct http_message *hm,
 
 #define MAX_DEPTH 8
 
+/* HTTP/1.1 connections persist unless the client asks to close them */
+static bool keep_alive(struct http_message *hm)
+{
+	struct mg_str		*hdr;
+
+	hdr = mg_get_http_header(hm, "Connection");
+	if (hdr)
+		return mg_vcasecmp(hdr, "close") != 0;
+
+	return mg_vcmp(&hm->proto, HTTP_HDR) == 0;
+}
+
 void handle_http_request(struct mg_connection *c, void *ev_data)
 {
 	struct http_message	*hm = (struct http_message *) ev_data;
+	struct mg_str		*hdr;
 	char			*resp = NULL;
 	char			*uri = NULL;
+	char			*gz = NULL;
 	char			*parts[MAX_DEPTH] = { NULL };
+	bool			 keep = keep_alive(hm);
+	size_t			 gz_len = 0;
 	int			 ret;
 	int			 n;
 
@@ -746,25 +762,43 @@ void handle_http_request(struct mg_connection *c, void *ev_data)
 	}
 
 	ret = handle_target_requests(parts, n+1, hm, resp);
+
+	/* large replies go gzip encoded to clients that take it */
+	hdr = mg_get_http_header(hm, "Accept-Encoding");
+	if (!ret && hdr && gzip_accepted(hdr->p, hdr->len) &&
+	    strlen(resp) >= GZIP_MIN_SIZE)
+		gz = gzip_body(resp, strlen(resp), &gz_len);
 out:
 	if (!ret)
 		mg_printf(c, "%s %d OK", HTTP_HDR, HTTP_OK);
 	else
 		mg_printf(c, "%s %d %s", HTTP_HDR, ret, http_error_str(ret));
 
+	/* the body is exactly Content-Length bytes so the connection
+	 * can be reused for the next request
+	 */
+	mg_printf(c, "\r\nConnection: %s", keep ? "keep-alive" : "close");
 	mg_printf(c, "\r\nContent-Type: plain/text");
-	if (resp) {
+	if (gz) {
+		mg_printf(c, "\r\nContent-Encoding: gzip");
+		mg_printf(c, "\r\nVary: Accept-Encoding");
+		mg_printf(c, "\r\nContent-Length: %ld\r\n\r\n", gz_len);
+		mg_send(c, gz, gz_len);
+	} else if (resp) {
 		mg_printf(c, "\r\nContent-Length: %ld\r\n", strlen(resp));
-		mg_printf(c, "\r\n%s\r\n\r\n", resp);
+		mg_printf(c, "\r\n%s", resp);
 	} else {
 		mg_printf(c, "\r\nContent-Length: 14\r\n");
-		mg_printf(c, "\r\nInternal Error\r\n\r\n");
+		mg_printf(c, "\r\nInternal Error");
 	}
 
 	if (uri)
 		free(uri);
 	if (resp)
 		free(resp);
+	if (gz)
+		free(gz);
 
-	c->flags = MG_F_SEND_AND_CLOSE;
+	if (!keep)
+		c->flags |= MG_F_SEND_AND_CLOSE;
 }
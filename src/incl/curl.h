@@ -34,9 +34,16 @@
 
 int init_curl(int debug);
 void cleanup_curl(void);
+void free_curl_context(void);
 int exec_get(char *url, char **result);
 int exec_delete(char *url);
 int exec_delete_ex(char *url, char *data, int len);
 int exec_put(char *url, char *data, int len);
 int exec_post(char *url, char *data, int len);
 int exec_patch(char *url, char *data, int len);
+
+typedef void (*curl_batch_cb)(void *owner, int ret, void *arg);
+
+int curl_batch_begin(void);
+void curl_batch_owner(void *owner);
+int curl_batch_end(curl_batch_cb failed, void *arg);
@@ -184,6 +184,11 @@ int ipv4_to_addr(char *p, int *addr);
 int ipv6_to_addr(char *p, int *addr);
 int fc_to_addr(char *p, int *addr);
 
+#define GZIP_MIN_SIZE		1024
+
+bool gzip_accepted(const char *hdr, size_t len);
+char *gzip_body(const char *body, size_t len, size_t *gz_len);
+
 int connect_ctrl(struct ctrl_queue *ctrl);
 void disconnect_ctrl(struct ctrl_queue *ctrl, int shutdown);
 int client_connect(struct endpoint *ep, void *data, int bytes);
@@ -196,6 +201,7 @@ int send_set_features(struct endpoint *ep, u8 fid, u32 dword11);
 int send_async_event_request(struct endpoint *ep);
 int send_keep_alive(struct endpoint *ep);
 int send_mi_send(struct endpoint *ep, int cid, int len, void *data);
+int send_mi_send_batch(struct endpoint *ep, int len, void *data, u64 *failed);
 int send_mi_receive(struct endpoint *ep, int cid, int len, void **data);
 
 int send_del_target(struct target *target);
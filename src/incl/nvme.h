@@ -529,6 +529,7 @@ enum {
 	nvmf_del_host_config	= 0x0a,
 	nvmf_link_host_config	= 0x0b,
 	nvmf_unlink_host_config	= 0x0c,
+	nvmf_batch_config	= 0x0d,
 };
 
 struct nvmf_resource_config_command {
@@ -592,6 +593,29 @@ struct nvmf_link_port_entry {
 	__le16			portid;
 };
 
+/*
+ * A batch carries up to NVMF_BATCH_MAX_ENTRIES set config entries in one
+ * MI send, each prefixed by its fcid and padded to 8 bytes.  Entries are
+ * applied in order; bit N of the completion result is set if entry N
+ * failed.
+ */
+#define NVMF_BATCH_MAX_ENTRIES	64
+#define NVMF_BATCH_SIZE		4096
+#define NVMF_BATCH_ENTRY_SIZE(len) \
+	(sizeof(struct nvmf_batch_config_entry) + (((len) + 7) & ~7))
+
+struct nvmf_batch_config_hdr {
+	__le16			num_entries;
+	__u8			rsvd[6];
+};
+
+struct nvmf_batch_config_entry {
+	__u8			fcid;
+	__u8			rsvd;
+	__le16			len;	/* of the entry that follows */
+	__u8			rsvd2[4];
+};
+
 struct nvmf_get_transports_entry {
 	__u8			trtype;
 	__u8			adrfam;
@@ -86,6 +86,40 @@
 #define TAG_NEW			"NEW"
 #define TAG_OLD			"OLD"
 
+/* DEM status specific */
+#define TAG_STARTUP		"Startup"
+#define TAG_READY		"Ready"
+#define TAG_FAILED		"Failed"
+#define TAG_COMPLETE		"Complete"
+
+/* Target health specific */
+#define TAG_STATE		"State"
+#define TAG_FAILURES		"Failures"
+#define TAG_NEXT_RETRY		"NextRetry"
+
+/* Bulk import specific */
+#define TAG_OPERATIONS		"Operations"
+#define TAG_METHOD		"Method"
+#define TAG_URI			"URI"
+#define TAG_BODY		"Body"
+
+/* Config journal specific */
+#define TAG_SECTION		"Section"
+#define TAG_KEY			"Key"
+#define TAG_VALUE		"Value"
+
+/* List specific */
+#define TAG_NEXT		"Next"
+
+/* Job specific */
+#define TAG_JOBS		"Jobs"
+#define TAG_STATUS		"Status"
+#define TAG_RESULT		"Result"
+
+/* Watch specific */
+#define TAG_GENERATION		"Generation"
+#define TAG_DELETED		"Deleted"
+
 #define URI_GROUP		"group"
 #define URI_TARGET		"target"
 #define URI_HOST		"host"
@@ -99,20 +133,32 @@
 #define URI_SIGNATURE		"signature"
 #define URI_LOG_PAGE		"logpage"
 #define URI_USAGE		"usage"
-#define URI_PARM_MODE		"mode="
-#define URI_PARM_FABRIC		"fabric="
+#define URI_HEALTH		"health"
+#define URI_IMPORT		"import"
+#define URI_WATCH		"watch"
+#define URI_METRICS		"metrics"
+#define URI_JOB			"job"
+
+/* list query parameters */
+#define URI_PARM_MODE		"mode"
+#define URI_PARM_FABRIC		"fabric"
+#define URI_PARM_GROUP		"group"
+#define URI_PARM_NQN		"nqn"
+#define URI_PARM_FIELDS		"fields"
+#define URI_PARM_LIMIT		"limit"
+#define URI_PARM_AFTER		"after"
+#define URI_PARM_SINCE		"since"
 
 #define GROUP_LEN		(sizeof(URI_GROUP) - 1)
 #define TARGET_LEN		(sizeof(URI_TARGET) - 1)
 #define HOST_LEN		(sizeof(URI_HOST) - 1)
 #define DEM_LEN			(sizeof(URI_DEM) - 1)
 #define V1_LEN			(sizeof(URI_V1) - 1)
-#define PARM_MODE_LEN		(sizeof(URI_PARM_MODE) - 1)
-#define PARM_FABRIC_LEN		(sizeof(URI_PARM_FABRIC) - 1)
 
 #define METHOD_SHUTDOWN		"shutdown"
 #define METHOD_REFRESH		"refresh"
 #define METHOD_RECONFIG		"reconfig"
+#define METHOD_COMMIT		"commit"
 
 #define DEFAULT_HTTP_ADDR	"127.0.0.1"
 #define DEFAULT_HTTP_PORT	"22345"